@@ -76,6 +76,8 @@ class BoardInfo:
     gcc_cpu: Optional[str]
     loader_link_address: int
     kernel_options: KERNEL_OPTIONS
+    # Number of CPUs the loader may use to copy the system image into place.
+    loader_num_cpus: int = 1
 
 
 @dataclass
@@ -231,6 +233,7 @@ SUPPORTED_BOARDS = (
             "KernelArmVtimerUpdateVOffset": False,
             "KernelAllowSMCCalls": True,
         },
+        loader_num_cpus=4,
     ),
     BoardInfo(
         name="qemu_virt_riscv64",
@@ -244,6 +247,7 @@ SUPPORTED_BOARDS = (
             "KernelRiscvExtD": True,
             "KernelRiscvExtF": True,
         },
+        loader_num_cpus=4,
     ),
     BoardInfo(
         name="rpi4b_1gb",
@@ -385,6 +389,17 @@ SUPPORTED_CONFIGS = (
             "KernelBenchmarks": "track_utilisation"
         },
     ),
+    ConfigInfo(
+        name="benchmark_trace",
+        debug=False,
+        cheri=False,
+        kernel_options={
+            "KernelArmExportPMUUser": True,
+            "KernelDebugBuild": False,
+            "KernelVerificationBuild": False,
+            "KernelBenchmarks": "track_kernel_entries"
+        },
+    ),
     ConfigInfo(
         name="cheri",
         debug=True,
@@ -403,6 +418,7 @@ EXAMPLES = {
     "passive_server": Path("example/passive_server"),
     "hierarchy": Path("example/hierarchy"),
     "timer": Path("example/timer"),
+    "virtio_net": Path("example/virtio_net"),
 }
 
 
@@ -670,6 +686,17 @@ def build_lib_component(
     dest.chmod(0o744)
 
     if component_name == "libmicrokit":
+        # The event loops a PD can link instead of the one in libmicrokit.a
+        for loop in ("protected", "notified", "poll"):
+            obj = build_dir / f"loop_{loop}.o"
+            if cheri_purecap:
+                dest = lib_dir / f"microkit_loop_{loop}_purecap.o"
+            else:
+                dest = lib_dir / f"microkit_loop_{loop}.o"
+            dest.unlink(missing_ok=True)
+            copy(obj, dest)
+            dest.chmod(0o744)
+
         link_script = Path(component_name) / "microkit.ld"
         dest = lib_dir / "microkit.ld"
         dest.unlink(missing_ok=True)
@@ -812,7 +839,8 @@ def main() -> None:
             loader_printing = 1 if config.debug else 0
             loader_defines = [
                 ("LINK_ADDRESS", hex(board.loader_link_address)),
-                ("PRINTING", loader_printing)
+                ("PRINTING", loader_printing),
+                ("NUM_CPUS", board.loader_num_cpus),
             ]
             # There are some architecture dependent configuration options that the loader
             # needs to know about, so we figure that out here
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Passes every packet received by one network driver to the other to send,
+ * in both directions.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <microkit.h>
+
+#include "queue.h"
+
+#define NET0_CH 1
+#define NET1_CH 2
+
+uintptr_t net0_rx_vaddr;
+uintptr_t net0_tx_vaddr;
+uintptr_t net1_rx_vaddr;
+uintptr_t net1_tx_vaddr;
+
+/* Not printed, but can be looked at with a debugger */
+uint64_t forwarded;
+uint64_t dropped;
+
+/* Move all of the packets from 'from' to 'to' as one batch */
+static void forward(struct queue *from, struct queue *to, microkit_channel to_ch)
+{
+    bool sent = false;
+    do {
+        void *data;
+        uint32_t length;
+        while (queue_peek(from, &data, &length)) {
+            if (queue_push(to, data, length)) {
+                sent = true;
+                forwarded++;
+            } else {
+                dropped++;
+            }
+            queue_pop(from);
+        }
+    } while (!queue_wait(from));
+
+    if (sent && queue_should_notify(to)) {
+        microkit_notify(to_ch);
+    }
+}
+
+void init(void)
+{
+    queue_wait((void *)net0_rx_vaddr);
+    queue_wait((void *)net1_rx_vaddr);
+}
+
+void notified(microkit_channel ch)
+{
+    switch (ch) {
+        case NET0_CH:
+            forward((void *)net0_rx_vaddr, (void *)net1_tx_vaddr, NET1_CH);
+            break;
+        case NET1_CH:
+            forward((void *)net1_rx_vaddr, (void *)net0_tx_vaddr, NET0_CH);
+            break;
+        default:
+            microkit_dbg_puts("pass: received notification on unexpected channel\n");
+            break;
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Queues of packets from one PD to another, in a shared memory region. Each
+ * queue has a single producer and a single consumer, so neither side needs a
+ * lock. The producer only notifies the consumer when the consumer has said that
+ * it is about to wait for more packets, so a busy consumer is not notified for
+ * every batch.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define QUEUE_SLOTS 512
+#define QUEUE_BUFFER_SIZE 2048
+/* The packets start after the header, on the next page */
+#define QUEUE_DATA_OFFSET 0x1000
+
+struct queue {
+    /* Written by the producer, on its own cache line */
+    uint32_t head;
+    uint8_t padding0[60];
+    /* Written by the consumer */
+    uint32_t tail;
+    /* Set by the consumer before it waits, cleared by the producer when it notifies */
+    uint32_t consumer_waiting;
+    uint8_t padding1[56];
+    uint16_t length[QUEUE_SLOTS];
+};
+
+/*
+ * Copy 'length' bytes, rounded up to a multiple of 8. Both buffers are 8-byte
+ * aligned and have room for the extra bytes. Volatile so that the copy is not
+ * turned into a call to memcpy.
+ */
+static inline void queue_copy(void *dst, const void *src, uint32_t length)
+{
+    volatile uint64_t *d = dst;
+    const volatile uint64_t *s = src;
+    for (uint32_t i = 0; i < (length + 7) / 8; i++) {
+        d[i] = s[i];
+    }
+}
+
+static inline void *queue_buffer(struct queue *q, uint32_t idx)
+{
+    return (uint8_t *)q + QUEUE_DATA_OFFSET + (idx % QUEUE_SLOTS) * QUEUE_BUFFER_SIZE;
+}
+
+/* Producer: add a packet, returns false if the queue is full */
+static inline bool queue_push(struct queue *q, const void *data, uint32_t length)
+{
+    uint32_t head = q->head;
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == QUEUE_SLOTS || length > QUEUE_BUFFER_SIZE) {
+        return false;
+    }
+    queue_copy(queue_buffer(q, head), data, length);
+    q->length[head % QUEUE_SLOTS] = length;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Producer: after adding a batch of packets, whether the consumer needs to be notified */
+static inline bool queue_should_notify(struct queue *q)
+{
+    /* Pairs with the fence in queue_wait */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_exchange_n(&q->consumer_waiting, 0, __ATOMIC_RELAXED) != 0;
+}
+
+/* Consumer: the next packet, if any, which stays in the queue until queue_pop */
+static inline bool queue_peek(struct queue *q, void **data, uint32_t *length)
+{
+    uint32_t tail = q->tail;
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    *data = queue_buffer(q, tail);
+    *length = q->length[tail % QUEUE_SLOTS];
+    return true;
+}
+
+static inline void queue_pop(struct queue *q)
+{
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Consumer: ask to be notified of the next packet. Returns false if a packet
+ * arrived in the meantime, in which case the consumer should carry on.
+ */
+static inline bool queue_wait(struct queue *q)
+{
+    __atomic_store_n(&q->consumer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&q->head, __ATOMIC_RELAXED) == q->tail;
+}
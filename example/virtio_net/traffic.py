@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+# Copyright 2025, Capabilities Limited
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+"""Traffic generator for the virtio_net example.
+
+QEMU connects each virtio-net device to a pair of UDP sockets on the host, with
+one Ethernet frame in each datagram. This sends frames into one device and
+times their arrival from the other, after they have passed through the drivers
+and the pass PD, and reports the throughput and round-trip latency.
+
+Each frame carries a sequence number and the time it was sent. Up to --window
+frames are in flight at once: a window of 1 measures latency without any
+queueing, a larger one measures throughput. Frames that do not come back
+within --timeout are counted as lost.
+"""
+from argparse import ArgumentParser
+from select import select
+from socket import socket, AF_INET, SOCK_DGRAM
+import struct
+import time
+
+from typing import Dict, List, Optional, Tuple
+
+# Locally administered addresses, and the IEEE local experimental ethertype
+DST_MAC = bytes.fromhex("020000000001")
+SRC_MAC = bytes.fromhex("020000000002")
+ETHERTYPE = 0x88B5
+MAGIC = 0x6D6B6E74
+
+HEADER = struct.Struct("!6s6sHIQQ")
+MIN_FRAME = 60
+MAX_FRAME = 1514
+
+
+def parse_address(address: str) -> Tuple[str, int]:
+    host, _, port = address.rpartition(":")
+    return (host or "127.0.0.1", int(port))
+
+
+def make_frame(seq: int, sent: int, size: int) -> bytes:
+    header = HEADER.pack(DST_MAC, SRC_MAC, ETHERTYPE, MAGIC, seq, sent)
+    return header + bytes(size - len(header))
+
+
+def parse_frame(frame: bytes) -> Optional[Tuple[int, int]]:
+    if len(frame) < HEADER.size:
+        return None
+    _, _, ethertype, magic, seq, sent = HEADER.unpack_from(frame)
+    if ethertype != ETHERTYPE or magic != MAGIC:
+        return None
+    return (seq, sent)
+
+
+def percentile(values: List[int], p: float) -> float:
+    return values[min(len(values) - 1, int(len(values) * p))] / 1000
+
+
+def main() -> None:
+    parser = ArgumentParser(description="Send frames through the virtio_net example and measure them")
+    parser.add_argument("--to", default="127.0.0.1:7000", help="where QEMU receives frames for the first device")
+    parser.add_argument("--listen", default="127.0.0.1:7003", help="where QEMU sends frames from the second device")
+    parser.add_argument("--size", type=int, default=MIN_FRAME, help=f"frame size in bytes, {MIN_FRAME} to {MAX_FRAME}")
+    parser.add_argument("--window", type=int, default=1, help="frames in flight at once")
+    parser.add_argument("--count", type=int, help="stop after sending this many frames")
+    parser.add_argument("--duration", type=float, default=10.0, help="stop sending after this many seconds")
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds before a frame is counted as lost")
+    args = parser.parse_args()
+
+    if not MIN_FRAME <= args.size <= MAX_FRAME:
+        parser.error(f"--size must be between {MIN_FRAME} and {MAX_FRAME}")
+    if args.window < 1:
+        parser.error("--window must be at least 1")
+
+    target = parse_address(args.to)
+    rx = socket(AF_INET, SOCK_DGRAM)
+    rx.bind(parse_address(args.listen))
+    rx.setblocking(False)
+    tx = socket(AF_INET, SOCK_DGRAM)
+
+    timeout = int(args.timeout * 1e9)
+    # Sequence number to send time of the frames in flight, oldest first
+    outstanding: Dict[int, int] = {}
+    rtts: List[int] = []
+    seq = 0
+    lost = 0
+    start = time.monotonic_ns()
+    end = start + int(args.duration * 1e9)
+    last_rx = start
+
+    while True:
+        now = time.monotonic_ns()
+        while outstanding:
+            oldest, sent = next(iter(outstanding.items()))
+            if now - sent < timeout:
+                break
+            del outstanding[oldest]
+            lost += 1
+
+        sending = now < end and (args.count is None or seq < args.count)
+        if not sending and not outstanding:
+            break
+
+        if sending and len(outstanding) < args.window:
+            tx.sendto(make_frame(seq, now, args.size), target)
+            outstanding[seq] = now
+            seq += 1
+            continue
+
+        readable, _, _ = select([rx], [], [], 0.01)
+        while readable:
+            try:
+                frame = rx.recv(2048)
+            except BlockingIOError:
+                break
+            now = time.monotonic_ns()
+            parsed = parse_frame(frame)
+            if parsed is None or parsed[0] not in outstanding:
+                continue
+            del outstanding[parsed[0]]
+            rtts.append(now - parsed[1])
+            last_rx = now
+
+    received = len(rtts)
+    elapsed = (last_rx - start) / 1e9
+    print(f"sent {seq}, received {received}, lost {lost}")
+    if received == 0:
+        return
+    print(f"throughput: {received / elapsed:.0f} frames/s, {received * args.size * 8 / elapsed / 1e6:.1f} Mbit/s")
+    rtts.sort()
+    print(f"round trip (us): min {percentile(rtts, 0):.1f}, median {percentile(rtts, 0.5):.1f}, "
+          f"99% {percentile(rtts, 0.99):.1f}, max {percentile(rtts, 1):.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,387 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * A driver for a virtio-net device on the MMIO transport. Received packets are
+ * added to rx_queue, packets in tx_queue are sent. Packets are handled in
+ * batches: each interrupt or notification deals with everything that is ready,
+ * and the device, the driver and the pass PD each ask to be told about more
+ * work only once they have run out of it.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <microkit.h>
+
+#include "queue.h"
+#include "virtio.h"
+
+#define IRQ_CH 0
+#define PASS_CH 1
+
+uintptr_t regs;
+uintptr_t dma_vaddr;
+uintptr_t dma_paddr;
+uintptr_t rx_queue_vaddr;
+uintptr_t tx_queue_vaddr;
+
+/*
+ * Layout of the DMA region: the rings of each virtqueue, then the buffers of
+ * the receive queue, then those of the transmit queue.
+ */
+#define VIRTQ_AREA_SIZE 0x4000
+#define VIRTQ_AVAIL_OFFSET 0x1000
+#define VIRTQ_USED_OFFSET 0x2000
+#define NET_BUFFERS_OFFSET (2 * VIRTQ_AREA_SIZE)
+#define NET_BUFFER_SIZE 2048
+/* The header goes just before the frame, so that the frame is 8-byte aligned */
+#define NET_FRAME_OFFSET 16
+#define NET_HDR_OFFSET (NET_FRAME_OFFSET - sizeof(struct virtio_net_hdr))
+#define NET_MAX_FRAME (NET_BUFFER_SIZE - NET_FRAME_OFFSET)
+
+_Static_assert(sizeof(struct virtq_desc) * VIRTQ_SIZE <= VIRTQ_AVAIL_OFFSET, "descriptors overlap avail ring");
+_Static_assert(VIRTQ_AVAIL_OFFSET + sizeof(struct virtq_avail) <= VIRTQ_USED_OFFSET, "avail ring overlaps used ring");
+_Static_assert(VIRTQ_USED_OFFSET + sizeof(struct virtq_used) <= VIRTQ_AREA_SIZE, "used ring too large");
+
+#if defined(__aarch64__)
+/* Orders accesses to the rings, which the device reads and writes like another CPU */
+#define virtq_mb() asm volatile("dmb sy" ::: "memory")
+/* Orders accesses to the rings before a write to a device register */
+#define mmio_mb() asm volatile("dsb sy" ::: "memory")
+#elif defined(__riscv)
+#define virtq_mb() asm volatile("fence rw, rw" ::: "memory")
+#define mmio_mb() asm volatile("fence iorw, iorw" ::: "memory")
+#endif
+
+struct virtq {
+    uint16_t index;
+    volatile struct virtq_desc *desc;
+    volatile struct virtq_avail *avail;
+    volatile struct virtq_used *used;
+    uintptr_t buffers;
+    uint64_t buffers_paddr;
+    /* The next entry of the avail ring to fill */
+    uint16_t avail_idx;
+    /* The next entry of the used ring to look at */
+    uint16_t last_used;
+};
+
+static struct virtq rx;
+static struct virtq tx;
+static uint16_t tx_free[VIRTQ_SIZE];
+static unsigned tx_free_count;
+static bool event_idx;
+
+/* Not printed, but can be looked at with a debugger */
+uint64_t rx_packets;
+uint64_t rx_dropped;
+uint64_t tx_packets;
+uint64_t tx_dropped;
+uint64_t device_notifications;
+
+static inline uint32_t reg_read(uint32_t offset)
+{
+    return *(volatile uint32_t *)(regs + offset);
+}
+
+static inline void reg_write(uint32_t offset, uint32_t value)
+{
+    *(volatile uint32_t *)(regs + offset) = value;
+}
+
+static void puthex8(uint8_t x)
+{
+    const char *digits = "0123456789abcdef";
+    microkit_dbg_putc(digits[x >> 4]);
+    microkit_dbg_putc(digits[x & 0xf]);
+}
+
+static void fail(const char *msg)
+{
+    reg_write(VIRTIO_MMIO_STATUS, reg_read(VIRTIO_MMIO_STATUS) | VIRTIO_STATUS_FAILED);
+    microkit_dbg_puts(microkit_name);
+    microkit_dbg_puts(": ");
+    microkit_dbg_puts(msg);
+    microkit_dbg_puts("\n");
+}
+
+/* Ask the device to interrupt once it has used the next buffer of 'vq' */
+static void virtq_enable_interrupts(struct virtq *vq)
+{
+    if (event_idx) {
+        vq->avail->used_event = vq->last_used;
+    } else {
+        vq->avail->flags = 0;
+    }
+}
+
+static void virtq_disable_interrupts(struct virtq *vq)
+{
+    /* With event indexes, the device only interrupts when it passes used_event, which is left behind */
+    if (!event_idx) {
+        vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+/*
+ * Make the buffers added to the avail ring since it was at 'old' available to
+ * the device, and only notify the device if it has asked to be.
+ */
+static void virtq_publish(struct virtq *vq, uint16_t old)
+{
+    virtq_mb();
+    vq->avail->idx = vq->avail_idx;
+    virtq_mb();
+
+    bool notify;
+    if (event_idx) {
+        notify = virtq_need_event(vq->used->avail_event, vq->avail_idx, old);
+    } else {
+        notify = !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+    if (notify) {
+        mmio_mb();
+        reg_write(VIRTIO_MMIO_QUEUE_NOTIFY, vq->index);
+        device_notifications++;
+    }
+}
+
+static bool virtq_init(struct virtq *vq, uint16_t index)
+{
+    uintptr_t area = dma_vaddr + index * VIRTQ_AREA_SIZE;
+    uint64_t area_paddr = dma_paddr + index * VIRTQ_AREA_SIZE;
+    uint64_t buffers_offset = NET_BUFFERS_OFFSET + index * VIRTQ_SIZE * NET_BUFFER_SIZE;
+
+    vq->index = index;
+    vq->desc = (void *)area;
+    vq->avail = (void *)(area + VIRTQ_AVAIL_OFFSET);
+    vq->used = (void *)(area + VIRTQ_USED_OFFSET);
+    vq->buffers = dma_vaddr + buffers_offset;
+    vq->buffers_paddr = dma_paddr + buffers_offset;
+
+    reg_write(VIRTIO_MMIO_QUEUE_SEL, index);
+    if (reg_read(VIRTIO_MMIO_QUEUE_READY) != 0 || reg_read(VIRTIO_MMIO_QUEUE_NUM_MAX) < VIRTQ_SIZE) {
+        return false;
+    }
+    reg_write(VIRTIO_MMIO_QUEUE_NUM, VIRTQ_SIZE);
+    reg_write(VIRTIO_MMIO_QUEUE_DESC_LOW, area_paddr);
+    reg_write(VIRTIO_MMIO_QUEUE_DESC_HIGH, area_paddr >> 32);
+    reg_write(VIRTIO_MMIO_QUEUE_DRIVER_LOW, area_paddr + VIRTQ_AVAIL_OFFSET);
+    reg_write(VIRTIO_MMIO_QUEUE_DRIVER_HIGH, (area_paddr + VIRTQ_AVAIL_OFFSET) >> 32);
+    reg_write(VIRTIO_MMIO_QUEUE_DEVICE_LOW, area_paddr + VIRTQ_USED_OFFSET);
+    reg_write(VIRTIO_MMIO_QUEUE_DEVICE_HIGH, (area_paddr + VIRTQ_USED_OFFSET) >> 32);
+    reg_write(VIRTIO_MMIO_QUEUE_READY, 1);
+
+    return true;
+}
+
+static void handle_rx(void)
+{
+    struct queue *q = (void *)rx_queue_vaddr;
+    uint16_t old = rx.avail_idx;
+    bool received = false;
+
+    virtq_disable_interrupts(&rx);
+    for (;;) {
+        uint16_t used_idx = rx.used->idx;
+        virtq_mb();
+        while (rx.last_used != used_idx) {
+            volatile struct virtq_used_elem *elem = &rx.used->ring[rx.last_used % VIRTQ_SIZE];
+            uint16_t id = elem->id % VIRTQ_SIZE;
+            uint32_t len = elem->len;
+            void *frame = (void *)(rx.buffers + id * NET_BUFFER_SIZE + NET_FRAME_OFFSET);
+
+            if (len > sizeof(struct virtio_net_hdr)
+                && queue_push(q, frame, len - sizeof(struct virtio_net_hdr))) {
+                received = true;
+                rx_packets++;
+            } else {
+                rx_dropped++;
+            }
+
+            /* Give the buffer straight back to the device */
+            rx.avail->ring[rx.avail_idx % VIRTQ_SIZE] = id;
+            rx.avail_idx++;
+            rx.last_used++;
+        }
+
+        /* Ask for an interrupt for the next packet, then make sure none arrived in the meantime */
+        virtq_enable_interrupts(&rx);
+        virtq_mb();
+        if (rx.used->idx == rx.last_used) {
+            break;
+        }
+    }
+
+    if (rx.avail_idx != old) {
+        virtq_publish(&rx, old);
+    }
+    if (received && queue_should_notify(q)) {
+        microkit_notify(PASS_CH);
+    }
+}
+
+static void handle_tx(void)
+{
+    struct queue *q = (void *)tx_queue_vaddr;
+    uint16_t old = tx.avail_idx;
+
+    for (;;) {
+        /* Take back the buffers the device has sent */
+        uint16_t used_idx = tx.used->idx;
+        virtq_mb();
+        while (tx.last_used != used_idx) {
+            tx_free[tx_free_count++] = tx.used->ring[tx.last_used % VIRTQ_SIZE].id % VIRTQ_SIZE;
+            tx.last_used++;
+        }
+
+        void *data;
+        uint32_t length;
+        while (tx_free_count > 0 && queue_peek(q, &data, &length)) {
+            if (length > NET_MAX_FRAME) {
+                queue_pop(q);
+                tx_dropped++;
+                continue;
+            }
+
+            uint16_t id = tx_free[--tx_free_count];
+            uintptr_t buffer = tx.buffers + id * NET_BUFFER_SIZE;
+            volatile struct virtio_net_hdr *hdr = (void *)(buffer + NET_HDR_OFFSET);
+            hdr->flags = 0;
+            hdr->gso_type = 0;
+            hdr->num_buffers = 0;
+            queue_copy((void *)(buffer + NET_FRAME_OFFSET), data, length);
+            queue_pop(q);
+
+            tx.desc[id].len = sizeof(struct virtio_net_hdr) + length;
+            tx.avail->ring[tx.avail_idx % VIRTQ_SIZE] = id;
+            tx.avail_idx++;
+            tx_packets++;
+        }
+
+        if (tx_free_count == 0) {
+            /*
+             * Out of buffers, the rest of the queue waits until the device
+             * has sent some, which it interrupts for.
+             */
+            virtq_enable_interrupts(&tx);
+            virtq_mb();
+            if (tx.used->idx == tx.last_used) {
+                break;
+            }
+        } else {
+            /* The queue is empty, the pass PD notifies this PD when there is more */
+            virtq_disable_interrupts(&tx);
+            if (queue_wait(q)) {
+                break;
+            }
+        }
+    }
+
+    if (tx.avail_idx != old) {
+        virtq_publish(&tx, old);
+    }
+}
+
+void init(void)
+{
+    if (reg_read(VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MMIO_MAGIC
+        || reg_read(VIRTIO_MMIO_DEVICE_ID) != VIRTIO_DEVICE_ID_NET) {
+        microkit_dbg_puts(microkit_name);
+        microkit_dbg_puts(": no virtio-net device found\n");
+        return;
+    }
+    if (reg_read(VIRTIO_MMIO_VERSION_REG) != VIRTIO_MMIO_VERSION) {
+        microkit_dbg_puts(microkit_name);
+        microkit_dbg_puts(": legacy virtio devices are not supported\n");
+        return;
+    }
+
+    reg_write(VIRTIO_MMIO_STATUS, 0);
+    reg_write(VIRTIO_MMIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    reg_write(VIRTIO_MMIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    reg_write(VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    uint64_t features = reg_read(VIRTIO_MMIO_DEVICE_FEATURES);
+    reg_write(VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+    features |= (uint64_t)reg_read(VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+    if (!(features & (1ULL << VIRTIO_F_VERSION_1))) {
+        fail("device does not support VIRTIO_F_VERSION_1");
+        return;
+    }
+
+    uint64_t driver_features = (1ULL << VIRTIO_F_VERSION_1)
+                               | (features & ((1ULL << VIRTIO_NET_F_MAC) | (1ULL << VIRTIO_RING_F_EVENT_IDX)));
+    event_idx = (driver_features & (1ULL << VIRTIO_RING_F_EVENT_IDX)) != 0;
+    reg_write(VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    reg_write(VIRTIO_MMIO_DRIVER_FEATURES, driver_features);
+    reg_write(VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    reg_write(VIRTIO_MMIO_DRIVER_FEATURES, driver_features >> 32);
+
+    uint32_t status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK;
+    reg_write(VIRTIO_MMIO_STATUS, status);
+    if (!(reg_read(VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+        fail("device did not accept features");
+        return;
+    }
+
+    if (!virtq_init(&rx, VIRTIO_NET_RX_QUEUE) || !virtq_init(&tx, VIRTIO_NET_TX_QUEUE)) {
+        fail("could not set up virtqueues");
+        return;
+    }
+
+    for (uint16_t i = 0; i < VIRTQ_SIZE; i++) {
+        rx.desc[i].addr = rx.buffers_paddr + i * NET_BUFFER_SIZE + NET_HDR_OFFSET;
+        rx.desc[i].len = NET_BUFFER_SIZE - NET_HDR_OFFSET;
+        rx.desc[i].flags = VIRTQ_DESC_F_WRITE;
+        rx.avail->ring[i] = i;
+
+        tx.desc[i].addr = tx.buffers_paddr + i * NET_BUFFER_SIZE + NET_HDR_OFFSET;
+        tx.desc[i].flags = 0;
+        tx_free[i] = i;
+    }
+    rx.avail_idx = VIRTQ_SIZE;
+    tx_free_count = VIRTQ_SIZE;
+    virtq_enable_interrupts(&rx);
+    virtq_disable_interrupts(&tx);
+
+    reg_write(VIRTIO_MMIO_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+    virtq_publish(&rx, 0);
+
+    /* Packets to send are notified by the pass PD */
+    queue_wait((void *)tx_queue_vaddr);
+
+    microkit_dbg_puts(microkit_name);
+    microkit_dbg_puts(": ready");
+    if (driver_features & (1ULL << VIRTIO_NET_F_MAC)) {
+        microkit_dbg_puts(", MAC ");
+        for (int i = 0; i < 6; i++) {
+            puthex8(*(volatile uint8_t *)(regs + VIRTIO_MMIO_CONFIG + i));
+            if (i != 5) {
+                microkit_dbg_putc(':');
+            }
+        }
+    }
+    microkit_dbg_puts(event_idx ? ", event index\n" : "\n");
+}
+
+void notified(microkit_channel ch)
+{
+    switch (ch) {
+        case IRQ_CH:
+            reg_write(VIRTIO_MMIO_INTERRUPT_ACK, reg_read(VIRTIO_MMIO_INTERRUPT_STATUS));
+            handle_rx();
+            handle_tx();
+            microkit_irq_ack(ch);
+            break;
+        case PASS_CH:
+            handle_tx();
+            break;
+        default:
+            microkit_dbg_puts(microkit_name);
+            microkit_dbg_puts(": received notification on unexpected channel\n");
+            break;
+    }
+}
@@ -13,6 +13,7 @@
 
 typedef unsigned int microkit_channel;
 typedef unsigned int microkit_child;
+typedef unsigned int microkit_template;
 typedef seL4_MessageInfo_t microkit_msginfo;
 
 #define MONITOR_EP 5
@@ -26,10 +27,17 @@ typedef seL4_MessageInfo_t microkit_msginfo;
 #define BASE_TCB_CAP 202
 #define BASE_VM_TCB_CAP 266
 #define BASE_VCPU_CAP 330
+#define BASE_BROADCAST_CAP 394
 
 #define MICROKIT_MAX_CHANNELS 62
 #define MICROKIT_MAX_CHANNEL_ID (MICROKIT_MAX_CHANNELS - 1)
 #define MICROKIT_PD_NAME_LENGTH 64
+#define MICROKIT_MAX_BROADCASTS 8
+#define MICROKIT_MAX_TEMPLATES 8
+
+/* Labels of requests to the monitor, must match the monitor */
+#define MICROKIT_TEMPLATE_SPAWN_LABEL 0x100
+#define MICROKIT_TEMPLATE_DESTROY_LABEL 0x101
 
 /* User provided functions */
 void init(void);
@@ -49,6 +57,81 @@ extern seL4_Word microkit_irqs;
 extern seL4_Word microkit_notifications;
 extern seL4_Word microkit_pps;
 
+/* Patched by the Microkit tool with the address and size of the buffer, if any,
+ * of each channel. Purecap PDs use the capabilities instead of the addresses. */
+extern seL4_Word microkit_channel_buffer_vaddrs[MICROKIT_MAX_CHANNELS];
+extern seL4_Word microkit_channel_buffer_sizes[MICROKIT_MAX_CHANNELS];
+#if defined(__CHERI_PURE_CAPABILITY__)
+extern void *microkit_channel_buffer_caps[MICROKIT_MAX_CHANNELS];
+#endif
+
+/*
+ * Broadcasts, see the <broadcast> element of the system description.
+ *
+ * The producer writes a message into a page shared with all consumers and
+ * notifies them all with one call. A consumer is notified on a channel, and
+ * the page is that channel's buffer. Each message has a sequence number, so
+ * consumers that miss notifications still read the latest message and can tell
+ * how many they missed.
+ *
+ * Patched by the Microkit tool for each broadcast the PD produces, with the
+ * first of the PD's caps to the consumers' notifications and their number.
+ */
+extern seL4_Word microkit_broadcast_vaddrs[MICROKIT_MAX_BROADCASTS];
+extern seL4_Word microkit_broadcast_sizes[MICROKIT_MAX_BROADCASTS];
+extern seL4_Word microkit_broadcast_caps[MICROKIT_MAX_BROADCASTS];
+extern seL4_Word microkit_broadcast_consumers[MICROKIT_MAX_BROADCASTS];
+#if defined(__CHERI_PURE_CAPABILITY__)
+extern void *microkit_broadcast_buffer_caps[MICROKIT_MAX_BROADCASTS];
+#endif
+
+/* The sequence number is odd while the producer is writing a message */
+typedef struct microkit_broadcast_message {
+    seL4_Word seq;
+    seL4_Uint8 data[];
+} microkit_broadcast_message;
+
+/*
+ * Start writing the next message of broadcast 'id', returning where to write
+ * it, or NULL if the PD does not produce the broadcast. The message is
+ * published by microkit_broadcast.
+ */
+void *microkit_broadcast_begin(unsigned int id);
+
+/* The largest message that broadcast 'id' can hold */
+seL4_Word microkit_broadcast_size(unsigned int id);
+
+/*
+ * Publish the message started with microkit_broadcast_begin, if any, and
+ * notify all consumers of broadcast 'id'.
+ */
+void microkit_broadcast(unsigned int id);
+
+/*
+ * Copy up to 'length' bytes of the latest message of the broadcast that is
+ * notified on channel 'ch' to 'buf'. Returns the number of messages published
+ * so far, or 0 if there is no complete message to read, for example because
+ * the producer is writing one, in which case it notifies again once done.
+ */
+seL4_Word microkit_broadcast_read(microkit_channel ch, void *buf, seL4_Word length);
+
+/*
+ * Busy-polling. Only used by PDs with mode="poll" in the system description.
+ *
+ * A poller is called on each round of the PD's event loop, for example to check
+ * a queue in shared memory, and returns whether it found any work. The loop
+ * backs off by up to microkit_poll_backoff_max idle hints once neither the
+ * pollers nor the kernel have anything for the PD, set it to 0 to never back off.
+ * Registering a poller fails if the PD is not polling or too many are registered.
+ */
+#define MICROKIT_MAX_POLLERS 8
+
+typedef seL4_Bool (*microkit_poller)(void *arg);
+
+extern seL4_Word microkit_poll_backoff_max;
+
+seL4_Bool microkit_poll_register(microkit_poller fn, void *arg);
+
 /*
  * Output a single character on the debug console.
  */
@@ -69,6 +152,17 @@ void microkit_dbg_put8(seL4_Uint8 x);
  */
 void microkit_dbg_put32(seL4_Uint32 x);
 
+/*
+ * Layout of the memory region given to the tool with '--boot-log', which holds
+ * the output of the loader and monitor. A PD that maps the region can read it
+ * once the system is running. Output that did not fit is counted in 'dropped'.
+ */
+typedef struct microkit_boot_log {
+    seL4_Word length;
+    seL4_Word dropped;
+    char text[];
+} microkit_boot_log;
+
 static inline void microkit_internal_crash(seL4_Error err)
 {
 #if defined(__CHERI_PURE_CAPABILITY__)
@@ -191,11 +285,121 @@ static inline microkit_msginfo microkit_ppcall(microkit_channel ch, microkit_msg
     return seL4_Call(BASE_ENDPOINT_CAP + ch, msginfo);
 }
 
+/*
+ * Templates, see the <template> element of the system description.
+ *
+ * The monitor creates an instance of a template from memory set aside for it
+ * when the system was built, so a PD can only have as many instances of a
+ * template at once as the system description allows. Patched by the Microkit
+ * tool with a bit for each of the PD's templates.
+ */
+extern seL4_Word microkit_templates;
+
+/*
+ * Start an instance of 'template', which runs from the start of its program
+ * image. Fails if all the template's instances are in use. Otherwise, 'ch' is
+ * set to the channel that the PD notifies the instance on, and is notified on
+ * by it, which is also how the instance is destroyed.
+ */
+static inline seL4_Bool microkit_spawn(microkit_template template, microkit_channel *ch)
+{
+    if (template >= MICROKIT_MAX_TEMPLATES || (microkit_templates & (1ULL << template)) == 0) {
+        microkit_dbg_puts(microkit_name);
+        microkit_dbg_puts(" microkit_spawn: invalid template given '");
+        microkit_dbg_put32(template);
+        microkit_dbg_puts("'\n");
+        return seL4_False;
+    }
+    seL4_SetMR(0, template);
+    seL4_MessageInfo_t tag = seL4_Call(MONITOR_EP, seL4_MessageInfo_new(MICROKIT_TEMPLATE_SPAWN_LABEL, 0, 0, 1));
+    if (seL4_MessageInfo_get_label(tag) != 0) {
+        return seL4_False;
+    }
+    *ch = seL4_GetMR(0);
+    return seL4_True;
+}
+
+/* Stop the instance on channel 'ch' and free everything it was given */
+static inline seL4_Bool microkit_destroy(microkit_channel ch)
+{
+    if (microkit_templates == 0) {
+        return seL4_False;
+    }
+    seL4_SetMR(0, ch);
+    seL4_MessageInfo_t tag = seL4_Call(MONITOR_EP, seL4_MessageInfo_new(MICROKIT_TEMPLATE_DESTROY_LABEL, 0, 0, 1));
+    return seL4_MessageInfo_get_label(tag) == 0;
+}
+
 static inline microkit_msginfo microkit_msginfo_new(seL4_Word label, seL4_Uint16 count)
 {
     return seL4_MessageInfo_new(label, 0, 0, count);
 }
 
+/*
+ * The buffer that the system description gives the channel, which is mapped
+ * into the PDs at both ends of the channel. Returns NULL if there is none.
+ */
+static inline void *microkit_channel_buffer(microkit_channel ch)
+{
+    if (ch > MICROKIT_MAX_CHANNEL_ID) {
+        return (void *)0;
+    }
+#if defined(__CHERI_PURE_CAPABILITY__)
+    return microkit_channel_buffer_caps[ch];
+#else
+    return (void *)microkit_channel_buffer_vaddrs[ch];
+#endif
+}
+
+static inline seL4_Word microkit_channel_buffer_size(microkit_channel ch)
+{
+    if (ch > MICROKIT_MAX_CHANNEL_ID) {
+        return 0;
+    }
+    return microkit_channel_buffer_sizes[ch];
+}
+
+/*
+ * A message that refers to 'length' bytes at 'offset' in a channel buffer. The
+ * offset and length are passed in the first two message registers.
+ */
+static inline microkit_msginfo microkit_msginfo_buf_new(seL4_Word label, seL4_Word offset, seL4_Word length)
+{
+    seL4_SetMR(0, offset);
+    seL4_SetMR(1, length);
+    return seL4_MessageInfo_new(label, 0, 0, 2);
+}
+
+/*
+ * Get the data that a message made by microkit_msginfo_buf_new, received on
+ * channel 'ch', refers to. Returns NULL if the message does not refer to data
+ * that is within the channel's buffer.
+ */
+static inline void *microkit_msginfo_buf_get(microkit_channel ch, microkit_msginfo msginfo, seL4_Word *length)
+{
+    seL4_Word size = microkit_channel_buffer_size(ch);
+    if (seL4_MessageInfo_get_length(msginfo) < 2 || size == 0) {
+        return (void *)0;
+    }
+    seL4_Word offset = seL4_GetMR(0);
+    seL4_Word len = seL4_GetMR(1);
+    if (offset > size || len > size - offset) {
+        return (void *)0;
+    }
+    *length = len;
+    return (char *)microkit_channel_buffer(ch) + offset;
+}
+
+/*
+ * Make a protected procedure call about 'length' bytes at 'offset' in the
+ * channel's buffer. The data itself is not copied.
+ */
+static inline microkit_msginfo microkit_ppcall_buf(microkit_channel ch, seL4_Word label, seL4_Word offset,
+                                                   seL4_Word length)
+{
+    return microkit_ppcall(ch, microkit_msginfo_buf_new(label, offset, length));
+}
+
 static inline seL4_Word microkit_msginfo_get_label(microkit_msginfo msginfo)
 {
     return seL4_MessageInfo_get_label(msginfo);
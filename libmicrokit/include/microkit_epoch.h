@@ -0,0 +1,114 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Epoch-based reclamation for data shared between PDs that is read often and
+ * updated rarely, such as routing tables.
+ *
+ * A 'domain' lives in a memory region mapped by one writer PD and up to
+ * MICROKIT_EPOCH_MAX_READERS reader PDs. It holds a word identifying the
+ * current version of the data, for example its offset in a memory region, since
+ * PDs may map the region at different addresses. The writer publishes a new
+ * version and keeps the old one until every reader has passed a quiescent point
+ * since, at which point the old version is handed back to the writer to reuse.
+ *
+ * Readers pass a quiescent point each time round the event loop, after an
+ * entry point returns, so a version must not be used beyond the entry point
+ * that got it from microkit_epoch_current. Reading needs no atomic operations
+ * or barriers. A reader that is blocked waiting for an event does not pass any
+ * quiescent points, so the writer can notify lagging readers, which libmicrokit
+ * handles itself rather than calling 'notified'.
+ */
+
+#pragma once
+
+#include <microkit.h>
+
+#define MICROKIT_EPOCH_MAX_READERS 16
+/* Number of domains a PD can read */
+#define MICROKIT_EPOCH_MAX_DOMAINS 4
+/* Number of old versions a writer can hold before they are reclaimed */
+#define MICROKIT_EPOCH_MAX_RETIRED 16
+#define MICROKIT_EPOCH_NO_NUDGE ((microkit_channel)-1)
+
+/* Readers are kept on separate cache lines so they do not slow each other down */
+#define MICROKIT_EPOCH_CACHE_LINE 64
+
+typedef struct microkit_epoch_domain {
+    seL4_Word epoch;
+    seL4_Word current;
+    seL4_Uint8 padding[MICROKIT_EPOCH_CACHE_LINE - 2 * sizeof(seL4_Word)];
+    struct {
+        /* The last epoch the reader saw at a quiescent point, 0 if not reading */
+        seL4_Word epoch;
+        seL4_Uint8 padding[MICROKIT_EPOCH_CACHE_LINE - sizeof(seL4_Word)];
+    } readers[MICROKIT_EPOCH_MAX_READERS];
+} microkit_epoch_domain;
+
+typedef void (*microkit_epoch_reclaim_fn)(void *cookie, seL4_Word version);
+
+/* Private to the writer PD */
+typedef struct microkit_epoch_writer {
+    microkit_epoch_domain *domain;
+    microkit_epoch_reclaim_fn reclaim;
+    void *cookie;
+    /* The channel to notify each reader on when it lags, and the epoch it was last notified for */
+    microkit_channel nudge[MICROKIT_EPOCH_MAX_READERS];
+    seL4_Word nudged[MICROKIT_EPOCH_MAX_READERS];
+    struct {
+        seL4_Word version;
+        seL4_Word epoch;
+    } retired[MICROKIT_EPOCH_MAX_RETIRED];
+    unsigned int num_retired;
+} microkit_epoch_writer;
+
+/* Used by the event loop */
+extern unsigned int microkit_epoch_num_domains;
+extern seL4_Word microkit_epoch_nudge_mask;
+void microkit_epoch_quiescent(void);
+
+/*
+ * Start reading 'domain' as reader number 'reader', which must be unique among
+ * the domain's readers. 'nudge' is the channel the writer notifies this PD on,
+ * or MICROKIT_EPOCH_NO_NUDGE. Fails if the PD reads too many domains.
+ */
+seL4_Bool microkit_epoch_reader_register(microkit_epoch_domain *domain, unsigned int reader,
+                                         microkit_channel nudge);
+
+/* The current version, valid until the calling entry point returns */
+static inline seL4_Word microkit_epoch_current(const microkit_epoch_domain *domain)
+{
+    /*
+     * A plain load. Accesses to the version depend on its value, which orders
+     * them after this load on both AArch64 and RISC-V.
+     */
+    return *(volatile const seL4_Word *)&domain->current;
+}
+
+/*
+ * Initialise 'domain', which no reader may have registered with yet, with
+ * 'version' as its current version. Old versions are passed to 'reclaim' once
+ * no reader can be using them.
+ */
+void microkit_epoch_writer_init(microkit_epoch_writer *writer, microkit_epoch_domain *domain, seL4_Word version,
+                                microkit_epoch_reclaim_fn reclaim, void *cookie);
+
+/* Notify 'reader' on channel 'ch' when it holds up reclamation */
+void microkit_epoch_writer_nudge(microkit_epoch_writer *writer, unsigned int reader, microkit_channel ch);
+
+/*
+ * Make 'version' the current version. Fails, leaving the current version as it
+ * is, if too many old versions are waiting to be reclaimed.
+ */
+seL4_Bool microkit_epoch_publish(microkit_epoch_writer *writer, seL4_Word version);
+
+/*
+ * Reclaim the old versions that no reader can be using any more and nudge the
+ * readers holding up the rest. Returns the number of versions still waiting,
+ * in which case the writer should call this again later, for example when it
+ * is next notified.
+ */
+unsigned int microkit_epoch_reclaim(microkit_epoch_writer *writer);
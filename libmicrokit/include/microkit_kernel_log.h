@@ -0,0 +1,60 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Access to the kernel's benchmark log from protection domains.
+ *
+ * In the 'benchmark_trace' configuration the kernel logs an entry for each
+ * kernel entry, giving the reason for the entry, when it happened and how long
+ * the kernel took, to the memory region given to the tool with '--kernel-log'.
+ * A PD that maps the region can read the entries once the log is stopped.
+ *
+ * The kernel stops logging when the buffer is full. Resetting and stopping
+ * the log are system calls that any thread can make, so the system designer
+ * decides which PD does so.
+ */
+
+#pragma once
+
+#include <microkit.h>
+
+#if defined(CONFIG_KERNEL_LOG_BUFFER)
+#define MICROKIT_KERNEL_LOG_AVAILABLE 1
+#else
+#define MICROKIT_KERNEL_LOG_AVAILABLE 0
+#endif
+
+#if MICROKIT_KERNEL_LOG_AVAILABLE
+
+#if defined(CONFIG_BENCHMARK_TRACK_KERNEL_ENTRIES)
+#include <sel4/benchmark_track_types.h>
+typedef benchmark_track_kernel_entry_t microkit_kernel_log_entry;
+#elif defined(CONFIG_BENCHMARK_TRACEPOINTS)
+#include <sel4/benchmark_tracepoints_types.h>
+typedef benchmark_tracepoint_log_entry_t microkit_kernel_log_entry;
+#endif
+
+/* The size of the memory region the kernel logs to */
+#define MICROKIT_KERNEL_LOG_SIZE (1 << seL4_LargePageBits)
+#define MICROKIT_KERNEL_LOG_MAX_ENTRIES (MICROKIT_KERNEL_LOG_SIZE / sizeof(microkit_kernel_log_entry))
+
+/* Throw away the entries logged so far and start logging again from the start of the buffer */
+static inline void microkit_kernel_log_reset(void)
+{
+    seL4_BenchmarkResetLog();
+}
+
+/*
+ * Stop logging and return the number of entries in the log, which the caller
+ * can then read from the start of the memory region.
+ */
+static inline seL4_Word microkit_kernel_log_stop(void)
+{
+    seL4_Word count = seL4_BenchmarkFinalizeLog();
+    return count < MICROKIT_KERNEL_LOG_MAX_ENTRIES ? count : MICROKIT_KERNEL_LOG_MAX_ENTRIES;
+}
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Access to the performance monitoring unit (PMU) from protection domains.
+ *
+ * On AArch64 the PMU is only accessible when the kernel exports it to user
+ * level, which is the case in the 'benchmark' configuration. On RISC-V the
+ * cycle and instret counters are read directly. The hpmcounter3 and hpmcounter4
+ * counters are only read, as cache and branch misses, when the PD sets
+ * 'microkit_pmu_riscv_hpm' since which events they count (if any) is chosen by
+ * the firmware.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <microkit.h>
+
+#if (defined(__aarch64__) && defined(CONFIG_EXPORT_PMU_USER)) || defined(__riscv)
+#define MICROKIT_PMU_AVAILABLE 1
+#else
+#define MICROKIT_PMU_AVAILABLE 0
+#endif
+
+typedef struct microkit_pmu_counters {
+    seL4_Uint64 cycles;
+    seL4_Uint64 instructions;
+    seL4_Uint64 cache_misses;
+    seL4_Uint64 branch_misses;
+} microkit_pmu_counters;
+
+/* Counters accumulated over all calls of an entry point for a given channel */
+typedef struct microkit_pmu_stats {
+    seL4_Uint64 calls;
+    microkit_pmu_counters total;
+} microkit_pmu_stats;
+
+#if MICROKIT_PMU_AVAILABLE
+
+extern bool microkit_pmu_profiling;
+extern microkit_pmu_stats microkit_pmu_notified_stats[MICROKIT_MAX_CHANNELS];
+extern microkit_pmu_stats microkit_pmu_protected_stats[MICROKIT_MAX_CHANNELS];
+
+#if defined(__aarch64__)
+
+/* Common architectural event numbers */
+#define MICROKIT_PMU_EVENT_INST_RETIRED 0x08
+#define MICROKIT_PMU_EVENT_L1D_CACHE_REFILL 0x03
+#define MICROKIT_PMU_EVENT_BR_MIS_PRED 0x10
+
+/* Event counters may only be 32 bits wide */
+#define MICROKIT_PMU_EVENT_MASK 0xffffffffULL
+
+static inline void microkit_pmu_init(void)
+{
+    seL4_Word pmcr;
+
+    asm volatile("msr pmevtyper0_el0, %0" :: "r"((seL4_Word)MICROKIT_PMU_EVENT_INST_RETIRED));
+    asm volatile("msr pmevtyper1_el0, %0" :: "r"((seL4_Word)MICROKIT_PMU_EVENT_L1D_CACHE_REFILL));
+    asm volatile("msr pmevtyper2_el0, %0" :: "r"((seL4_Word)MICROKIT_PMU_EVENT_BR_MIS_PRED));
+    asm volatile("msr pmccfiltr_el0, %0" :: "r"((seL4_Word)0));
+    /* Enable the cycle counter (bit 31) and event counters 0-2 */
+    asm volatile("msr pmcntenset_el0, %0" :: "r"((seL4_Word)((1UL << 31) | 0x7)));
+
+    /* Enable the PMU (E) with a 64-bit cycle counter (LC) */
+    asm volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    pmcr |= (1 << 6) | (1 << 0);
+    asm volatile("msr pmcr_el0, %0" :: "r"(pmcr));
+    asm volatile("isb" ::: "memory");
+}
+
+static inline void microkit_pmu_read(microkit_pmu_counters *c)
+{
+    asm volatile("mrs %0, pmccntr_el0" : "=r"(c->cycles));
+    asm volatile("mrs %0, pmevcntr0_el0" : "=r"(c->instructions));
+    asm volatile("mrs %0, pmevcntr1_el0" : "=r"(c->cache_misses));
+    asm volatile("mrs %0, pmevcntr2_el0" : "=r"(c->branch_misses));
+}
+
+#elif defined(__riscv)
+
+#define MICROKIT_PMU_EVENT_MASK 0xffffffffffffffffULL
+
+extern bool microkit_pmu_riscv_hpm;
+
+static inline void microkit_pmu_init(void)
+{
+    /* The counters are set up by the firmware and cannot be configured from U-mode */
+}
+
+static inline void microkit_pmu_read(microkit_pmu_counters *c)
+{
+    asm volatile("csrr %0, cycle" : "=r"(c->cycles));
+    asm volatile("csrr %0, instret" : "=r"(c->instructions));
+    if (microkit_pmu_riscv_hpm) {
+        asm volatile("csrr %0, hpmcounter3" : "=r"(c->cache_misses));
+        asm volatile("csrr %0, hpmcounter4" : "=r"(c->branch_misses));
+    } else {
+        c->cache_misses = 0;
+        c->branch_misses = 0;
+    }
+}
+
+#endif
+
+/*
+ * Add the counts between 'start' and 'end' to 'total'. The cycle counter is
+ * always 64 bits, the other counters may wrap at a smaller width.
+ */
+static inline void microkit_pmu_accumulate(microkit_pmu_counters *total, const microkit_pmu_counters *start,
+                                           const microkit_pmu_counters *end)
+{
+    total->cycles += end->cycles - start->cycles;
+    total->instructions += (end->instructions - start->instructions) & MICROKIT_PMU_EVENT_MASK;
+    total->cache_misses += (end->cache_misses - start->cache_misses) & MICROKIT_PMU_EVENT_MASK;
+    total->branch_misses += (end->branch_misses - start->branch_misses) & MICROKIT_PMU_EVENT_MASK;
+}
+
+/*
+ * Start accumulating the counters for each call of 'notified' and 'protected'
+ * into microkit_pmu_notified_stats and microkit_pmu_protected_stats, indexed by
+ * channel. The counts include the time spent in the kernel during the entry
+ * point, but not the IPC that delivered the event.
+ */
+static inline void microkit_pmu_profile_enable(void)
+{
+    microkit_pmu_init();
+    microkit_pmu_profiling = true;
+}
+
+static inline void microkit_pmu_profile_disable(void)
+{
+    microkit_pmu_profiling = false;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Emulation of device memory for VMM protection domains.
+ *
+ * A VMM registers the guest physical address ranges of the devices it emulates
+ * and passes the VM faults it receives in 'fault' to microkit_vmm_handle_fault.
+ * Accesses to a registered range are decoded, handed to the device's read or
+ * write handler, and the guest is resumed after the faulting instruction.
+ *
+ * Decoding uses the syndrome that the hardware reports for most loads and
+ * stores. Accesses without a valid syndrome, such as those that write back the
+ * base register, are only emulated if the VMM provides a way to fetch the
+ * faulting instruction, see microkit_vmm_fetch_insn.
+ *
+ * Only available on AArch64 when the kernel is built as a hypervisor.
+ */
+
+#pragma once
+
+#include <microkit.h>
+
+#if defined(CONFIG_ARM_HYPERVISOR_SUPPORT)
+
+#define MICROKIT_VMM_MAX_DEVICES 32
+
+/*
+ * Handlers are given the offset of the access into the device and its size in
+ * bytes (1, 2, 4 or 8). Returning false leaves the fault to the caller of
+ * microkit_vmm_handle_fault.
+ */
+typedef seL4_Bool (*microkit_vmm_read_fn)(void *cookie, seL4_Word offset, seL4_Word size, seL4_Word *value);
+typedef seL4_Bool (*microkit_vmm_write_fn)(void *cookie, seL4_Word offset, seL4_Word size, seL4_Word value);
+
+typedef struct microkit_vmm_device {
+    const char *name;
+    /* Guest physical address range of the device */
+    seL4_Word base;
+    seL4_Word size;
+    microkit_vmm_read_fn read;
+    microkit_vmm_write_fn write;
+    void *cookie;
+    /* Number of guest accesses emulated, kept by the library */
+    seL4_Uint64 exits;
+} microkit_vmm_device;
+
+/*
+ * Optionally set by the VMM to read the instruction at guest virtual address
+ * 'pc', which requires walking the guest's page tables.
+ */
+extern seL4_Bool (*microkit_vmm_fetch_insn)(microkit_child vcpu, seL4_Word pc, seL4_Uint32 *insn);
+
+/* Faults that were not handled, for example as no device covers the address */
+extern seL4_Uint64 microkit_vmm_unhandled_exits;
+
+/*
+ * Register a device. The device must stay valid while registered. Fails if the
+ * range overlaps another device or too many devices are registered.
+ */
+seL4_Bool microkit_vmm_add_device(microkit_vmm_device *dev);
+
+/*
+ * Emulate the access that caused a fault of 'vcpu', which is expected to be
+ * called from 'fault' with its arguments. Returns whether the fault was handled,
+ * in which case 'reply_msginfo' is set and 'fault' should return true.
+ */
+seL4_Bool microkit_vmm_handle_fault(microkit_child vcpu, microkit_msginfo msginfo, microkit_msginfo *reply_msginfo);
+
+/* Print the number of exits of each device to the debug console */
+void microkit_vmm_print_stats(void);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <microkit.h>
+
+/*
+ * The message page is a sequence lock. The producer makes the sequence number
+ * odd before writing a message and even again once it is done, and consumers
+ * only accept a copy if the number was even and unchanged around it. Consumers
+ * do not retry, as they may run at a higher priority than the producer, which
+ * notifies them again after finishing a message.
+ */
+
+static microkit_broadcast_message *producer_message(unsigned int id)
+{
+    if (id >= MICROKIT_MAX_BROADCASTS || microkit_broadcast_consumers[id] == 0) {
+        return (void *)0;
+    }
+#if defined(__CHERI_PURE_CAPABILITY__)
+    return microkit_broadcast_buffer_caps[id];
+#else
+    return (microkit_broadcast_message *)microkit_broadcast_vaddrs[id];
+#endif
+}
+
+void *microkit_broadcast_begin(unsigned int id)
+{
+    microkit_broadcast_message *msg = producer_message(id);
+    if (msg == (void *)0) {
+        return (void *)0;
+    }
+
+    seL4_Word seq = msg->seq;
+    if ((seq & 1) == 0) {
+        __atomic_store_n(&msg->seq, seq + 1, __ATOMIC_RELAXED);
+        /* Consumers must see the odd number before any of the new message */
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    return msg->data;
+}
+
+seL4_Word microkit_broadcast_size(unsigned int id)
+{
+    if (producer_message(id) == (void *)0) {
+        return 0;
+    }
+    return microkit_broadcast_sizes[id] - sizeof(microkit_broadcast_message);
+}
+
+void microkit_broadcast(unsigned int id)
+{
+    microkit_broadcast_message *msg = producer_message(id);
+    if (msg == (void *)0) {
+        microkit_dbg_puts(microkit_name);
+        microkit_dbg_puts(" microkit_broadcast: invalid broadcast given '");
+        microkit_dbg_put32(id);
+        microkit_dbg_puts("'\n");
+        return;
+    }
+
+    seL4_Word seq = msg->seq;
+    if (seq & 1) {
+        __atomic_store_n(&msg->seq, seq + 1, __ATOMIC_RELEASE);
+    }
+
+    /* The caps to the consumers are consecutive, and signalling never blocks */
+    seL4_CPtr cap = microkit_broadcast_caps[id];
+    seL4_Word consumers = microkit_broadcast_consumers[id];
+    for (seL4_Word i = 0; i < consumers; i++) {
+        seL4_Signal(cap + i);
+    }
+}
+
+seL4_Word microkit_broadcast_read(microkit_channel ch, void *buf, seL4_Word length)
+{
+    const microkit_broadcast_message *msg = microkit_channel_buffer(ch);
+    seL4_Word size = microkit_channel_buffer_size(ch);
+    if (msg == (void *)0 || size <= sizeof(microkit_broadcast_message)) {
+        return 0;
+    }
+    if (length > size - sizeof(microkit_broadcast_message)) {
+        length = size - sizeof(microkit_broadcast_message);
+    }
+
+    seL4_Word seq = __atomic_load_n(&msg->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0 || (seq & 1)) {
+        return 0;
+    }
+
+    /* Volatile so that the copy is not turned into a call to memcpy */
+    const volatile seL4_Uint8 *src = msg->data;
+    seL4_Uint8 *dst = buf;
+    for (seL4_Word i = 0; i < length; i++) {
+        dst[i] = src[i];
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&msg->seq, __ATOMIC_RELAXED) != seq) {
+        return 0;
+    }
+
+    return seq / 2;
+}
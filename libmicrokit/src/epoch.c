@@ -0,0 +1,148 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <microkit.h>
+#include <microkit_epoch.h>
+
+/*
+ * The writer stores the new version and then increments the epoch with release
+ * ordering, and a reader loads the epoch with acquire ordering at each quiescent
+ * point. So once a reader has seen an epoch, it can only see the versions current
+ * in that epoch or later. A reader's store of the epoch it saw is a release, so
+ * when the writer sees it, all the reader's accesses to older versions are done.
+ */
+
+unsigned int microkit_epoch_num_domains;
+seL4_Word microkit_epoch_nudge_mask;
+
+static struct {
+    microkit_epoch_domain *domain;
+    unsigned int reader;
+    seL4_Word epoch;
+} domains[MICROKIT_EPOCH_MAX_DOMAINS];
+
+void microkit_epoch_quiescent(void)
+{
+    for (unsigned int i = 0; i < microkit_epoch_num_domains; i++) {
+        seL4_Word epoch = __atomic_load_n(&domains[i].domain->epoch, __ATOMIC_ACQUIRE);
+        if (epoch != domains[i].epoch) {
+            domains[i].epoch = epoch;
+            __atomic_store_n(&domains[i].domain->readers[domains[i].reader].epoch, epoch, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+seL4_Bool microkit_epoch_reader_register(microkit_epoch_domain *domain, unsigned int reader,
+                                         microkit_channel nudge)
+{
+    if (microkit_epoch_num_domains == MICROKIT_EPOCH_MAX_DOMAINS || reader >= MICROKIT_EPOCH_MAX_READERS) {
+        return seL4_False;
+    }
+
+    unsigned int i = microkit_epoch_num_domains;
+    domains[i].domain = domain;
+    domains[i].reader = reader;
+    domains[i].epoch = __atomic_load_n(&domain->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&domain->readers[reader].epoch, domains[i].epoch, __ATOMIC_RELEASE);
+    /* The writer must see that this PD is reading before it reads the current version */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    microkit_epoch_num_domains++;
+
+    if (nudge != MICROKIT_EPOCH_NO_NUDGE) {
+        microkit_epoch_nudge_mask |= 1ULL << nudge;
+    }
+
+    return seL4_True;
+}
+
+void microkit_epoch_writer_init(microkit_epoch_writer *writer, microkit_epoch_domain *domain, seL4_Word version,
+                                microkit_epoch_reclaim_fn reclaim, void *cookie)
+{
+    writer->domain = domain;
+    writer->reclaim = reclaim;
+    writer->cookie = cookie;
+    for (unsigned int i = 0; i < MICROKIT_EPOCH_MAX_READERS; i++) {
+        writer->nudge[i] = MICROKIT_EPOCH_NO_NUDGE;
+        writer->nudged[i] = 0;
+        domain->readers[i].epoch = 0;
+    }
+    writer->num_retired = 0;
+
+    domain->current = version;
+    __atomic_store_n(&domain->epoch, 1, __ATOMIC_RELEASE);
+}
+
+void microkit_epoch_writer_nudge(microkit_epoch_writer *writer, unsigned int reader, microkit_channel ch)
+{
+    if (reader < MICROKIT_EPOCH_MAX_READERS) {
+        writer->nudge[reader] = ch;
+    }
+}
+
+seL4_Bool microkit_epoch_publish(microkit_epoch_writer *writer, seL4_Word version)
+{
+    microkit_epoch_domain *domain = writer->domain;
+    if (writer->num_retired == MICROKIT_EPOCH_MAX_RETIRED) {
+        return seL4_False;
+    }
+
+    seL4_Word old = domain->current;
+    seL4_Word epoch = domain->epoch + 1;
+    __atomic_store_n(&domain->current, version, __ATOMIC_RELEASE);
+    __atomic_store_n(&domain->epoch, epoch, __ATOMIC_RELEASE);
+
+    writer->retired[writer->num_retired].version = old;
+    writer->retired[writer->num_retired].epoch = epoch;
+    writer->num_retired++;
+
+    return seL4_True;
+}
+
+unsigned int microkit_epoch_reclaim(microkit_epoch_writer *writer)
+{
+    microkit_epoch_domain *domain = writer->domain;
+    if (writer->num_retired == 0) {
+        return 0;
+    }
+
+    /* Pairs with the fence in microkit_epoch_reader_register */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* The oldest epoch that a reader may still be using versions from */
+    seL4_Word oldest = domain->epoch;
+    for (unsigned int i = 0; i < MICROKIT_EPOCH_MAX_READERS; i++) {
+        seL4_Word epoch = __atomic_load_n(&domain->readers[i].epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    /* Versions are retired in order of epoch */
+    unsigned int done = 0;
+    while (done < writer->num_retired && writer->retired[done].epoch <= oldest) {
+        writer->reclaim(writer->cookie, writer->retired[done].version);
+        done++;
+    }
+    for (unsigned int i = done; i < writer->num_retired; i++) {
+        writer->retired[i - done] = writer->retired[i];
+    }
+    writer->num_retired -= done;
+
+    if (writer->num_retired == 0) {
+        return 0;
+    }
+
+    seL4_Word needed = writer->retired[0].epoch;
+    for (unsigned int i = 0; i < MICROKIT_EPOCH_MAX_READERS; i++) {
+        seL4_Word epoch = __atomic_load_n(&domain->readers[i].epoch, __ATOMIC_RELAXED);
+        if (epoch != 0 && epoch < needed && writer->nudge[i] != MICROKIT_EPOCH_NO_NUDGE
+            && writer->nudged[i] != needed) {
+            writer->nudged[i] = needed;
+            microkit_notify(writer->nudge[i]);
+        }
+    }
+
+    return writer->num_retired;
+}
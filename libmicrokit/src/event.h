@@ -0,0 +1,152 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/*
+ * Shared by libmicrokit's event loops. Each loop is a separate object that
+ * defines microkit_event_loop: the one handling every kind of event is in
+ * libmicrokit.a, and a PD that needs less links one of the others ahead of
+ * the library so that only its loop ends up in the program image.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define __thread
+#include <sel4/sel4.h>
+
+#include <microkit.h>
+#include <microkit_pmu.h>
+#include <microkit_epoch.h>
+
+#define INPUT_CAP 1
+#define REPLY_CAP 4
+
+#define PD_MASK 0xff
+#define CHANNEL_MASK 0x3f
+
+/*
+ * The events beyond notifications that the linked loop handles, given by
+ * microkit_event_loop_events. The tool checks this against the system
+ * description, so these must match the Microkit tool.
+ */
+#define MICROKIT_EVENT_PPCS (1 << 0)
+#define MICROKIT_EVENT_FAULTS (1 << 1)
+#define MICROKIT_EVENT_POLL (1 << 2)
+
+extern const seL4_Word microkit_event_loop_events;
+void microkit_event_loop(void);
+
+extern seL4_Word microkit_dispatch_mask;
+extern seL4_Uint8 microkit_dispatch_order[MICROKIT_MAX_CHANNELS];
+
+static inline void dispatch_notified(microkit_channel ch)
+{
+#if MICROKIT_PMU_AVAILABLE
+    if (microkit_pmu_profiling) {
+        microkit_pmu_counters start, end;
+        microkit_pmu_read(&start);
+        notified(ch);
+        microkit_pmu_read(&end);
+        microkit_pmu_notified_stats[ch].calls++;
+        microkit_pmu_accumulate(&microkit_pmu_notified_stats[ch].total, &start, &end);
+        return;
+    }
+#endif
+    notified(ch);
+}
+
+static inline microkit_msginfo dispatch_protected(microkit_channel ch, microkit_msginfo msginfo)
+{
+#if MICROKIT_PMU_AVAILABLE
+    if (microkit_pmu_profiling) {
+        microkit_pmu_counters start, end;
+        microkit_pmu_read(&start);
+        microkit_msginfo reply = protected(ch, msginfo);
+        microkit_pmu_read(&end);
+        microkit_pmu_protected_stats[ch].calls++;
+        microkit_pmu_accumulate(&microkit_pmu_protected_stats[ch].total, &start, &end);
+        return reply;
+    }
+#endif
+    return protected(ch, msginfo);
+}
+
+/*
+ * Call 'notified' for each channel set in 'badge'. Channels that have a dispatch
+ * priority are serviced first, in the order given by the system description,
+ * and then the rest in order of channel ID.
+ */
+static inline void dispatch_notifications(seL4_Word badge)
+{
+    seL4_Word prioritised = badge & microkit_dispatch_mask;
+    for (unsigned int i = 0; prioritised != 0; i++) {
+        microkit_channel ch = microkit_dispatch_order[i];
+        if (prioritised & (1ULL << ch)) {
+            dispatch_notified(ch);
+            prioritised &= ~(1ULL << ch);
+        }
+    }
+    badge &= ~microkit_dispatch_mask;
+
+    unsigned int idx = 0;
+    while (badge != 0) {
+        if (badge & 1) {
+            dispatch_notified(idx);
+        }
+        badge >>= 1;
+        idx++;
+    }
+}
+
+/*
+ * Returns whether the event needs a reply, in which case 'reply_tag' is set.
+ * 'ppcs' and 'faults' say whether the loop handles protected procedure calls
+ * and faults, they are constant in each loop so the checks are compiled out.
+ */
+static inline __attribute__((always_inline)) bool handle_event(seL4_Word badge, seL4_MessageInfo_t tag,
+                                                               seL4_MessageInfo_t *reply_tag, bool ppcs, bool faults)
+{
+    uint64_t is_endpoint = badge >> 63;
+    uint64_t is_fault = (badge >> 62) & 1;
+
+    if (faults && is_fault) {
+        return fault(badge & PD_MASK, tag, reply_tag);
+    } else if (ppcs && is_endpoint) {
+        *reply_tag = dispatch_protected(badge & CHANNEL_MASK, tag);
+        return true;
+    } else {
+        /* Nudges from epoch writers only need the quiescent point below */
+        dispatch_notifications(badge & ~microkit_epoch_nudge_mask);
+        return false;
+    }
+}
+
+static inline __attribute__((always_inline)) void handler_loop(bool ppcs, bool faults)
+{
+    bool have_reply = false;
+    seL4_MessageInfo_t reply_tag;
+
+    for (;;) {
+        seL4_Word badge;
+        seL4_MessageInfo_t tag;
+
+        if (have_reply) {
+            tag = seL4_ReplyRecv(INPUT_CAP, reply_tag, &badge, REPLY_CAP);
+        } else if (microkit_have_signal) {
+            tag = seL4_NBSendRecv(microkit_signal_cap, microkit_signal_msg, INPUT_CAP, &badge, REPLY_CAP);
+            microkit_have_signal = seL4_False;
+        } else {
+            tag = seL4_Recv(INPUT_CAP, &badge, REPLY_CAP);
+        }
+
+        have_reply = handle_event(badge, tag, &reply_tag, ppcs, faults);
+
+        /* Between events the PD holds no references to versions of shared tables */
+        if (microkit_epoch_num_domains != 0) {
+            microkit_epoch_quiescent();
+        }
+    }
+}
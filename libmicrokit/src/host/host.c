@@ -0,0 +1,126 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Host backend for libmicrokit.
+ *
+ * This replaces main.c when a protection domain is built as a shared object to
+ * be run on the build host with 'microkit --host'. Rather than an event loop
+ * around seL4 system calls, the tool calls the microkit_host_* entry points
+ * below from the PD's thread, and system calls made by the PD are forwarded to
+ * the tool through microkit_host_ops.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <microkit.h>
+#include <microkit_epoch.h>
+
+/* All globals are prefixed with microkit_* to avoid clashes with user defined globals. */
+
+bool microkit_passive;
+char microkit_name[MICROKIT_PD_NAME_LENGTH];
+seL4_Bool microkit_have_signal = seL4_False;
+seL4_CPtr microkit_signal_cap;
+seL4_MessageInfo_t microkit_signal_msg;
+
+seL4_Word microkit_irqs;
+seL4_Word microkit_notifications;
+seL4_Word microkit_pps;
+
+seL4_Word microkit_dispatch_mask;
+seL4_Uint8 microkit_dispatch_order[MICROKIT_MAX_CHANNELS];
+
+seL4_Word microkit_channel_buffer_vaddrs[MICROKIT_MAX_CHANNELS];
+seL4_Word microkit_channel_buffer_sizes[MICROKIT_MAX_CHANNELS];
+
+seL4_Word microkit_broadcast_vaddrs[MICROKIT_MAX_BROADCASTS];
+seL4_Word microkit_broadcast_sizes[MICROKIT_MAX_BROADCASTS];
+seL4_Word microkit_broadcast_caps[MICROKIT_MAX_BROADCASTS];
+seL4_Word microkit_broadcast_consumers[MICROKIT_MAX_BROADCASTS];
+
+seL4_Word microkit_templates;
+
+/* Patched by the tool when loading the PD */
+const struct microkit_host_ops *microkit_host_ops;
+seL4_Word microkit_host_pd;
+
+seL4_Word microkit_host_mrs[seL4_MsgMaxLength];
+
+__attribute__((weak)) microkit_msginfo protected(microkit_channel ch, microkit_msginfo msginfo)
+{
+    microkit_dbg_puts(microkit_name);
+    microkit_dbg_puts(" is missing the 'protected' entry point\n");
+    microkit_internal_crash(0);
+    return seL4_MessageInfo_new(0, 0, 0, 0);
+}
+
+void seL4_DebugPutChar(char c)
+{
+    putchar(c);
+    if (c == '\n') {
+        fflush(stdout);
+    }
+}
+
+/*
+ * On seL4 a deferred signal is combined with the PD's next receive, here we
+ * just perform it once the entry point returns. Deferred IRQ acks have no effect
+ * on the host.
+ */
+static void deferred_signal(void)
+{
+    if (microkit_have_signal) {
+        microkit_have_signal = seL4_False;
+        if (seL4_MessageInfo_get_label(microkit_signal_msg) != IRQAckIRQ) {
+            seL4_Signal(microkit_signal_cap);
+        }
+    }
+    /* The same quiescent point as the event loop */
+    if (microkit_epoch_num_domains != 0) {
+        microkit_epoch_quiescent();
+    }
+}
+
+void microkit_host_init(void)
+{
+    init();
+    deferred_signal();
+}
+
+void microkit_host_notified(seL4_Word badge)
+{
+    badge &= ~microkit_epoch_nudge_mask;
+
+    /* The same order as the event loop in main.c */
+    seL4_Word prioritised = badge & microkit_dispatch_mask;
+    for (unsigned int i = 0; prioritised != 0; i++) {
+        microkit_channel ch = microkit_dispatch_order[i];
+        if (prioritised & (1ULL << ch)) {
+            notified(ch);
+            prioritised &= ~(1ULL << ch);
+        }
+    }
+    badge &= ~microkit_dispatch_mask;
+
+    unsigned int idx = 0;
+    while (badge != 0) {
+        if (badge & 1) {
+            notified(idx);
+        }
+        badge >>= 1;
+        idx++;
+    }
+    deferred_signal();
+}
+
+seL4_Word microkit_host_protected(seL4_Word ch, seL4_Word msginfo)
+{
+    seL4_MessageInfo_t tag = { .words = { msginfo } };
+    seL4_MessageInfo_t reply = protected(ch, tag);
+    deferred_signal();
+    return reply.words[0];
+}
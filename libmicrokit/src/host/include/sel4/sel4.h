@@ -0,0 +1,120 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * A minimal stand-in for the seL4 user-level API, just enough for libmicrokit's
+ * header to be used by protection domains that run on the host (see host.c).
+ * System calls are forwarded to the Microkit tool, which runs the system.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uint8_t seL4_Uint8;
+typedef uint16_t seL4_Uint16;
+typedef uint32_t seL4_Uint32;
+typedef uint64_t seL4_Uint64;
+typedef uint64_t seL4_Word;
+typedef seL4_Word seL4_CPtr;
+typedef seL4_Uint8 seL4_Bool;
+
+#define seL4_True 1
+#define seL4_False 0
+
+#define seL4_MsgMaxLength 120
+
+/* Printing is always available on the host */
+#define CONFIG_PRINTING 1
+
+typedef enum {
+    seL4_NoError = 0,
+    seL4_InvalidArgument,
+    seL4_InvalidCapability,
+    seL4_IllegalOperation,
+} seL4_Error;
+
+enum invocation_label {
+    IRQAckIRQ = 1,
+};
+
+typedef struct seL4_MessageInfo {
+    seL4_Uint64 words[1];
+} seL4_MessageInfo_t;
+
+typedef struct seL4_UserContext_ {
+    seL4_Word pc;
+} seL4_UserContext;
+
+static inline seL4_MessageInfo_t seL4_MessageInfo_new(seL4_Uint64 label, seL4_Uint64 capsUnwrapped,
+                                                      seL4_Uint64 extraCaps, seL4_Uint64 length)
+{
+    seL4_MessageInfo_t info;
+    info.words[0] = (label << 12) | ((capsUnwrapped & 0x7) << 9) | ((extraCaps & 0x3) << 7) | (length & 0x7f);
+    return info;
+}
+
+static inline seL4_Uint64 seL4_MessageInfo_get_label(seL4_MessageInfo_t info)
+{
+    return info.words[0] >> 12;
+}
+
+static inline seL4_Uint64 seL4_MessageInfo_get_length(seL4_MessageInfo_t info)
+{
+    return info.words[0] & 0x7f;
+}
+
+/* Provided by the Microkit tool when it loads the protection domain */
+struct microkit_host_ops {
+    void (*signal)(seL4_Word pd, seL4_CPtr cap);
+    seL4_Word (*ppcall)(seL4_Word pd, seL4_CPtr cap, seL4_Word msginfo);
+};
+
+extern const struct microkit_host_ops *microkit_host_ops;
+extern seL4_Word microkit_host_pd;
+extern seL4_Word microkit_host_mrs[seL4_MsgMaxLength];
+
+void seL4_DebugPutChar(char c);
+
+static inline void seL4_SetMR(int i, seL4_Word mr)
+{
+    microkit_host_mrs[i] = mr;
+}
+
+static inline seL4_Word seL4_GetMR(int i)
+{
+    return microkit_host_mrs[i];
+}
+
+static inline void seL4_Signal(seL4_CPtr dest)
+{
+    microkit_host_ops->signal(microkit_host_pd, dest);
+}
+
+static inline seL4_MessageInfo_t seL4_Call(seL4_CPtr dest, seL4_MessageInfo_t msgInfo)
+{
+    seL4_MessageInfo_t reply;
+    reply.words[0] = microkit_host_ops->ppcall(microkit_host_pd, dest, msgInfo.words[0]);
+    return reply;
+}
+
+static inline seL4_Error seL4_IRQHandler_Ack(seL4_CPtr irq_handler)
+{
+    /* There are no real interrupts on the host */
+    return seL4_NoError;
+}
+
+/* Child protection domains are not supported on the host */
+static inline seL4_Error seL4_TCB_WriteRegisters(seL4_CPtr tcb, seL4_Bool resume_target, seL4_Uint8 arch_flags,
+                                                 seL4_Word count, seL4_UserContext *regs)
+{
+    return seL4_IllegalOperation;
+}
+
+static inline seL4_Error seL4_TCB_Suspend(seL4_CPtr tcb)
+{
+    return seL4_IllegalOperation;
+}
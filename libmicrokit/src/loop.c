@@ -0,0 +1,14 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/* The event loop in libmicrokit.a, used unless the PD links another one */
+#include "event.h"
+
+const seL4_Word microkit_event_loop_events = MICROKIT_EVENT_PPCS | MICROKIT_EVENT_FAULTS;
+
+void microkit_event_loop(void)
+{
+    handler_loop(true, true);
+}
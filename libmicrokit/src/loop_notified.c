@@ -0,0 +1,17 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/*
+ * The event loop for PDs that are only ever notified, such as drivers that
+ * only handle IRQs. It never checks for calls or faults and never replies.
+ */
+#include "event.h"
+
+const seL4_Word microkit_event_loop_events = 0;
+
+void microkit_event_loop(void)
+{
+    handler_loop(false, false);
+}
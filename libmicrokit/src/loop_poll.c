@@ -0,0 +1,88 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/*
+ * The event loop of a PD with mode="poll". Rather than blocking in the kernel
+ * this repeatedly runs the registered pollers and checks for notifications,
+ * protected procedure calls and faults with a non-blocking receive. While there
+ * is nothing to do the PD backs off exponentially, up to
+ * microkit_poll_backoff_max idle hints between rounds.
+ */
+#include "event.h"
+
+const seL4_Word microkit_event_loop_events = MICROKIT_EVENT_PPCS | MICROKIT_EVENT_FAULTS | MICROKIT_EVENT_POLL;
+
+static struct {
+    microkit_poller fn;
+    void *arg;
+} pollers[MICROKIT_MAX_POLLERS];
+static unsigned int num_pollers;
+
+/* Overrides the one in libmicrokit.a, which fails as the PD does not poll */
+seL4_Bool microkit_poll_register(microkit_poller fn, void *arg)
+{
+    if (num_pollers == MICROKIT_MAX_POLLERS) {
+        return seL4_False;
+    }
+    pollers[num_pollers].fn = fn;
+    pollers[num_pollers].arg = arg;
+    num_pollers++;
+    return seL4_True;
+}
+
+static inline void idle_hint(void)
+{
+#if defined(__aarch64__)
+    asm volatile("yield");
+#elif defined(__riscv)
+    /* 'pause' from Zihintpause, which is encoded as a FENCE with no effect on other harts */
+    asm volatile(".word 0x0100000f");
+#endif
+}
+
+void microkit_event_loop(void)
+{
+    seL4_Word backoff = 0;
+
+    for (;;) {
+        bool work = false;
+        seL4_Word badge;
+        seL4_MessageInfo_t tag, reply_tag;
+
+        if (microkit_have_signal) {
+            seL4_NBSend(microkit_signal_cap, microkit_signal_msg);
+            microkit_have_signal = seL4_False;
+        }
+
+        for (unsigned int i = 0; i < num_pollers; i++) {
+            work |= pollers[i].fn(pollers[i].arg);
+        }
+
+        /* A failed non-blocking receive sets the badge to 0, which no event has */
+        tag = seL4_NBRecv(INPUT_CAP, &badge, REPLY_CAP);
+        if (badge != 0) {
+            work = true;
+            if (handle_event(badge, tag, &reply_tag, true, true)) {
+                seL4_Send(REPLY_CAP, reply_tag);
+            }
+        }
+
+        if (microkit_epoch_num_domains != 0) {
+            microkit_epoch_quiescent();
+        }
+
+        if (work) {
+            backoff = 0;
+        } else {
+            for (seL4_Word i = 0; i < backoff; i++) {
+                idle_hint();
+            }
+            backoff = backoff ? backoff * 2 : 1;
+            if (backoff > microkit_poll_backoff_max) {
+                backoff = microkit_poll_backoff_max;
+            }
+        }
+    }
+}
@@ -0,0 +1,17 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/*
+ * The event loop for PDs that have no children or virtual machine, such as
+ * passive servers, which are notified and called but never receive faults.
+ */
+#include "event.h"
+
+const seL4_Word microkit_event_loop_events = MICROKIT_EVENT_PPCS;
+
+void microkit_event_loop(void)
+{
+    handler_loop(true, false);
+}
@@ -3,20 +3,9 @@
  *
  * SPDX-License-Identifier: BSD-2-Clause
  */
-#include <stdbool.h>
 #include <stddef.h>
-#include <stdint.h>
 
-#define __thread
-#include <sel4/sel4.h>
-
-#include <microkit.h>
-
-#define INPUT_CAP 1
-#define REPLY_CAP 4
-
-#define PD_MASK 0xff
-#define CHANNEL_MASK 0x3f
+#include "event.h"
 
 /* All globals are prefixed with microkit_* to avoid clashes with user defined globals. */
 
@@ -32,6 +21,20 @@ seL4_Word microkit_irqs;
 seL4_Word microkit_notifications;
 seL4_Word microkit_pps;
 
+/* Channels with a dispatch priority, and the order in which to service them, patched by the tool */
+seL4_Word microkit_dispatch_mask;
+seL4_Uint8 microkit_dispatch_order[MICROKIT_MAX_CHANNELS];
+
+seL4_Word microkit_channel_buffer_vaddrs[MICROKIT_MAX_CHANNELS];
+seL4_Word microkit_channel_buffer_sizes[MICROKIT_MAX_CHANNELS];
+
+seL4_Word microkit_broadcast_vaddrs[MICROKIT_MAX_BROADCASTS];
+seL4_Word microkit_broadcast_sizes[MICROKIT_MAX_BROADCASTS];
+seL4_Word microkit_broadcast_caps[MICROKIT_MAX_BROADCASTS];
+seL4_Word microkit_broadcast_consumers[MICROKIT_MAX_BROADCASTS];
+
+seL4_Word microkit_templates;
+
 extern seL4_IPCBuffer __sel4_ipc_buffer_obj;
 
 #if defined(__CHERI_PURE_CAPABILITY__)
@@ -42,6 +45,9 @@ extern seL4_IPCBuffer __sel4_ipc_buffer_obj;
  * domains.
  */
 seL4_IPCBuffer *__sel4_ipc_buffer_cap;
+
+void *microkit_channel_buffer_caps[MICROKIT_MAX_CHANNELS];
+void *microkit_broadcast_buffer_caps[MICROKIT_MAX_BROADCASTS];
 #endif
 
 seL4_IPCBuffer *__sel4_ipc_buffer = &__sel4_ipc_buffer_obj;
@@ -65,6 +71,23 @@ __attribute__((weak)) seL4_Bool fault(microkit_child child, microkit_msginfo msg
     return seL4_False;
 }
 
+#if MICROKIT_PMU_AVAILABLE
+bool microkit_pmu_profiling;
+microkit_pmu_stats microkit_pmu_notified_stats[MICROKIT_MAX_CHANNELS];
+microkit_pmu_stats microkit_pmu_protected_stats[MICROKIT_MAX_CHANNELS];
+#if defined(__riscv)
+bool microkit_pmu_riscv_hpm;
+#endif
+#endif
+
+seL4_Word microkit_poll_backoff_max = 64;
+
+/* Only a PD that links the polling event loop can register pollers */
+__attribute__((weak)) seL4_Bool microkit_poll_register(microkit_poller fn, void *arg)
+{
+    return seL4_False;
+}
+
 static void run_init_funcs(void)
 {
     size_t count = __init_array_end - __init_array_start;
@@ -73,50 +96,6 @@ static void run_init_funcs(void)
     }
 }
 
-static void handler_loop(void)
-{
-    bool have_reply = false;
-    seL4_MessageInfo_t reply_tag;
-
-    for (;;) {
-        seL4_Word badge;
-        seL4_MessageInfo_t tag;
-
-        if (have_reply) {
-            tag = seL4_ReplyRecv(INPUT_CAP, reply_tag, &badge, REPLY_CAP);
-        } else if (microkit_have_signal) {
-            tag = seL4_NBSendRecv(microkit_signal_cap, microkit_signal_msg, INPUT_CAP, &badge, REPLY_CAP);
-            microkit_have_signal = seL4_False;
-        } else {
-            tag = seL4_Recv(INPUT_CAP, &badge, REPLY_CAP);
-        }
-
-        uint64_t is_endpoint = badge >> 63;
-        uint64_t is_fault = (badge >> 62) & 1;
-
-        have_reply = false;
-
-        if (is_fault) {
-            seL4_Bool reply_to_fault = fault(badge & PD_MASK, tag, &reply_tag);
-            if (reply_to_fault) {
-                have_reply = true;
-            }
-        } else if (is_endpoint) {
-            have_reply = true;
-            reply_tag = protected(badge & CHANNEL_MASK, tag);
-        } else {
-            unsigned int idx = 0;
-            do  {
-                if (badge & 1) {
-                    notified(idx);
-                }
-                badge >>= 1;
-                idx++;
-            } while (badge != 0);
-        }
-    }
-}
-
 void main(void)
 {
     run_init_funcs();
@@ -138,5 +117,5 @@ void main(void)
         microkit_signal_cap = MONITOR_EP;
     }
 
-    handler_loop();
+    microkit_event_loop();
 }
@@ -0,0 +1,328 @@
+/*
+ * Copyright 2025, Capabilities Limited
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <stddef.h>
+#include <microkit.h>
+#include <microkit_vmm.h>
+
+#if defined(CONFIG_ARM_HYPERVISOR_SUPPORT)
+
+/* Fields of the syndrome (ESR_EL2) of a data abort */
+#define ESR_EC(esr) ((esr) >> 26)
+#define ESR_EC_DATA_ABORT_LOWER 0x24
+#define ESR_IL (1UL << 25)
+#define ESR_ISV (1UL << 24)
+#define ESR_SAS(esr) (((esr) >> 22) & 0x3)
+#define ESR_SSE (1UL << 21)
+#define ESR_SRT(esr) (((esr) >> 16) & 0x1f)
+#define ESR_SF (1UL << 15)
+#define ESR_WNR (1UL << 6)
+
+/* Index of registers in seL4_UserContext, which starts with pc, sp, spsr, x0 */
+#define REG_PC 0
+#define REG_SP 1
+#define REG_X0 3
+
+/* Register number 31 is the zero register, or SP when it is the base register */
+#define REG_31 31
+
+struct access {
+    seL4_Word size;
+    seL4_Bool write;
+    seL4_Bool sign_extend;
+    /* Whether a load writes all 64 bits of the register */
+    seL4_Bool reg64;
+    unsigned int rt;
+    seL4_Word insn_len;
+    /* Only when decoded from the instruction: pre/post-indexed base update */
+    seL4_Bool writeback;
+    unsigned int rn;
+    seL4_Word imm;
+};
+
+seL4_Bool (*microkit_vmm_fetch_insn)(microkit_child vcpu, seL4_Word pc, seL4_Uint32 *insn);
+seL4_Uint64 microkit_vmm_unhandled_exits;
+
+/* Sorted by base address */
+static microkit_vmm_device *devices[MICROKIT_VMM_MAX_DEVICES];
+static unsigned int num_devices;
+/* Guests tend to access the same device many times in a row */
+static microkit_vmm_device *last_device;
+
+seL4_Bool microkit_vmm_add_device(microkit_vmm_device *dev)
+{
+    if (num_devices == MICROKIT_VMM_MAX_DEVICES || dev->size == 0 || dev->base + dev->size < dev->base) {
+        return seL4_False;
+    }
+
+    unsigned int idx = 0;
+    while (idx < num_devices && devices[idx]->base < dev->base) {
+        idx++;
+    }
+    if (idx > 0 && devices[idx - 1]->base + devices[idx - 1]->size > dev->base) {
+        return seL4_False;
+    }
+    if (idx < num_devices && dev->base + dev->size > devices[idx]->base) {
+        return seL4_False;
+    }
+
+    for (unsigned int i = num_devices; i > idx; i--) {
+        devices[i] = devices[i - 1];
+    }
+    devices[idx] = dev;
+    num_devices++;
+    dev->exits = 0;
+
+    return seL4_True;
+}
+
+static microkit_vmm_device *find_device(seL4_Word addr)
+{
+    if (last_device != NULL && addr - last_device->base < last_device->size) {
+        return last_device;
+    }
+
+    unsigned int lo = 0;
+    unsigned int hi = num_devices;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        microkit_vmm_device *dev = devices[mid];
+        if (addr < dev->base) {
+            hi = mid;
+        } else if (addr - dev->base >= dev->size) {
+            lo = mid + 1;
+        } else {
+            last_device = dev;
+            return dev;
+        }
+    }
+
+    return NULL;
+}
+
+static void decode_syndrome(seL4_Word esr, struct access *a)
+{
+    a->size = 1UL << ESR_SAS(esr);
+    a->write = (esr & ESR_WNR) != 0;
+    a->sign_extend = (esr & ESR_SSE) != 0;
+    a->reg64 = (esr & ESR_SF) != 0;
+    a->rt = ESR_SRT(esr);
+    a->insn_len = (esr & ESR_IL) ? 4 : 2;
+    a->writeback = seL4_False;
+    a->rn = 0;
+}
+
+/*
+ * Decode the A64 load and store (single general-purpose register) encodings
+ * with an immediate or register offset, including the pre- and post-indexed
+ * forms for which the hardware gives no syndrome.
+ */
+static seL4_Bool decode_insn(seL4_Uint32 insn, struct access *a)
+{
+    unsigned int size = insn >> 30;
+    unsigned int opc = (insn >> 22) & 0x3;
+
+    /* SIMD and floating-point registers */
+    if (insn & (1U << 26)) {
+        return seL4_False;
+    }
+
+    a->writeback = seL4_False;
+    if ((insn & 0x3b000000) == 0x39000000) {
+        /* Unsigned immediate offset */
+    } else if ((insn & 0x3b200000) == 0x38000000) {
+        /* 9-bit signed immediate, unscaled, post-indexed, unprivileged or pre-indexed */
+        unsigned int op2 = (insn >> 10) & 0x3;
+        if (op2 == 1 || op2 == 3) {
+            a->writeback = seL4_True;
+            a->imm = (seL4_Word)((seL4_Int64)((seL4_Uint64)((insn >> 12) & 0x1ff) << 55) >> 55);
+        }
+    } else if ((insn & 0x3b200c00) == 0x38200800) {
+        /* Register offset */
+    } else {
+        return seL4_False;
+    }
+
+    a->size = 1UL << size;
+    a->rt = insn & 0x1f;
+    a->rn = (insn >> 5) & 0x1f;
+    a->insn_len = 4;
+    switch (opc) {
+    case 0:
+        a->write = seL4_True;
+        a->sign_extend = seL4_False;
+        a->reg64 = size == 3;
+        break;
+    case 1:
+        a->write = seL4_False;
+        a->sign_extend = seL4_False;
+        a->reg64 = size == 3;
+        break;
+    case 2:
+        /* With a size of 3 this is a prefetch */
+        if (size == 3) {
+            return seL4_False;
+        }
+        a->write = seL4_False;
+        a->sign_extend = seL4_True;
+        a->reg64 = seL4_True;
+        break;
+    default:
+        if (size >= 2) {
+            return seL4_False;
+        }
+        a->write = seL4_False;
+        a->sign_extend = seL4_True;
+        a->reg64 = seL4_False;
+        break;
+    }
+
+    /* Loads that write back to the register they load are unpredictable */
+    if (a->writeback && !a->write && a->rn == a->rt && a->rt != REG_31) {
+        return seL4_False;
+    }
+
+    return seL4_True;
+}
+
+seL4_Bool microkit_vmm_handle_fault(microkit_child vcpu, microkit_msginfo msginfo, microkit_msginfo *reply_msginfo)
+{
+    if (microkit_msginfo_get_label(msginfo) != seL4_Fault_VMFault) {
+        microkit_vmm_unhandled_exits++;
+        return seL4_False;
+    }
+
+    /* Reading the registers overwrites the message, so keep the fault */
+    seL4_Word ip = seL4_GetMR(seL4_VMFault_IP);
+    seL4_Word addr = seL4_GetMR(seL4_VMFault_Addr);
+    seL4_Word prefetch = seL4_GetMR(seL4_VMFault_PrefetchFault);
+    seL4_Word esr = seL4_GetMR(seL4_VMFault_FSR);
+
+    microkit_vmm_device *dev = NULL;
+    struct access a;
+    seL4_Word offset;
+    if (prefetch || ESR_EC(esr) != ESR_EC_DATA_ABORT_LOWER) {
+        goto unhandled;
+    }
+    dev = find_device(addr);
+    if (dev == NULL) {
+        goto unhandled;
+    }
+
+    if (esr & ESR_ISV) {
+        decode_syndrome(esr, &a);
+    } else {
+        seL4_Uint32 insn;
+        if (microkit_vmm_fetch_insn == NULL || !microkit_vmm_fetch_insn(vcpu, ip, &insn) || !decode_insn(insn, &a)) {
+            goto unhandled;
+        }
+    }
+
+    offset = addr - dev->base;
+    if (a.size > dev->size - offset) {
+        goto unhandled;
+    }
+
+    /*
+     * All the registers needed are read and written back with one system call
+     * each, the PC and any registers before the ones accessed.
+     */
+    unsigned int rt_idx = a.rt == REG_31 ? 0 : REG_X0 + a.rt;
+    unsigned int rn_idx = a.rn == REG_31 ? REG_SP : REG_X0 + a.rn;
+    seL4_Word count = 1;
+    if (rt_idx != 0) {
+        count = rt_idx + 1;
+    }
+    if (a.writeback && rn_idx + 1 > count) {
+        count = rn_idx + 1;
+    }
+
+    seL4_UserContext ctxt;
+    seL4_Word *regs = (seL4_Word *)&ctxt;
+    seL4_Error err;
+    if (count > 1) {
+        err = seL4_TCB_ReadRegisters(BASE_VM_TCB_CAP + vcpu, seL4_False, 0, count, &ctxt);
+        if (err != seL4_NoError) {
+            microkit_dbg_puts("microkit_vmm_handle_fault: error reading registers\n");
+            microkit_internal_crash(err);
+        }
+    }
+
+    seL4_Word mask = a.size == 8 ? ~0UL : (1UL << (a.size * 8)) - 1;
+    seL4_Word value;
+    if (a.write) {
+        value = rt_idx != 0 ? regs[rt_idx] & mask : 0;
+        if (dev->write == NULL || !dev->write(dev->cookie, offset, a.size, value)) {
+            goto unhandled;
+        }
+    } else {
+        if (dev->read == NULL || !dev->read(dev->cookie, offset, a.size, &value)) {
+            goto unhandled;
+        }
+        value &= mask;
+        if (a.sign_extend && a.size < 8) {
+            seL4_Word sign = 1UL << (a.size * 8 - 1);
+            value = (value ^ sign) - sign;
+        }
+        if (!a.reg64) {
+            value &= 0xffffffff;
+        }
+        if (rt_idx != 0) {
+            regs[rt_idx] = value;
+        }
+    }
+
+    if (a.writeback) {
+        regs[rn_idx] += a.imm;
+    }
+    regs[REG_PC] = ip + a.insn_len;
+    err = seL4_TCB_WriteRegisters(BASE_VM_TCB_CAP + vcpu, seL4_False, 0, count, &ctxt);
+    if (err != seL4_NoError) {
+        microkit_dbg_puts("microkit_vmm_handle_fault: error writing registers\n");
+        microkit_internal_crash(err);
+    }
+
+    dev->exits++;
+    *reply_msginfo = microkit_msginfo_new(0, 0);
+    return seL4_True;
+
+unhandled:
+    microkit_vmm_unhandled_exits++;
+    seL4_SetMR(seL4_VMFault_IP, ip);
+    seL4_SetMR(seL4_VMFault_Addr, addr);
+    seL4_SetMR(seL4_VMFault_PrefetchFault, prefetch);
+    seL4_SetMR(seL4_VMFault_FSR, esr);
+    return seL4_False;
+}
+
+static void put64(seL4_Uint64 x)
+{
+    char tmp[21];
+    unsigned int i = 20;
+    tmp[20] = 0;
+    do {
+        tmp[--i] = '0' + x % 10;
+        x /= 10;
+    } while (x);
+    microkit_dbg_puts(&tmp[i]);
+}
+
+void microkit_vmm_print_stats(void)
+{
+    for (unsigned int i = 0; i < num_devices; i++) {
+        microkit_dbg_puts(microkit_name);
+        microkit_dbg_puts(": ");
+        microkit_dbg_puts(devices[i]->name);
+        microkit_dbg_puts(" exits: ");
+        put64(devices[i]->exits);
+        microkit_dbg_puts("\n");
+    }
+    microkit_dbg_puts(microkit_name);
+    microkit_dbg_puts(": unhandled exits: ");
+    put64(microkit_vmm_unhandled_exits);
+    microkit_dbg_puts("\n");
+}
+
+#endif
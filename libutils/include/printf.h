@@ -50,6 +50,16 @@ void *memset(void *s, unsigned long c, unsigned long n);
 void _putchar(char character);
 
 
+/**
+ * Output a block of characters to a custom device, used by the printf() function
+ * printf() collects its output and passes it on in blocks of up to PRINTF_OUT_BLOCK_SIZE characters.
+ * The default implementation calls _putchar() for each character, override it to write a block at once
+ * \param buffer The characters to output, not null terminated
+ * \param count The number of characters in buffer
+ */
+void _putchar_block(const char* buffer, size_t count);
+
+
 /**
  * Tiny printf implementation
  * You have to implement _putchar if you use printf()
@@ -110,6 +120,18 @@ int vprintf_(const char* format, va_list va);
 int fctprintf(void (*out)(char character, void* arg), void* arg, const char* format, ...);
 
 
+/**
+ * printf with block output function
+ * Like fctprintf(), but the output is collected and passed to the output function in blocks of up to
+ * PRINTF_OUT_BLOCK_SIZE characters, e.g. to copy it into shared memory without a call for every character
+ * \param out An output function which takes a block of characters, its length and an argument pointer
+ * \param arg An argument pointer for user data passed to output function
+ * \param format A string that specifies the format of the output
+ * \return The number of characters that are sent to the output function, not counting the terminating null character
+ */
+int fctprintf_block(void (*out)(const char* buffer, size_t count, void* arg), void* arg, const char* format, ...);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,6 +51,13 @@
 #define PRINTF_NTOA_BUFFER_SIZE    32U
 #endif
 
+// block output buffer size, printf() and vprintf() collect this many characters
+// (dynamically created on stack) before passing them on to _putchar_block()
+// default: 128 byte
+#ifndef PRINTF_OUT_BLOCK_SIZE
+#define PRINTF_OUT_BLOCK_SIZE      128U
+#endif
+
 // 'ftoa' conversion buffer size, this must be big enough to hold one converted
 // float number including padded zeros (dynamically created on stack)
 // default: 32 byte
@@ -154,6 +161,15 @@ typedef struct {
 } out_fct_wrap_type;
 
 
+// wrapper (used as buffer) for block output function type
+typedef struct {
+  void  (*fct)(const char* buffer, size_t count, void* arg);
+  void* arg;
+  size_t len;
+  char  buf[PRINTF_OUT_BLOCK_SIZE];
+} out_block_wrap_type;
+
+
 // internal buffer output
 static inline void _out_buffer(char character, void* buffer, size_t idx, size_t maxlen)
 {
@@ -170,27 +186,59 @@ static inline void _out_null(char character, void* buffer, size_t idx, size_t ma
 }
 
 
-// internal _putchar wrapper
-static inline void _out_char(char character, void* buffer, size_t idx, size_t maxlen)
+// internal output function wrapper
+static inline void _out_fct(char character, void* buffer, size_t idx, size_t maxlen)
 {
-  (void)buffer; (void)idx; (void)maxlen;
+  (void)idx; (void)maxlen;
   if (character) {
-    _putchar(character);
+    // buffer is the output fct pointer
+    ((out_fct_wrap_type*)buffer)->fct(character, ((out_fct_wrap_type*)buffer)->arg);
   }
 }
 
 
-// internal output function wrapper
-static inline void _out_fct(char character, void* buffer, size_t idx, size_t maxlen)
+// internal block output, collects characters and passes them on a block at a time
+static inline void _out_block(char character, void* buffer, size_t idx, size_t maxlen)
 {
   (void)idx; (void)maxlen;
+  out_block_wrap_type* block = (out_block_wrap_type*)buffer;
   if (character) {
-    // buffer is the output fct pointer
-    ((out_fct_wrap_type*)buffer)->fct(character, ((out_fct_wrap_type*)buffer)->arg);
+    block->buf[block->len++] = character;
+    if (block->len == PRINTF_OUT_BLOCK_SIZE) {
+      block->fct(block->buf, block->len, block->arg);
+      block->len = 0U;
+    }
+  }
+}
+
+
+// pass on the characters left in the block buffer
+static inline void _out_block_flush(out_block_wrap_type* block)
+{
+  if (block->len) {
+    block->fct(block->buf, block->len, block->arg);
+    block->len = 0U;
   }
 }
 
 
+// default block output to _putchar, may be overridden to write whole blocks at once
+__attribute__((weak)) void _putchar_block(const char* buffer, size_t count)
+{
+  for (size_t i = 0U; i < count; i++) {
+    _putchar(buffer[i]);
+  }
+}
+
+
+// internal _putchar_block wrapper
+static void _putchar_block_fct(const char* buffer, size_t count, void* arg)
+{
+  (void)arg;
+  _putchar_block(buffer, count);
+}
+
+
 // internal secure strlen
 // \return The length of the string (excluding the terminating 0) limited by 'maxsize'
 static inline unsigned int _strnlen_s(const char* str, size_t maxsize)
@@ -302,6 +350,62 @@ static size_t _ntoa_format(out_fct_type out, char* buffer, size_t idx, size_t ma
 }
 
 
+// two digit decimal strings, so that decimal conversion needs one division for every two digits
+static const char _digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+
+// internal conversion of value into digits, least significant digit first
+// \return The number of digits written to buf
+static size_t _ntoa_digits(char* buf, unsigned long long value, unsigned long long base, unsigned int flags)
+{
+  size_t len = 0U;
+
+  if (base == 10U) {
+    // at most 20 digits, which always fit in the buffer
+    while (value >= 100U) {
+      const size_t pair = (size_t)(value % 100U) * 2U;
+      value /= 100U;
+      buf[len++] = _digit_pairs[pair + 1U];
+      buf[len++] = _digit_pairs[pair];
+    }
+    if (value >= 10U) {
+      buf[len++] = _digit_pairs[value * 2U + 1U];
+      buf[len++] = _digit_pairs[value * 2U];
+    }
+    else {
+      buf[len++] = (char)('0' + value);
+    }
+  }
+  else if (base == 16U) {
+    // at most 16 digits, which always fit in the buffer
+    const char* digits = (flags & FLAGS_UPPERCASE) ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+      buf[len++] = digits[value & 0xFU];
+      value >>= 4U;
+    } while (value);
+  }
+  else {
+    do {
+      const char digit = (char)(value % base);
+      buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
+      value /= base;
+    } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+  }
+
+  return len;
+}
+
+
 // internal itoa for 'long' type
 static size_t _ntoa_long(out_fct_type out, char* buffer, size_t idx, size_t maxlen, unsigned long value, bool negative, unsigned long base, unsigned int prec, unsigned int width, unsigned int flags)
 {
@@ -315,11 +419,7 @@ static size_t _ntoa_long(out_fct_type out, char* buffer, size_t idx, size_t maxl
 
   // write if precision != 0 and value is != 0
   if (!(flags & FLAGS_PRECISION) || value) {
-    do {
-      const char digit = (char)(value % base);
-      buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
-      value /= base;
-    } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    len = _ntoa_digits(buf, value, base, flags);
   }
 
   return _ntoa_format(out, buffer, idx, maxlen, buf, len, negative, (unsigned int)base, prec, width, flags);
@@ -340,11 +440,7 @@ static size_t _ntoa_long_long(out_fct_type out, char* buffer, size_t idx, size_t
 
   // write if precision != 0 and value is != 0
   if (!(flags & FLAGS_PRECISION) || value) {
-    do {
-      const char digit = (char)(value % base);
-      buf[len++] = digit < 10 ? '0' + digit : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10;
-      value /= base;
-    } while (value && (len < PRINTF_NTOA_BUFFER_SIZE));
+    len = _ntoa_digits(buf, value, base, flags);
   }
 
   return _ntoa_format(out, buffer, idx, maxlen, buf, len, negative, (unsigned int)base, prec, width, flags);
@@ -608,7 +704,7 @@ static char *fmt_x(uintmax_t x, char *s, int lower)
     return s;
 }
 
-static int fmt_cap(out_fct_type out, const void *cap, unsigned fmt) {
+static size_t fmt_cap(out_fct_type out, char* buffer, size_t idx, size_t maxlen, const void *cap, unsigned fmt) {
     char buf[CAP_BUFFER_SIZE];
     char *z = buf + sizeof(buf);
     _Bool tag = __builtin_cheri_tag_get(cap);
@@ -845,9 +941,9 @@ value:
 
     size_t length = (size_t)buf + sizeof(buf) - (size_t)z;
     for(int i = 0; i < length; i++)
-        out(z[i], z, 0, length);
+        out(z[i], buffer, idx++, maxlen);
 
-    return length;
+    return idx;
 }
 #endif
 
@@ -1100,7 +1196,7 @@ static int _vsnprintf(out_fct_type out, char* buffer, const size_t maxlen, const
       case 'p' : {
 #if defined(CONFIG_HAVE_CHERI)
         if (flags & FLAGS_HASH) {
-            idx = fmt_cap(out, va_arg(va, void*), 1);
+            idx = fmt_cap(out, buffer, idx, maxlen, va_arg(va, void*), 1);
             format++;
             break;
         }
@@ -1148,8 +1244,7 @@ int printf_(const char* format, ...)
 {
   va_list va;
   va_start(va, format);
-  char buffer[1];
-  const int ret = _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+  const int ret = vprintf_(format, va);
   va_end(va);
   return ret;
 }
@@ -1177,8 +1272,10 @@ int snprintf_(char* buffer, size_t count, const char* format, ...)
 
 int vprintf_(const char* format, va_list va)
 {
-  char buffer[1];
-  return _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+  out_block_wrap_type block = { _putchar_block_fct, NULL, 0U };
+  const int ret = _vsnprintf(_out_block, (char*)(uintptr_t)&block, (size_t)-1, format, va);
+  _out_block_flush(&block);
+  return ret;
 }
 
 
@@ -1197,3 +1294,15 @@ int fctprintf(void (*out)(char character, void* arg), void* arg, const char* for
   va_end(va);
   return ret;
 }
+
+
+int fctprintf_block(void (*out)(const char* buffer, size_t count, void* arg), void* arg, const char* format, ...)
+{
+  va_list va;
+  va_start(va, format);
+  out_block_wrap_type block = { out, arg, 0U };
+  const int ret = _vsnprintf(_out_block, (char*)(uintptr_t)&block, (size_t)-1, format, va);
+  _out_block_flush(&block);
+  va_end(va);
+  return ret;
+}
@@ -27,6 +27,14 @@ _Static_assert(sizeof(uintptr_t) == 8 || sizeof(uintptr_t) == 4, "Expect uintptr
 
 #define STACK_SIZE 4096
 
+/* Output held back by the loader until the boot log region can be written */
+#define BOOT_LOG_BUFFER_SIZE 0x4000
+
+/* The number of CPUs that may be used to copy the regions, see copy_data() */
+#ifndef NUM_CPUS
+#define NUM_CPUS 1
+#endif
+
 #define UART_REG(x) ((volatile uint32_t *)(UART_BASE + (x)))
 
 #if defined(BOARD_zcu102) || defined(BOARD_ultra96v2)
@@ -39,6 +47,7 @@ _Static_assert(sizeof(uintptr_t) == 8 || sizeof(uintptr_t) == 4, "Expect uintptr
 
 #define REGION_TYPE_DATA 1
 #define REGION_TYPE_ZERO 2
+#define REGION_TYPE_LZ4 3
 
 #define FLAG_SEL4_HYP (1UL << 0)
 #define FLAG_SEL4_CHERI (1UL << 1)
@@ -70,11 +79,24 @@ struct loader_data {
     uintptr_t v_entry_size;
     uintptr_t extra_device_addr_p;
     uintptr_t extra_device_size;
+    uintptr_t boot_log_addr_p;
+    uintptr_t boot_log_size;
 
     uintptr_t num_regions;
     struct region regions[];
 };
 
+/*
+ * The boot log, when the tool is given '--boot-log'. The same layout is used by
+ * the monitor, which appends to it, and by PDs that map it.
+ */
+struct boot_log {
+    uintptr_t length;
+    /* Bytes that did not fit */
+    uintptr_t dropped;
+    char text[];
+};
+
 typedef void (*sel4_entry)(
     uintptr_t ui_p_reg_start,
     uintptr_t ui_p_reg_end,
@@ -128,6 +150,95 @@ void *memmove(void *restrict dest, const void *restrict src, size_t n)
     return dest;
 }
 
+/*
+ * Decompress an LZ4 block (as produced by the Microkit tool) into dst.
+ *
+ * The block format does not record its own length, so decoding stops once
+ * 'size' bytes have been produced. The tool guarantees that the final
+ * sequence is literals-only, which is how the reference format ends a block.
+ * Matches may overlap the bytes they produce, so they are copied forwards one
+ * byte at a time.
+ */
+/*
+ * Copy a match of 'len' bytes from 'offset' bytes back. Regions are copied
+ * before the MMU is enabled, when unaligned accesses fault on AArch64, so
+ * matches at least a word back are copied with aligned words: the source words
+ * are shifted into place. Shorter offsets overlap the bytes being written and
+ * are copied a byte at a time.
+ */
+static unsigned char *lz4_copy_match(unsigned char *d, size_t offset, size_t len)
+{
+    const unsigned char *m = d - offset;
+    if (offset >= sizeof(uint64_t)) {
+        while (((uintptr_t)d & (sizeof(uint64_t) - 1)) != 0 && len > 0) {
+            *d++ = *m++;
+            len--;
+        }
+        uint64_t *dw = (uint64_t *)d;
+        size_t shift = ((uintptr_t)m & (sizeof(uint64_t) - 1)) * 8;
+        if (shift == 0) {
+            const uint64_t *mw = (const uint64_t *)m;
+            for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+                *dw++ = *mw++;
+            }
+        } else {
+            /* Little-endian, and every word read ends before the byte being written */
+            const uint64_t *mw = (const uint64_t *)(m - shift / 8);
+            uint64_t lo = *mw++;
+            for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+                uint64_t hi = *mw++;
+                *dw++ = (lo >> shift) | (hi << (64 - shift));
+                lo = hi;
+            }
+        }
+        m += (unsigned char *)dw - d;
+        d = (unsigned char *)dw;
+    }
+    while (len-- > 0) {
+        *d++ = *m++;
+    }
+    return d;
+}
+
+static void lz4_decompress(void *dst, const void *src, size_t size)
+{
+    unsigned char *d = dst;
+    unsigned char *d_end = d + size;
+    const unsigned char *s = src;
+
+    while (d < d_end) {
+        unsigned char token = *s++;
+        size_t len = token >> 4;
+        if (len == 15) {
+            unsigned char b;
+            do {
+                b = *s++;
+                len += b;
+            } while (b == 255);
+        }
+        memcpy(d, s, len);
+        d += len;
+        s += len;
+        if (d >= d_end) {
+            break;
+        }
+
+        size_t offset = s[0] | ((size_t)s[1] << 8);
+        s += 2;
+        len = token & 0xf;
+        if (len == 15) {
+            unsigned char b;
+            do {
+                b = *s++;
+                len += b;
+            } while (b == 255);
+        }
+        len += 4;
+
+        d = lz4_copy_match(d, offset, len);
+    }
+}
+
 void switch_to_el1(void);
 void switch_to_el2(void);
 void el1_mmu_enable(void);
@@ -344,9 +455,29 @@ static void putc(uint8_t ch)
 #error Board not defined
 #endif
 
+/*
+ * With a boot log, output is kept in boot_log_buffer rather than printed and
+ * boot_log_commit() moves it to the boot log region once the regions have been
+ * copied. The monitor prints the whole log once the system is running, unless
+ * something fails first, in which case it is printed straight away.
+ */
+static char boot_log_buffer[BOOT_LOG_BUFFER_SIZE];
+static uintptr_t boot_log_length;
+static int boot_log_deferred;
+
 static void puts(const char *s)
 {
 #if PRINTING
+    if (boot_log_deferred) {
+        while (*s) {
+            if (boot_log_length < BOOT_LOG_BUFFER_SIZE) {
+                boot_log_buffer[boot_log_length] = *s;
+            }
+            boot_log_length++;
+            s++;
+        }
+        return;
+    }
     while (*s) {
         if (*s == '\n') {
             putc('\r');
@@ -357,6 +488,26 @@ static void puts(const char *s)
 #endif
 }
 
+static void boot_log_flush(void)
+{
+    if (!boot_log_deferred) {
+        return;
+    }
+    boot_log_deferred = 0;
+#if PRINTING
+    uintptr_t length = boot_log_length < BOOT_LOG_BUFFER_SIZE ? boot_log_length : BOOT_LOG_BUFFER_SIZE;
+    for (uintptr_t i = 0; i < length; i++) {
+        if (boot_log_buffer[i] == '\n') {
+            putc('\r');
+        }
+        putc(boot_log_buffer[i]);
+    }
+    if (boot_log_length > length) {
+        puts("LDR|INFO: boot log truncated\n");
+    }
+#endif
+}
+
 static char hexchar(unsigned int v)
 {
     return v < 10 ? '0' + v : ('a' - 10) + v;
@@ -595,17 +746,234 @@ static void print_loader_data(void)
     }
 }
 
-static void copy_data(void)
+/*
+ * Start the boot log region with what has been held back so far. This is done
+ * while the MMU is still off, later output (enabling the MMU and jumping to the
+ * kernel) is printed directly.
+ */
+static void boot_log_commit(void)
+{
+    if (!boot_log_deferred) {
+        return;
+    }
+    struct boot_log *log = (struct boot_log *)loader_data->boot_log_addr_p;
+    uintptr_t capacity = loader_data->boot_log_size - sizeof(struct boot_log);
+    uintptr_t length = boot_log_length < BOOT_LOG_BUFFER_SIZE ? boot_log_length : BOOT_LOG_BUFFER_SIZE;
+    if (length > capacity) {
+        length = capacity;
+    }
+    memcpy(log->text, boot_log_buffer, length);
+    log->length = length;
+    log->dropped = boot_log_length - length;
+    boot_log_deferred = 0;
+}
+
+/*
+ * Copy the share of each region that belongs to 'cpu' out of 'num_cpus'.
+ * Plain data and zero regions are split into one contiguous chunk per CPU,
+ * while an LZ4 block can only be decoded from its start, so compressed
+ * regions are instead handed out whole, round-robin. Only CPU 0 prints.
+ */
+static void copy_regions(uintptr_t cpu, uintptr_t num_cpus)
 {
     const void *base = &loader_data->regions[loader_data->num_regions];
     for (uint32_t i = 0; i < loader_data->num_regions; i++) {
         const struct region *r = &loader_data->regions[i];
-        puts("LDR|INFO: copying region ");
-        puthex32(i);
-        puts("\n");
-        memcpy((void *)(uintptr_t)r->load_addr, base + r->offset, r->size);
+        /* The tool may have laid out the image so the data is already in place */
+        if ((uintptr_t)(base + r->offset) == r->load_addr) {
+            if (cpu == 0) {
+                puts("LDR|INFO: region ");
+                puthex32(i);
+                puts(" already in place\n");
+            }
+            continue;
+        }
+        if (cpu == 0) {
+            puts("LDR|INFO: copying region ");
+            puthex32(i);
+            puts("\n");
+        }
+
+        void *dst = (void *)(uintptr_t)r->load_addr;
+        const void *src = base + r->offset;
+        if (r->type == REGION_TYPE_LZ4) {
+            if (i % num_cpus == cpu) {
+                lz4_decompress(dst, src, r->size);
+            }
+            continue;
+        }
+
+        uintptr_t chunk = r->size / num_cpus;
+        uintptr_t start = chunk * cpu;
+        uintptr_t size = (cpu == num_cpus - 1) ? r->size - start : chunk;
+        memcpy(dst + start, src + start, size);
+    }
+}
+
+#if NUM_CPUS > 1
+/*
+ * The region copy can be spread across NUM_CPUS CPUs. The other CPUs are
+ * started with PSCI (AArch64) or the SBI HSM extension (RISC-V), copy their
+ * share of the regions and then stop themselves again, so that they are in
+ * the same state the kernel would have found them in otherwise. CPUs that fail
+ * to start are simply not used.
+ *
+ * Note that the MMU is off while copying, so all accesses are non-cacheable
+ * and the flags below only need barriers for ordering.
+ */
+char _secondary_stacks[NUM_CPUS - 1][STACK_SIZE] ALIGN(16);
+void secondary_entry(void);
+
+static volatile uintptr_t copy_num_cpus;
+static volatile uintptr_t copy_go;
+static volatile uintptr_t copy_done[NUM_CPUS];
+static uintptr_t copy_cpu_ids[NUM_CPUS];
+
+#ifdef ARCH_aarch64
+#define PSCI_CPU_OFF 0x84000002
+#define PSCI_CPU_ON 0xc4000003
+#define PSCI_AFFINITY_INFO 0xc4000004
+#define PSCI_AFFINITY_INFO_OFF 1
+
+#define barrier() asm volatile("dmb sy" ::: "memory")
+
+/* This assumes the SMC conduit, which is what the PSCI firmware uses on the supported boards */
+static uintptr_t psci_call(uintptr_t function_id, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2)
+{
+    register uintptr_t x0 asm("x0") = function_id;
+    register uintptr_t x1 asm("x1") = arg0;
+    register uintptr_t x2 asm("x2") = arg1;
+    register uintptr_t x3 asm("x3") = arg2;
+    asm volatile("smc #0"
+                 : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                 :
+                 : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15", "x16",
+                 "x17", "memory");
+    return x0;
+}
+
+/* CPUs are identified by the affinity level 0 field of their MPIDR */
+static uintptr_t cpu_id(void)
+{
+    uintptr_t mpidr;
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & 0xff;
+}
+
+static int cpu_start(uintptr_t id, uintptr_t index)
+{
+    return psci_call(PSCI_CPU_ON, id, (uintptr_t)secondary_entry, index) == 0;
+}
+
+static void cpu_stop(void)
+{
+    psci_call(PSCI_CPU_OFF, 0, 0, 0);
+}
+
+static int cpu_stopped(uintptr_t id)
+{
+    return psci_call(PSCI_AFFINITY_INFO, id, 0, 0) == PSCI_AFFINITY_INFO_OFF;
+}
+#elif defined(ARCH_riscv64)
+#define SBI_HSM_EID 0x48534d
+#define SBI_HSM_HART_START 0
+#define SBI_HSM_HART_STOP 1
+#define SBI_HSM_HART_GET_STATUS 2
+#define SBI_HSM_STATUS_STOPPED 1
+
+#define barrier() asm volatile("fence rw, rw" ::: "memory")
+
+struct sbi_ret {
+    uintptr_t error;
+    uintptr_t value;
+};
+
+static struct sbi_ret sbi_call(uintptr_t eid, uintptr_t fid, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2)
+{
+    register uintptr_t a0 asm("a0") = arg0;
+    register uintptr_t a1 asm("a1") = arg1;
+    register uintptr_t a2 asm("a2") = arg2;
+    register uintptr_t a6 asm("a6") = fid;
+    register uintptr_t a7 asm("a7") = eid;
+    asm volatile("ecall" : "+r"(a0), "+r"(a1) : "r"(a2), "r"(a6), "r"(a7) : "memory");
+    return (struct sbi_ret) { .error = a0, .value = a1 };
+}
+
+/* Harts are numbered upwards from FIRST_HART_ID, which the loader runs on */
+static uintptr_t cpu_id(void)
+{
+    return FIRST_HART_ID;
+}
+
+static int cpu_start(uintptr_t id, uintptr_t index)
+{
+    return sbi_call(SBI_HSM_EID, SBI_HSM_HART_START, id, (uintptr_t)secondary_entry, index).error == 0;
+}
+
+static void cpu_stop(void)
+{
+    sbi_call(SBI_HSM_EID, SBI_HSM_HART_STOP, 0, 0, 0);
+}
+
+static int cpu_stopped(uintptr_t id)
+{
+    struct sbi_ret ret = sbi_call(SBI_HSM_EID, SBI_HSM_HART_GET_STATUS, id, 0, 0);
+    return ret.error == 0 && ret.value == SBI_HSM_STATUS_STOPPED;
+}
+#endif
+
+void secondary_main(uintptr_t index)
+{
+    while (!copy_go) {
+    }
+    barrier();
+
+    copy_regions(index, copy_num_cpus);
+
+    barrier();
+    copy_done[index] = 1;
+    cpu_stop();
+
+    for (;;) {
+    }
+}
+
+static void copy_data(void)
+{
+    uintptr_t self = cpu_id();
+    uintptr_t num_cpus = 1;
+    for (uintptr_t id = self + 1; id < self + NUM_CPUS; id++) {
+        if (cpu_start(id, num_cpus)) {
+            copy_cpu_ids[num_cpus] = id;
+            num_cpus++;
+        }
     }
+
+    puts("LDR|INFO: copying regions with ");
+    puthex32(num_cpus);
+    puts(" CPUs\n");
+
+    copy_num_cpus = num_cpus;
+    barrier();
+    copy_go = 1;
+
+    copy_regions(0, num_cpus);
+
+    /* Wait for the other CPUs to finish and be stopped before going any further */
+    for (uintptr_t i = 1; i < num_cpus; i++) {
+        while (!copy_done[i]) {
+        }
+        while (!cpu_stopped(copy_cpu_ids[i])) {
+        }
+    }
+    barrier();
+}
+#else
+static void copy_data(void)
+{
+    copy_regions(0, 1);
 }
+#endif
 
 #ifdef ARCH_aarch64
 static int ensure_correct_el(void)
@@ -836,6 +1204,8 @@ int main(void)
         goto fail;
     }
 
+    boot_log_deferred = loader_data->boot_log_size != 0;
+
     print_loader_data();
 
     /* past here we have trashed u-boot so any errors should go to the
@@ -855,6 +1225,7 @@ int main(void)
         goto fail;
     }
 
+    boot_log_commit();
     puts("LDR|INFO: enabling MMU\n");
     el = current_el();
     if (el == EL1) {
@@ -865,6 +1236,7 @@ int main(void)
         puts("LDR|ERROR: unknown EL level for MMU enable\n");
     }
 #elif defined(ARCH_riscv64)
+    boot_log_commit();
     puts("LDR|INFO: enabling MMU\n");
     enable_mmu();
 #endif
@@ -875,6 +1247,7 @@ int main(void)
     puts("LDR|ERROR: seL4 Loader: Error - KERNEL RETURNED\n");
 
 fail:
+    boot_log_flush();
     /* Note: can't usefully return to U-Boot once we are here. */
     /* IMPROVEMENT: use SMC SVC call to try and power-off / reboot system.
      * or at least go to a WFI loop
@@ -887,6 +1260,7 @@ fail:
 void exception_handler(uintptr_t ex, uintptr_t esr, uintptr_t far)
 {
     uintptr_t ec = (esr >> 26) & 0x3f;
+    boot_log_flush();
     puts("LDR|ERROR: loader trapped kernel exception: ");
     puts(ex_to_string(ex));
     puts("   ec=");
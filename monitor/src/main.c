@@ -60,6 +60,7 @@
 #define __thread
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sel4/sel4.h>
 
@@ -72,6 +73,16 @@
 
 #define MAX_UNTYPED_REGIONS 256
 
+/* Must match MAX_TEMPLATE_INSTANCES in the tool */
+#define MAX_TEMPLATE_INSTANCES 64
+/* The badges of the fault endpoints of template instances follow those of PDs */
+#define TEMPLATE_INSTANCE_BADGE MAX_PDS
+/* Labels of requests from PDs to create and destroy instances, must match libmicrokit */
+#define TEMPLATE_SPAWN_LABEL 0x100
+#define TEMPLATE_DESTROY_LABEL 0x101
+/* A step of a recipe that copies data instead of making an invocation */
+#define RECIPE_COPY 0
+
 /* Max words available for bootstrap invocations.
  *
  * Only a small number of syscalls is required to
@@ -121,6 +132,43 @@ seL4_Word *system_invocation_data = (void *)0x80000000;
 
 struct untyped_info untyped_info;
 
+/*
+ * The recipes to create and destroy each instance of a template are in the
+ * system invocation data, after the system invocations, at the given word
+ * offsets.
+ */
+struct template_instance {
+    seL4_Word parent;
+    seL4_Word template;
+    seL4_Word channel;
+    seL4_Word tcb;
+    seL4_Word spawn_offset;
+    seL4_Word spawn_count;
+    seL4_Word destroy_offset;
+    seL4_Word destroy_count;
+    char name[MAX_NAME_LEN];
+};
+
+struct template_instance template_instances[MAX_TEMPLATE_INSTANCES];
+seL4_Word template_instances_len;
+static bool template_instance_active[MAX_TEMPLATE_INSTANCES];
+
+/*
+ * With '--boot-log' the tool maps the boot log after the system invocation
+ * data, otherwise these are zero.
+ */
+seL4_Word boot_log_vaddr;
+seL4_Word boot_log_size;
+
+/*
+ * With '--kernel-log' the cap of the large page that the kernel logs its
+ * benchmark events to, otherwise zero. It is given to the kernel before the
+ * system invocation with index 'kernel_log_invocation', the first one that
+ * resumes a PD.
+ */
+seL4_Word kernel_log_buffer;
+seL4_Word kernel_log_invocation;
+
 void dump_untyped_info()
 {
     puts("\nUntyped Info Expected Memory Ranges\n");
@@ -652,6 +700,75 @@ static unsigned perform_invocation(seL4_Word *invocation_data, unsigned offset,
     return next_offset;
 }
 
+static unsigned perform_recipe_step(unsigned offset, unsigned idx)
+{
+    seL4_MessageInfo_t tag;
+    tag.words[0] = system_invocation_data[offset] & 0xffffffffULL;
+    if (seL4_MessageInfo_get_label(tag) != RECIPE_COPY) {
+        return perform_invocation(system_invocation_data, offset, idx);
+    }
+
+    const char *src = (const char *)system_invocation_data + system_invocation_data[offset + 2];
+    char *dest = (char *)system_invocation_data[offset + 3];
+    seL4_Word size = system_invocation_data[offset + 4];
+    for (seL4_Word i = 0; i < size; i++) {
+        dest[i] = src[i];
+    }
+#if defined(ARCH_riscv64)
+    /* The copied page may hold code; on AArch64 the recipe cleans it to the PoU instead */
+    asm volatile("fence.i" ::: "memory");
+#endif
+
+    return offset + 5;
+}
+
+static void perform_recipe(seL4_Word offset, seL4_Word count)
+{
+    for (unsigned idx = 0; idx < count; idx++) {
+        offset = perform_recipe_step(offset, idx);
+    }
+}
+
+/* Create an instance of 'template' for the PD with 'badge' and reply with its channel */
+static void template_spawn(seL4_Word badge, seL4_Word template)
+{
+    for (unsigned i = 0; i < template_instances_len; i++) {
+        struct template_instance *instance = &template_instances[i];
+        if (instance->parent != badge || instance->template != template || template_instance_active[i]) {
+            continue;
+        }
+
+        perform_recipe(instance->spawn_offset, instance->spawn_count);
+        template_instance_active[i] = true;
+#if CONFIG_DEBUG_BUILD
+        seL4_DebugNameThread(instance->tcb, instance->name);
+#endif
+        seL4_SetMR(0, instance->channel);
+        seL4_Send(reply, seL4_MessageInfo_new(0, 0, 0, 1));
+        return;
+    }
+
+    /* No such template, or all its instances are in use */
+    seL4_Send(reply, seL4_MessageInfo_new(1, 0, 0, 0));
+}
+
+static void template_destroy(seL4_Word badge, seL4_Word channel)
+{
+    for (unsigned i = 0; i < template_instances_len; i++) {
+        struct template_instance *instance = &template_instances[i];
+        if (instance->parent != badge || instance->channel != channel || !template_instance_active[i]) {
+            continue;
+        }
+
+        perform_recipe(instance->destroy_offset, instance->destroy_count);
+        template_instance_active[i] = false;
+        seL4_Send(reply, seL4_MessageInfo_new(0, 0, 0, 0));
+        return;
+    }
+
+    seL4_Send(reply, seL4_MessageInfo_new(1, 0, 0, 0));
+}
+
 static void print_tcb_registers(seL4_UserContext *regs, seL4_Word tcb_cap)
 {
 #if defined(ARCH_riscv64)
@@ -1067,7 +1184,27 @@ static void monitor(void)
         tag = seL4_Recv(fault_ep, &badge, reply);
         label = seL4_MessageInfo_get_label(tag);
 
-        seL4_Word tcb_cap = pd_tcbs[badge];
+        if (badge < MAX_PDS && label == TEMPLATE_SPAWN_LABEL) {
+            template_spawn(badge, seL4_GetMR(0));
+            continue;
+        }
+        if (badge < MAX_PDS && label == TEMPLATE_DESTROY_LABEL) {
+            template_destroy(badge, seL4_GetMR(0));
+            continue;
+        }
+
+        /* Faults from instances of templates are reported like those of PDs */
+        seL4_Word tcb_cap = 0;
+        char *name = NULL;
+        seL4_Word stack_addr = 0;
+        if (badge < MAX_PDS) {
+            tcb_cap = pd_tcbs[badge];
+            name = pd_names[badge][0] != 0 ? pd_names[badge] : NULL;
+            stack_addr = pd_stack_addrs[badge];
+        } else if (badge - TEMPLATE_INSTANCE_BADGE < template_instances_len) {
+            tcb_cap = template_instances[badge - TEMPLATE_INSTANCE_BADGE].tcb;
+            name = template_instances[badge - TEMPLATE_INSTANCE_BADGE].name;
+        }
 
         if (label == seL4_Fault_NullFault && badge < MAX_PDS) {
             /* This is a request from our PD to become passive */
@@ -1091,9 +1228,9 @@ static void monitor(void)
         puthex64(tcb_cap);
         puts("\n");
 
-        if (badge < MAX_PDS && pd_names[badge][0] != 0) {
+        if (name != NULL) {
             puts("MON|ERROR: faulting PD: ");
-            puts(pd_names[badge]);
+            puts(name);
             puts("\n");
         } else {
             fail("MON|ERROR: unknown/invalid badge\n");
@@ -1181,7 +1318,6 @@ static void monitor(void)
 #endif
 
             seL4_Word fault_addr = seL4_GetMR(seL4_VMFault_Addr);
-            seL4_Word stack_addr = pd_stack_addrs[badge];
             if (fault_addr < stack_addr && fault_addr >= stack_addr - 0x1000) {
                 puts("MON|ERROR: potential stack overflow, fault address within one page outside of stack region\n");
             }
@@ -1221,6 +1357,9 @@ static void monitor(void)
 void main(seL4_BootInfo *bi)
 {
     __sel4_ipc_buffer = bi->ipcBuffer;
+    if (boot_log_size != 0) {
+        boot_log_defer();
+    }
     puts("MON|INFO: Microkit Bootstrap\n");
 
     if (!check_untypeds_match(bi)) {
@@ -1244,10 +1383,27 @@ void main(seL4_BootInfo *bi)
     for (unsigned idx = 0; idx < bootstrap_invocation_count; idx++) {
         offset = perform_invocation(bootstrap_invocation_data, offset, idx);
     }
+    if (boot_log_size != 0) {
+        boot_log_map((void *)boot_log_vaddr, boot_log_size);
+    }
     puts("MON|INFO: completed bootstrap invocations\n");
 
     offset = 0;
     for (unsigned idx = 0; idx < system_invocation_count; idx++) {
+#if CONFIG_KERNEL_LOG_BUFFER
+        /*
+         * Like naming the threads below, this is a system call rather than an
+         * invocation. It is made before the first PD, early or not, is
+         * resumed, so the log covers all of the PDs' kernel entries.
+         */
+        if (kernel_log_buffer != 0 && idx == kernel_log_invocation) {
+            seL4_Error err = seL4_BenchmarkSetLogBuffer(kernel_log_buffer);
+            if (err != seL4_NoError) {
+                fail("MON|ERROR: could not set the kernel log buffer");
+            }
+            puts("MON|INFO: set the kernel log buffer\n");
+        }
+#endif
         offset = perform_invocation(system_invocation_data, offset, idx);
     }
 
@@ -1271,5 +1427,14 @@ void main(seL4_BootInfo *bi)
 
     puts("MON|INFO: completed system invocations\n");
 
+    if (boot_log_size != 0) {
+        /*
+         * The boot log stays in its memory region for a PD to read, printing
+         * it here would take the time that deferring it saved. From now on
+         * the monitor prints straight to the console.
+         */
+        boot_log_end();
+    }
+
     monitor();
 }
@@ -4,10 +4,23 @@
  *
  * SPDX-License-Identifier: BSD-2-Clause
  */
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "util.h"
 
+/* Output held back until the boot log is mapped, enough for the first few lines */
+#define BOOT_LOG_EARLY_SIZE 1024
+
+/* The boot log written by the loader, see loader.c */
+struct boot_log {
+    seL4_Word length;
+    /* Bytes that did not fit */
+    seL4_Word dropped;
+    char text[];
+};
+
 #if defined(CONFIG_HAVE_CHERI)
 #define CAP_BUFFER_SIZE 85
 
@@ -33,13 +46,102 @@
 #endif
 #endif
 
-void putc(uint8_t ch)
+static bool boot_log_deferred;
+static struct boot_log *boot_log;
+static seL4_Word boot_log_capacity;
+static char boot_log_early[BOOT_LOG_EARLY_SIZE];
+static seL4_Word boot_log_early_length;
+
+static void boot_log_append(uint8_t ch)
+{
+    if (boot_log == NULL) {
+        if (boot_log_early_length < BOOT_LOG_EARLY_SIZE) {
+            boot_log_early[boot_log_early_length] = ch;
+        }
+        boot_log_early_length++;
+    } else if (boot_log->length < boot_log_capacity) {
+        boot_log->text[boot_log->length++] = ch;
+    } else {
+        boot_log->dropped++;
+    }
+}
+
+static void console_putc(uint8_t ch)
 {
 #if defined(CONFIG_PRINTING)
     seL4_DebugPutChar(ch);
 #endif
 }
 
+void putc(uint8_t ch)
+{
+    if (boot_log_deferred) {
+        boot_log_append(ch);
+        return;
+    }
+    console_putc(ch);
+}
+
+void boot_log_defer(void)
+{
+    boot_log_deferred = true;
+}
+
+void boot_log_map(void *vaddr, seL4_Word size)
+{
+    boot_log = vaddr;
+    boot_log_capacity = size - sizeof(struct boot_log);
+
+    seL4_Word length = boot_log_early_length;
+    if (length > BOOT_LOG_EARLY_SIZE) {
+        boot_log->dropped += length - BOOT_LOG_EARLY_SIZE;
+        length = BOOT_LOG_EARLY_SIZE;
+    }
+    for (seL4_Word i = 0; i < length; i++) {
+        boot_log_append(boot_log_early[i]);
+    }
+}
+
+/* Stop deferring output, leaving the boot log in its memory region */
+void boot_log_end(void)
+{
+    if (!boot_log_deferred) {
+        return;
+    }
+
+    boot_log_deferred = false;
+    if (boot_log != NULL) {
+        puts("MON|INFO: boot log of ");
+        puthex64(boot_log->length);
+        puts(" bytes kept in memory");
+        if (boot_log->dropped != 0) {
+            puts(", ");
+            puthex64(boot_log->dropped);
+            puts(" bytes dropped");
+        }
+        puts("\n");
+    }
+}
+
+/* Print the boot log so far, when the monitor fails before it can be read */
+void boot_log_flush(void)
+{
+    if (!boot_log_deferred) {
+        return;
+    }
+
+    const char *text = boot_log_early;
+    seL4_Word length = boot_log_early_length < BOOT_LOG_EARLY_SIZE ? boot_log_early_length : BOOT_LOG_EARLY_SIZE;
+    if (boot_log != NULL) {
+        text = boot_log->text;
+        length = boot_log->length;
+    }
+    for (seL4_Word i = 0; i < length; i++) {
+        console_putc(text[i]);
+    }
+    boot_log_end();
+}
+
 void puts(const char *s)
 {
     while (*s) {
@@ -326,6 +428,7 @@ value:
 
 void fail(char *s)
 {
+    boot_log_flush();
     puts("FAIL: ");
     puts(s);
     puts("\n");
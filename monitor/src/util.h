@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sel4/sel4.h>
 
@@ -15,5 +16,9 @@ void puthex64(uint64_t val);
 #if defined(CONFIG_HAVE_CHERI)
 void putchericap(struct seL4_TCB_CheriReadRegister cap);
 #endif
+void boot_log_defer(void);
+void boot_log_map(void *vaddr, seL4_Word size);
+void boot_log_end(void);
+void boot_log_flush(void);
 void fail(char *s);
 char* sel4_strerror(seL4_Word err);
\ No newline at end of file
@@ -5,9 +5,12 @@
 //
 use crate::elf::{ElfFile, ElfFlagsRiscv, ElfFlagsAArch64};
 use crate::sel4::{Arch, Config, Invocation, InvocationArgs};
-use crate::sdf::SysMapPerms;
+use crate::sdf::{Broadcast, Channel, SysMapPerms};
 use crate::util::round_down;
 
+const SYMBOL_CHANNEL_BUFFER_CAPS: &str = "microkit_channel_buffer_caps";
+const SYMBOL_BROADCAST_BUFFER_CAPS: &str = "microkit_broadcast_buffer_caps";
+
 // This must match the CHERI-seL4's block CheriCapMeta
 #[derive(Debug, Clone, Copy)]
 pub struct CheriRiscv64CapMeta {
@@ -308,6 +311,44 @@ fn cheri_riscv_write_sym_cap(
     }
 }
 
+/// Find the page cap that backs 'vaddr' in the given PD.
+fn find_page_cptr(
+    pd_page_descriptors: &[(u64, usize, u64, u64, u64, u64, u64)],
+    pd_idx: usize,
+    vaddr: u64,
+) -> u64 {
+    let page = round_down(vaddr, 4096);
+
+    // Try to find a page cap that exactly matches the virtual address
+    let mut page_cptr = pd_page_descriptors
+        .iter()
+        .find(|(_, pdidx, vaddr, _, _, _, _)| *vaddr == page && *pdidx == pd_idx)
+        .map(|(cap_cptr, _, _, _, _, _, _)| *cap_cptr)
+        .unwrap_or(0);
+
+    // Couldn't find a page cap for this address. Try to find a multipage region (MR) that contains it
+    if page_cptr == 0 {
+        let (first_page, vaddr, _, page_size_bytes) = pd_page_descriptors
+            .iter()
+            .find(|(_, pdidx, vaddr, _, _, count, page_size_bytes)| {
+                *count > 1 &&
+                (page >= *vaddr && page < *vaddr + *count * *page_size_bytes) &&
+                *pdidx == pd_idx
+            })
+            .map(|(cap_cptr, _, vaddr, _, _, count, page_size_bytes)| {
+                (*cap_cptr, *vaddr, *count, *page_size_bytes)
+            })
+            .unwrap_or((0, 0, 0, 0));
+
+        if first_page != 0 {
+            let page_idx = (page - vaddr) / page_size_bytes;
+            page_cptr = first_page + page_idx;
+        }
+    }
+
+    page_cptr
+}
+
 pub fn cheri_arch_write_sym_cap(
     config: &Config,
     system_invocations: &mut Vec<Invocation>,
@@ -325,34 +366,7 @@ pub fn cheri_arch_write_sym_cap(
         let (sym_vaddr, _) = pd_elf_file
             .find_symbol(sym)
             .unwrap_or_else(|_| panic!("Could not find {}", sym));
-        let symbol_page = round_down(sym_vaddr, 4096);
-
-        // Try to find a page cap that exactly matches the symbol's virtual address
-        let mut page_cptr = pd_page_descriptors
-            .iter()
-            .find(|(_, pdidx, vaddr, _, _, _, _)| *vaddr == symbol_page && *pdidx == pd_idx)
-            .map(|(cap_cptr, _, _, _, _, _, _)| *cap_cptr)
-            .unwrap_or(0);
-
-        // Couldn't find a page cap for this symbol. Try to find a multipage region (MR) that contains it
-        if page_cptr == 0 {
-            let (first_page, vaddr, _, page_size_bytes) = pd_page_descriptors
-                .iter()
-                .find(|(_, pdidx, vaddr, _, _, count, page_size_bytes)| {
-                    *count > 1 &&
-                    (symbol_page >= *vaddr && symbol_page < *vaddr + *count * *page_size_bytes) &&
-                    *pdidx == pd_idx
-                })
-                .map(|(cap_cptr, _, vaddr, _, _, count, page_size_bytes)| {
-                    (*cap_cptr, *vaddr, *count, *page_size_bytes)
-                })
-                .unwrap_or((0, 0, 0, 0));
-
-            if first_page != 0 {
-                let page_idx = (symbol_page - vaddr) / page_size_bytes;
-                page_cptr = first_page + page_idx;
-            }
-        }
+        let page_cptr = find_page_cptr(pd_page_descriptors, pd_idx, sym_vaddr);
 
         match config.arch {
             Arch::Riscv64 => cheri_riscv_write_sym_cap(
@@ -374,3 +388,84 @@ pub fn cheri_arch_write_sym_cap(
         }
     }
 }
+
+/// A protection domain that capabilities are written into.
+pub struct CheriPd<'a> {
+    pub elf: &'a ElfFile,
+    pub idx: usize,
+    pub tcb_cptr: u64,
+    pub vspace_cptr: u64,
+    /// The page caps of all PDs, to find the page that holds a capability
+    pub page_descriptors: &'a [(u64, usize, u64, u64, u64, u64, u64)],
+}
+
+/// Write a capability for each of the PD's channel buffers into
+/// 'microkit_channel_buffer_caps', indexed by channel ID, and for the message
+/// of each broadcast it produces into 'microkit_broadcast_buffer_caps', indexed
+/// by broadcast ID. Consumers of a broadcast find its message as the buffer of
+/// the channel they are notified on.
+pub fn cheri_arch_write_channel_buffer_caps(
+    config: &Config,
+    system_invocations: &mut Vec<Invocation>,
+    pd: &CheriPd,
+    channels: &[Channel],
+    broadcasts: &[Broadcast],
+) {
+    let pd_elf_file = pd.elf;
+    let pd_idx = pd.idx;
+    if !is_purecap(&config.arch, pd_elf_file) {
+        return;
+    }
+
+    let read_write = SysMapPerms::Read as u8 | SysMapPerms::Write as u8;
+    let mut channel_buffers: Vec<(u64, u64, u64, u8)> = Channel::pd_buffers(channels, pd_idx)
+        .into_iter()
+        .map(|(id, vaddr, buffer)| (id, vaddr, buffer.size, read_write))
+        .collect();
+    channel_buffers.extend(
+        Broadcast::pd_consumer_buffers(broadcasts, pd_idx)
+            .into_iter()
+            .map(|(id, vaddr, size)| (id, vaddr, size, SysMapPerms::Read as u8)),
+    );
+    let broadcast_buffers: Vec<(u64, u64, u64, u8)> = broadcasts
+        .iter()
+        .filter(|broadcast| broadcast.producer == pd_idx)
+        .map(|broadcast| (broadcast.id, broadcast.vaddr, broadcast.size, read_write))
+        .collect();
+
+    for (symbol, buffers) in [
+        (SYMBOL_CHANNEL_BUFFER_CAPS, channel_buffers),
+        (SYMBOL_BROADCAST_BUFFER_CAPS, broadcast_buffers),
+    ] {
+        if buffers.is_empty() {
+            continue;
+        }
+
+        let (table_vaddr, _) = pd_elf_file
+            .find_symbol(symbol)
+            .unwrap_or_else(|_| panic!("Could not find {}", symbol));
+        let cap_size = 2 * config.word_size / 8;
+
+        for (id, vaddr, size, map_perms) in buffers {
+            let cap_vaddr = table_vaddr + id * cap_size;
+            match config.arch {
+                Arch::Riscv64 => cheri_riscv_write_sym_cap(
+                    config,
+                    system_invocations,
+                    pd_elf_file,
+                    pd.tcb_cptr,
+                    pd.vspace_cptr,
+                    find_page_cptr(pd.page_descriptors, pd_idx, cap_vaddr),
+                    cap_vaddr,
+                    vaddr,
+                    size,
+                    map_perms,
+                ),
+                _ => {
+                    eprintln!("Only CHERI-RISC-V 64-bit is supported at the moment");
+                    std::process::exit(1);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,461 @@
+//
+// Copyright 2025, Capabilities Limited
+//
+// SPDX-License-Identifier: BSD-2-Clause
+//
+
+//! Runs a Microkit system natively on the build host, see the 'Host emulation'
+//! section of the manual.
+//!
+//! Each protection domain is a shared object built against the host backend of
+//! libmicrokit (libmicrokit/src/host). All PDs are loaded into this process, each
+//! with its own copy of libmicrokit, and run on their own thread. Memory regions
+//! are plain zeroed allocations, notifications set bits in the receiving PD's
+//! pending mask, and protected procedure calls run the server's 'protected' entry
+//! point directly on the caller's thread. A per-PD lock makes sure a PD only ever
+//! runs one entry point at a time, as it would on seL4.
+
+use crate::sdf::{Broadcast, Channel, SysSetVarKind, SystemDescription};
+use crate::sel4::{Arch, Config};
+use crate::{MAX_BROADCASTS, MAX_BROADCAST_CONSUMERS, PD_MAX_NAME_LENGTH};
+use std::alloc::{alloc_zeroed, Layout};
+use std::collections::{HashMap, HashSet};
+use std::ffi::{c_char, c_int, c_void, CStr, CString};
+use std::path::{Path, PathBuf};
+use std::sync::{Condvar, Mutex, OnceLock};
+
+// Note that these values come from libmicrokit/include/microkit.h so should
+// also be changed there if any of these were to change.
+const MONITOR_EP: u64 = 5;
+const BASE_OUTPUT_NOTIFICATION_CAP: u64 = 10;
+const BASE_ENDPOINT_CAP: u64 = 74;
+const BASE_IRQ_CAP: u64 = 138;
+const BASE_BROADCAST_CAP: u64 = 394;
+const MAX_CHANNELS: u64 = 62;
+
+/// Number of message registers, must match seL4_MsgMaxLength in
+/// libmicrokit/src/host/include/sel4/sel4.h.
+const MSG_MAX_LENGTH: usize = 120;
+
+const RTLD_NOW: c_int = 2;
+
+extern "C" {
+    fn dlopen(filename: *const c_char, flag: c_int) -> *mut c_void;
+    fn dlsym(handle: *mut c_void, symbol: *const c_char) -> *mut c_void;
+    fn dlerror() -> *mut c_char;
+}
+
+/// Must match 'struct microkit_host_ops' in libmicrokit/src/host/include/sel4/sel4.h.
+#[repr(C)]
+struct HostOps {
+    signal: extern "C" fn(pd: u64, cap: u64),
+    ppcall: extern "C" fn(pd: u64, cap: u64, msginfo: u64) -> u64,
+}
+
+static HOST_OPS: HostOps = HostOps {
+    signal: host_signal,
+    ppcall: host_ppcall,
+};
+
+/// The kernel configuration used to check the system description. It is not
+/// used for anything else on the host, so we just pick a generic 64-bit
+/// platform.
+pub fn config() -> Config {
+    Config {
+        arch: Arch::Aarch64,
+        word_size: 64,
+        minimum_page_size: 4096,
+        paddr_user_device_top: 1 << 40,
+        kernel_frame_size: 1 << 12,
+        init_cnode_bits: 12,
+        cap_address_bits: 64,
+        fan_out_limit: 256,
+        hypervisor: false,
+        cheri: false,
+        benchmark: false,
+        fpu: true,
+        arm_pa_size_bits: Some(40),
+        arm_smc: Some(false),
+        riscv_pt_levels: None,
+        invocations_labels: serde_json::Value::Null,
+        device_regions: vec![],
+        normal_regions: vec![],
+    }
+}
+
+/// Entry points that libmicrokit provides in the PD's shared object
+type InitFn = extern "C" fn();
+type NotifiedFn = extern "C" fn(badge: u64);
+type ProtectedFn = extern "C" fn(ch: u64, msginfo: u64) -> u64;
+
+struct HostPd {
+    name: String,
+    /// Held while any of the PD's entry points are running
+    lock: Mutex<()>,
+    /// Notification bits that have been signalled but not yet delivered
+    pending: Mutex<u64>,
+    pending_cv: Condvar,
+    init: InitFn,
+    notified: NotifiedFn,
+    protected: ProtectedFn,
+    /// The PD's message registers
+    mrs: *mut u64,
+}
+
+// The raw pointer to the message registers is only used while holding the PD's lock,
+// or by the PD's own thread.
+unsafe impl Send for HostPd {}
+unsafe impl Sync for HostPd {}
+
+struct HostSystem {
+    pds: Vec<HostPd>,
+    /// Maps a (PD, channel) pair to the PD and channel on the other end, for
+    /// channel ends that are allowed to notify.
+    notify_targets: HashMap<(usize, u64), (usize, u64)>,
+    /// As above, but for channel ends that are allowed to perform PPCs.
+    pp_targets: HashMap<(usize, u64), (usize, u64)>,
+    /// Maps a producer and one of its broadcast caps to the consumer and the
+    /// channel it is notified on.
+    broadcast_targets: HashMap<(usize, u64), (usize, u64)>,
+}
+
+static SYSTEM: OnceLock<HostSystem> = OnceLock::new();
+
+fn host_system() -> &'static HostSystem {
+    SYSTEM.get().unwrap()
+}
+
+extern "C" fn host_signal(pd: u64, cap: u64) {
+    if cap == MONITOR_EP || (BASE_IRQ_CAP..BASE_IRQ_CAP + MAX_CHANNELS).contains(&cap) {
+        // There is no monitor or hardware on the host, nothing to do.
+        return;
+    }
+    let system = host_system();
+    let (target, target_ch) = if cap >= BASE_BROADCAST_CAP {
+        assert!(cap < BASE_BROADCAST_CAP + MAX_BROADCAST_CONSUMERS as u64);
+        system.broadcast_targets[&(pd as usize, cap - BASE_BROADCAST_CAP)]
+    } else {
+        assert!(
+            (BASE_OUTPUT_NOTIFICATION_CAP..BASE_OUTPUT_NOTIFICATION_CAP + MAX_CHANNELS)
+                .contains(&cap)
+        );
+        let ch = cap - BASE_OUTPUT_NOTIFICATION_CAP;
+        // libmicrokit checks the channel is valid for notifying before signalling
+        system.notify_targets[&(pd as usize, ch)]
+    };
+    let target = &system.pds[target];
+    *target.pending.lock().unwrap() |= 1 << target_ch;
+    target.pending_cv.notify_one();
+}
+
+extern "C" fn host_ppcall(pd: u64, cap: u64, msginfo: u64) -> u64 {
+    assert!((BASE_ENDPOINT_CAP..BASE_ENDPOINT_CAP + MAX_CHANNELS).contains(&cap));
+    let ch = cap - BASE_ENDPOINT_CAP;
+    let system = host_system();
+    // libmicrokit checks the channel is valid for PPCs before calling
+    let (server, server_ch) = system.pp_targets[&(pd as usize, ch)];
+    let client = &system.pds[pd as usize];
+    let server = &system.pds[server];
+
+    let _guard = server.lock.lock().unwrap();
+    // The length of a message is in the bottom 7 bits of the message info
+    let length = ((msginfo & 0x7f) as usize).min(MSG_MAX_LENGTH);
+    unsafe { std::ptr::copy_nonoverlapping(client.mrs, server.mrs, length) };
+    let reply = (server.protected)(server_ch, msginfo);
+    let length = ((reply & 0x7f) as usize).min(MSG_MAX_LENGTH);
+    unsafe { std::ptr::copy_nonoverlapping(server.mrs, client.mrs, length) };
+
+    reply
+}
+
+fn pd_thread(pd: &HostPd) {
+    loop {
+        let badge = {
+            let mut pending = pd.pending.lock().unwrap();
+            while *pending == 0 {
+                pending = pd.pending_cv.wait(pending).unwrap();
+            }
+            std::mem::take(&mut *pending)
+        };
+        let _guard = pd.lock.lock().unwrap();
+        (pd.notified)(badge);
+    }
+}
+
+struct SharedObject {
+    path: PathBuf,
+    handle: *mut c_void,
+}
+
+impl SharedObject {
+    fn open(path: &Path) -> Result<SharedObject, String> {
+        let c_path = CString::new(path.to_str().unwrap()).unwrap();
+        let handle = unsafe { dlopen(c_path.as_ptr(), RTLD_NOW) };
+        if handle.is_null() {
+            let err = unsafe { CStr::from_ptr(dlerror()) };
+            return Err(format!(
+                "Could not load '{}': {}",
+                path.display(),
+                err.to_string_lossy()
+            ));
+        }
+
+        Ok(SharedObject {
+            path: path.to_path_buf(),
+            handle,
+        })
+    }
+
+    fn symbol(&self, name: &str) -> Result<*mut c_void, String> {
+        let c_name = CString::new(name).unwrap();
+        let sym = unsafe { dlsym(self.handle, c_name.as_ptr()) };
+        if sym.is_null() {
+            return Err(format!(
+                "No symbol named '{}' in '{}'",
+                name,
+                self.path.display()
+            ));
+        }
+
+        Ok(sym)
+    }
+
+    fn write_symbol(&self, name: &str, data: &[u8]) -> Result<(), String> {
+        let sym = self.symbol(name)?;
+        unsafe { std::ptr::copy_nonoverlapping(data.as_ptr(), sym as *mut u8, data.len()) };
+
+        Ok(())
+    }
+}
+
+/// Run the system on the host. The program image of each PD in 'program_paths'
+/// must be a shared object built against the host backend of libmicrokit.
+/// This does not return unless there is an error.
+pub fn run(system: SystemDescription, program_paths: &[PathBuf]) -> Result<(), String> {
+    for pd in &system.protection_domains {
+        if pd.virtual_machine.is_some() {
+            return Err(format!(
+                "Protection domain '{}' has a virtual machine, which is not supported on the host",
+                pd.name
+            ));
+        }
+        if pd.poll {
+            return Err(format!(
+                "Protection domain '{}' polls for events, which is not supported on the host",
+                pd.name
+            ));
+        }
+        if !pd.templates.is_empty() {
+            return Err(format!(
+                "Protection domain '{}' has templates, which are not supported on the host",
+                pd.name
+            ));
+        }
+    }
+
+    let mut mr_addrs = HashMap::new();
+    for mr in &system.memory_regions {
+        let layout =
+            Layout::from_size_align(mr.size as usize, mr.page_size_bytes() as usize).unwrap();
+        // Memory regions live for the lifetime of the system, so they are never freed.
+        let addr = unsafe { alloc_zeroed(layout) };
+        if addr.is_null() {
+            return Err(format!("Could not allocate memory region '{}'", mr.name));
+        }
+        mr_addrs.insert(mr.name.as_str(), addr as u64);
+    }
+
+    let mut notify_targets = HashMap::new();
+    let mut pp_targets = HashMap::new();
+    for channel in &system.channels {
+        for (from, to) in [
+            (&channel.end_a, &channel.end_b),
+            (&channel.end_b, &channel.end_a),
+        ] {
+            if from.notify {
+                notify_targets.insert((from.pd, from.id), (to.pd, to.id));
+            }
+            if from.pp {
+                pp_targets.insert((from.pd, from.id), (to.pd, to.id));
+            }
+        }
+    }
+
+    let mut broadcast_targets = HashMap::new();
+    for broadcast in &system.broadcasts {
+        for (i, consumer) in broadcast.consumers.iter().enumerate() {
+            broadcast_targets.insert(
+                (broadcast.producer, broadcast.first_cap + i as u64),
+                (consumer.pd, consumer.id),
+            );
+        }
+    }
+
+    let mut pds = Vec::with_capacity(system.protection_domains.len());
+    let mut opened = HashSet::new();
+    for (i, pd) in system.protection_domains.iter().enumerate() {
+        // Loading the same shared object twice would give back the same copy, but
+        // each PD needs its own globals, so give any further PDs a copy of it.
+        let mut path = program_paths[i].clone();
+        if !opened.insert(path.clone()) {
+            let copy = std::env::temp_dir().join(format!(
+                "microkit-host-{}-{}",
+                std::process::id(),
+                pd.name
+            ));
+            if let Err(e) = std::fs::copy(&path, &copy) {
+                return Err(format!(
+                    "Could not copy '{}' to '{}': {}",
+                    path.display(),
+                    copy.display(),
+                    e
+                ));
+            }
+            path = copy;
+        }
+        let so = SharedObject::open(&path)?;
+        if path != program_paths[i] {
+            // The copy is no longer needed once it has been loaded
+            let _ = std::fs::remove_file(&path);
+        }
+
+        // Patch the same symbols that the tool patches in the PD's ELF when building
+        // an image, with memory region addresses being where they are on the host.
+        let mut name = [0u8; PD_MAX_NAME_LENGTH];
+        let name_length = pd.name.len().min(PD_MAX_NAME_LENGTH);
+        name[..name_length].copy_from_slice(&pd.name.as_bytes()[..name_length]);
+        so.write_symbol("microkit_name", &name)?;
+        so.write_symbol("microkit_passive", &[pd.passive as u8])?;
+        let notification_bits: u64 = notify_targets
+            .keys()
+            .filter(|(p, _)| *p == i)
+            .fold(0, |acc, (_, id)| acc | (1 << id));
+        let pp_bits: u64 = pp_targets
+            .keys()
+            .filter(|(p, _)| *p == i)
+            .fold(0, |acc, (_, id)| acc | (1 << id));
+        so.write_symbol("microkit_irqs", &pd.irq_bits().to_le_bytes())?;
+        so.write_symbol("microkit_notifications", &notification_bits.to_le_bytes())?;
+        so.write_symbol("microkit_pps", &pp_bits.to_le_bytes())?;
+        let (dispatch_mask, dispatch_order) = pd.dispatch_order(i, &system.channels);
+        so.write_symbol("microkit_dispatch_mask", &dispatch_mask.to_le_bytes())?;
+        so.write_symbol("microkit_dispatch_order", &dispatch_order)?;
+        let mut buffer_vaddrs = [0u64; MAX_CHANNELS as usize];
+        let mut buffer_sizes = [0u64; MAX_CHANNELS as usize];
+        for (id, _, buffer) in Channel::pd_buffers(&system.channels, i) {
+            buffer_vaddrs[id as usize] = mr_addrs[buffer.mr.as_str()];
+            buffer_sizes[id as usize] = buffer.size;
+        }
+        for broadcast in &system.broadcasts {
+            for consumer in broadcast.consumers.iter().filter(|c| c.pd == i) {
+                buffer_vaddrs[consumer.id as usize] = mr_addrs[broadcast.mr.as_str()];
+                buffer_sizes[consumer.id as usize] = broadcast.size;
+            }
+        }
+        let to_bytes =
+            |words: &[u64]| -> Vec<u8> { words.iter().flat_map(|w| w.to_le_bytes()).collect() };
+        so.write_symbol("microkit_channel_buffer_vaddrs", &to_bytes(&buffer_vaddrs))?;
+        so.write_symbol("microkit_channel_buffer_sizes", &to_bytes(&buffer_sizes))?;
+        let produced: Vec<&Broadcast> =
+            system.broadcasts.iter().filter(|b| b.producer == i).collect();
+        if !produced.is_empty() {
+            let mut broadcast_vaddrs = [0u64; MAX_BROADCASTS];
+            let mut broadcast_sizes = [0u64; MAX_BROADCASTS];
+            let mut broadcast_caps = [0u64; MAX_BROADCASTS];
+            let mut broadcast_consumers = [0u64; MAX_BROADCASTS];
+            for broadcast in produced {
+                let id = broadcast.id as usize;
+                broadcast_vaddrs[id] = mr_addrs[broadcast.mr.as_str()];
+                broadcast_sizes[id] = broadcast.size;
+                broadcast_caps[id] = BASE_BROADCAST_CAP + broadcast.first_cap;
+                broadcast_consumers[id] = broadcast.consumers.len() as u64;
+            }
+            so.write_symbol("microkit_broadcast_vaddrs", &to_bytes(&broadcast_vaddrs))?;
+            so.write_symbol("microkit_broadcast_sizes", &to_bytes(&broadcast_sizes))?;
+            so.write_symbol("microkit_broadcast_caps", &to_bytes(&broadcast_caps))?;
+            so.write_symbol("microkit_broadcast_consumers", &to_bytes(&broadcast_consumers))?;
+        }
+        for setvar in &pd.setvars {
+            let value = match &setvar.kind {
+                SysSetVarKind::Size { mr, offset, size } => size.unwrap_or(
+                    system
+                        .memory_regions
+                        .iter()
+                        .find(|m| m.name == *mr)
+                        .unwrap()
+                        .size
+                        - offset,
+                ),
+                SysSetVarKind::Vaddr { address, mr } => {
+                    // A map of part of the MR points into the middle of it
+                    let offset = pd
+                        .maps
+                        .iter()
+                        .find(|m| m.mr == *mr && m.vaddr == *address)
+                        .map_or(0, |m| m.offset);
+                    mr_addrs[mr.as_str()] + offset
+                }
+                SysSetVarKind::Paddr { region } => mr_addrs[region.as_str()],
+            };
+            so.write_symbol(&setvar.symbol, &value.to_le_bytes())?;
+        }
+
+        so.write_symbol("microkit_host_pd", &(i as u64).to_le_bytes())?;
+        so.write_symbol(
+            "microkit_host_ops",
+            &(&HOST_OPS as *const HostOps as u64).to_le_bytes(),
+        )?;
+
+        unsafe {
+            pds.push(HostPd {
+                name: pd.name.clone(),
+                lock: Mutex::new(()),
+                pending: Mutex::new(0),
+                pending_cv: Condvar::new(),
+                init: std::mem::transmute::<*mut c_void, InitFn>(
+                    so.symbol("microkit_host_init")?,
+                ),
+                notified: std::mem::transmute::<*mut c_void, NotifiedFn>(
+                    so.symbol("microkit_host_notified")?,
+                ),
+                protected: std::mem::transmute::<*mut c_void, ProtectedFn>(
+                    so.symbol("microkit_host_protected")?,
+                ),
+                mrs: so.symbol("microkit_host_mrs")? as *mut u64,
+            });
+        }
+    }
+
+    if SYSTEM
+        .set(HostSystem {
+            pds,
+            notify_targets,
+            pp_targets,
+            broadcast_targets,
+        })
+        .is_err()
+    {
+        panic!("Internal error: host system already running");
+    }
+
+    // Initialise PDs from highest to lowest priority, so that any PD a PD may
+    // call into during its 'init' has already been initialised.
+    let mut init_order: Vec<usize> = (0..system.protection_domains.len()).collect();
+    init_order.sort_by_key(|&i| std::cmp::Reverse(system.protection_domains[i].priority));
+    for i in init_order {
+        let pd = &host_system().pds[i];
+        let _guard = pd.lock.lock().unwrap();
+        (pd.init)();
+    }
+
+    std::thread::scope(|s| {
+        for pd in &host_system().pds {
+            std::thread::Builder::new()
+                .name(pd.name.clone())
+                .spawn_scoped(s, move || pd_thread(pd))
+                .unwrap();
+        }
+    });
+
+    Ok(())
+}
@@ -5,9 +5,13 @@
 //
 
 pub mod elf;
+pub mod host;
 pub mod loader;
+pub mod lz4;
 pub mod sdf;
 pub mod sel4;
+pub mod stats;
+pub mod timings;
 pub mod cheri;
 pub mod util;
 
@@ -24,6 +28,17 @@ pub const MAX_VMS: usize = 63;
 // the monitor and libmicrokit.
 pub const PD_MAX_NAME_LENGTH: usize = 64;
 pub const VM_MAX_NAME_LENGTH: usize = 64;
+// Must match MICROKIT_MAX_CHANNELS in libmicrokit
+pub const MAX_CHANNELS: usize = 62;
+// Must match MICROKIT_MAX_BROADCASTS in libmicrokit
+pub const MAX_BROADCASTS: usize = 8;
+// The consumers of all of a PD's broadcasts, each of which takes a slot in
+// the PD's CSpace after the vCPU caps
+pub const MAX_BROADCAST_CONSUMERS: usize = 118;
+// Must match MICROKIT_MAX_TEMPLATES in libmicrokit
+pub const MAX_TEMPLATES: usize = 8;
+// Must match MAX_TEMPLATE_INSTANCES in the monitor
+pub const MAX_TEMPLATE_INSTANCES: usize = 64;
 
 #[derive(Debug, Copy, Clone, PartialEq)]
 pub struct UntypedObject {
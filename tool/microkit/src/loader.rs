@@ -5,11 +5,15 @@
 //
 
 use crate::elf::{ElfFile, ElfFlagsRiscv, ElfFlagsAArch64};
+use crate::lz4;
 use crate::sel4::{Arch, Config};
 use crate::util::{kb, mask, mb, round_up, struct_to_bytes};
 use crate::MemoryRegion;
+use std::borrow::Cow;
 use std::fs::File;
-use std::io::{BufWriter, Write};
+use std::cmp::min;
+use std::io::{BufWriter, Seek, SeekFrom, Write};
+use std::iter::zip;
 use std::path::Path;
 
 const PAGE_TABLE_SIZE: usize = 4096;
@@ -100,6 +104,11 @@ fn check_non_overlapping(regions: &Vec<(u64, &[u8])>) {
     }
 }
 
+// Note that these values are used in the loader so should also be changed there
+// if any of these were to change.
+const REGION_TYPE_DATA: u64 = 1;
+const REGION_TYPE_LZ4: u64 = 3;
+
 #[repr(C)]
 struct LoaderRegion64 {
     load_addr: u64,
@@ -121,14 +130,108 @@ struct LoaderHeader64 {
     v_entry_size: u64,
     extra_device_addr_p: u64,
     extra_device_size: u64,
+    boot_log_addr_p: u64,
+    boot_log_size: u64,
     num_regions: u64,
 }
 
+/// Writes out a file while leaving holes wherever a whole block of the file would
+/// only contain zeroes, so that file systems that support sparse files do not need
+/// to store them. Large parts of a typical loader image are zero, such as ELF .bss
+/// segments and the padding before in-place regions.
+struct SparseWriter {
+    file: BufWriter<File>,
+    /// Current position in the file being written
+    pos: u64,
+    /// Position the underlying file is at, if this is behind 'pos' then
+    /// everything in between is a hole.
+    file_pos: u64,
+}
+
+impl SparseWriter {
+    const BLOCK_SIZE: u64 = 4096;
+
+    fn new(file: File) -> SparseWriter {
+        SparseWriter {
+            file: BufWriter::new(file),
+            pos: 0,
+            file_pos: 0,
+        }
+    }
+
+    fn write_run(&mut self, offset: u64, data: &[u8]) -> std::io::Result<()> {
+        if data.is_empty() {
+            return Ok(());
+        }
+        if self.file_pos != offset {
+            self.file.seek(SeekFrom::Start(offset))?;
+        }
+        self.file.write_all(data)?;
+        self.file_pos = offset + data.len() as u64;
+
+        Ok(())
+    }
+
+    fn write(&mut self, data: &[u8]) -> std::io::Result<()> {
+        // Look at the data in chunks that line up with the blocks of the file,
+        // writing out each run of chunks that are not entirely zero.
+        let mut i = 0;
+        let mut run_start = 0;
+        while i < data.len() {
+            let block_left = Self::BLOCK_SIZE - (self.pos + i as u64) % Self::BLOCK_SIZE;
+            let n = min(data.len() - i, block_left as usize);
+            if n as u64 == Self::BLOCK_SIZE && data[i..i + n].iter().all(|b| *b == 0) {
+                self.write_run(self.pos + run_start as u64, &data[run_start..i])?;
+                run_start = i + n;
+            }
+            i += n;
+        }
+        self.write_run(self.pos + run_start as u64, &data[run_start..])?;
+        self.pos += data.len() as u64;
+
+        Ok(())
+    }
+
+    /// Leave a hole of 'len' bytes.
+    fn skip(&mut self, len: u64) {
+        self.pos += len;
+    }
+
+    fn finish(mut self) -> std::io::Result<()> {
+        self.file.flush()?;
+        // Make sure the file is extended to cover any trailing hole
+        self.file.get_ref().set_len(self.pos)
+    }
+}
+
 pub struct Loader<'a> {
     image: Vec<u8>,
+    image_vaddr: u64,
     header: LoaderHeader64,
     region_metadata: Vec<LoaderRegion64>,
-    regions: Vec<(u64, &'a [u8])>,
+    /// The data that gets written out for each region. This is either the
+    /// region's contents or, for compressed regions, the LZ4 block that the
+    /// loader decompresses into the region's load address.
+    region_data: Vec<Cow<'a, [u8]>>,
+}
+
+/// Summary of how a region is stored in the loader image, used for the report.
+pub struct LoaderRegionInfo {
+    pub load_addr: u64,
+    pub size: u64,
+    pub stored_size: u64,
+    pub compressed: bool,
+    pub in_place: bool,
+}
+
+/// The initial task and the memory the loader tells the kernel to give it.
+pub struct InitialTask<'a> {
+    pub elf: &'a ElfFile,
+    /// If not None, this address is used as the base physical address of the
+    /// initial task, rather than the address that comes from the ELF file.
+    pub phys_base: Option<u64>,
+    pub reserved_region: MemoryRegion,
+    pub boot_log_region: Option<MemoryRegion>,
 }
 
 impl<'a> Loader<'a> {
@@ -136,14 +239,17 @@ impl<'a> Loader<'a> {
         config: &Config,
         loader_elf_path: &Path,
         kernel_elf: &'a ElfFile,
-        initial_task_elf: &'a ElfFile,
-        initial_task_phys_base: Option<u64>,
-        reserved_region: MemoryRegion,
+        initial_task: InitialTask<'a>,
         system_regions: Vec<(u64, &'a [u8])>,
+        compress: bool,
+        in_place: bool,
     ) -> Loader<'a> {
-        // Note: If initial_task_phys_base is not None, then it just this address
-        // as the base physical address of the initial task, rather than the address
-        // that comes from the initial_task_elf file.
+        let InitialTask {
+            elf: initial_task_elf,
+            phys_base: initial_task_phys_base,
+            reserved_region,
+            boot_log_region,
+        } = initial_task;
         let elf = ElfFile::from_path(loader_elf_path).unwrap();
         let sz = elf.word_size;
         let magic = match sz {
@@ -299,22 +405,69 @@ impl<'a> Loader<'a> {
             Arch::Riscv64 => if (elf_flags & ElfFlagsRiscv::EfRiscvCapMode as u64) != 0 {1 << 2} else {0},
         };
 
-        let mut region_metadata = Vec::new();
+        let mut region_types = Vec::with_capacity(all_regions.len());
+        let mut region_data: Vec<Cow<[u8]>> = Vec::with_capacity(all_regions.len());
+        for (_, data) in &all_regions {
+            // Only keep the compressed form of a region if it is actually smaller,
+            // otherwise the loader may as well copy the data directly.
+            let compressed = if compress {
+                Some(lz4::compress(data)).filter(|c| c.len() < data.len())
+            } else {
+                None
+            };
+            match compressed {
+                Some(c) => {
+                    region_types.push(REGION_TYPE_LZ4);
+                    region_data.push(Cow::Owned(c));
+                }
+                None => {
+                    region_types.push(REGION_TYPE_DATA);
+                    region_data.push(Cow::Borrowed(*data));
+                }
+            }
+        }
+
+        // The region data starts directly after the loader image, header and region
+        // metadata. Note that this is only where the data ends up at run-time once the
+        // loader has relocated itself to its link address (if necessary).
+        let metadata_size = (std::mem::size_of::<LoaderHeader64>()
+            + all_regions.len() * std::mem::size_of::<LoaderRegion64>())
+            as u64;
+        let region_data_base = image_vaddr + image.len() as u64 + metadata_size;
+
+        let in_place = if in_place {
+            let packed_sizes: Vec<u64> = region_data.iter().map(|d| d.len() as u64).collect();
+            Loader::in_place_regions(&all_regions, &packed_sizes, region_data_base)
+        } else {
+            vec![false; all_regions.len()]
+        };
+
+        let mut region_metadata = Vec::with_capacity(all_regions.len());
         let mut offset: u64 = 0;
-        for (addr, data) in &all_regions {
+        for (i, (addr, data)) in all_regions.iter().enumerate() {
+            let region_offset = if in_place[i] {
+                // The data is already at its load address, so it must be stored as is.
+                region_types[i] = REGION_TYPE_DATA;
+                region_data[i] = Cow::Borrowed(*data);
+                addr - region_data_base
+            } else {
+                let region_offset = offset;
+                offset += region_data[i].len() as u64;
+                region_offset
+            };
             region_metadata.push(LoaderRegion64 {
                 load_addr: *addr,
                 size: data.len() as u64,
-                offset,
-                r#type: 1,
+                offset: region_offset,
+                r#type: region_types[i],
             });
-            offset += data.len() as u64;
         }
 
-        let size = std::mem::size_of::<LoaderHeader64>() as u64
-            + region_metadata.iter().fold(0_u64, |acc, x| {
-                acc + x.size + std::mem::size_of::<LoaderRegion64>() as u64
-            });
+        let size = metadata_size
+            + zip(&region_metadata, &region_data)
+                .map(|(metadata, data)| metadata.offset + data.len() as u64)
+                .max()
+                .unwrap_or(0);
 
         let header = LoaderHeader64 {
             magic,
@@ -328,14 +481,84 @@ impl<'a> Loader<'a> {
             v_entry_size,
             extra_device_addr_p,
             extra_device_size,
+            boot_log_addr_p: boot_log_region.map_or(0, |r| r.base),
+            boot_log_size: boot_log_region.map_or(0, |r| r.size()),
             num_regions: all_regions.len() as u64,
         };
 
         Loader {
             image,
+            image_vaddr,
             header,
             region_metadata,
-            regions: all_regions,
+            region_data,
+        }
+    }
+
+    pub fn region_info(&self) -> Vec<LoaderRegionInfo> {
+        let region_data_base = self.region_data_base();
+        zip(&self.region_metadata, &self.region_data)
+            .map(|(metadata, data)| LoaderRegionInfo {
+                load_addr: metadata.load_addr,
+                size: metadata.size,
+                stored_size: data.len() as u64,
+                compressed: metadata.r#type == REGION_TYPE_LZ4,
+                in_place: region_data_base + metadata.offset == metadata.load_addr,
+            })
+            .collect()
+    }
+
+    /// Size of the image that write_image writes out.
+    pub fn image_size(&self) -> u64 {
+        self.image.len() as u64 + self.header.size
+    }
+
+    fn region_data_base(&self) -> u64 {
+        self.image_vaddr
+            + self.image.len() as u64
+            + std::mem::size_of::<LoaderHeader64>() as u64
+            + (self.region_metadata.len() * std::mem::size_of::<LoaderRegion64>()) as u64
+    }
+
+    /// Pick the regions that can be stored in the image at exactly their load address
+    /// (once the loader is at its link address), so that the loader does not have to
+    /// copy them at all. Such regions are placed after all the other region data, in
+    /// order of address, with zero padding in between. To stop the image from growing
+    /// without bound, a region is only placed in-place if the padding needed to reach
+    /// it is no larger than the region itself.
+    ///
+    /// Which regions are in-place affects where the remaining region data ends, so we
+    /// keep removing regions that no longer fit until the choice is stable.
+    fn in_place_regions(
+        regions: &[(u64, &[u8])],
+        packed_sizes: &[u64],
+        region_data_base: u64,
+    ) -> Vec<bool> {
+        let mut order: Vec<usize> = (0..regions.len()).collect();
+        order.sort_by_key(|&i| regions[i].0);
+
+        let mut in_place = vec![true; regions.len()];
+        loop {
+            let packed_size: u64 = (0..regions.len())
+                .filter(|&i| !in_place[i])
+                .map(|i| packed_sizes[i])
+                .sum();
+
+            let mut next = vec![false; regions.len()];
+            let mut end = region_data_base + packed_size;
+            for &i in &order {
+                let (addr, data) = regions[i];
+                let size = data.len() as u64;
+                if in_place[i] && size > 0 && addr >= end && addr - end <= size {
+                    next[i] = true;
+                    end = addr + size;
+                }
+            }
+
+            if next == in_place {
+                return in_place;
+            }
+            in_place = next;
         }
     }
 
@@ -345,34 +568,44 @@ impl<'a> Loader<'a> {
             Err(e) => panic!("Could not create '{}': {}", path.display(), e),
         };
 
-        let mut loader_buf = BufWriter::new(loader_file);
+        let mut loader_buf = SparseWriter::new(loader_file);
 
         // First write out all the image data
         loader_buf
-            .write_all(self.image.as_slice())
+            .write(self.image.as_slice())
             .expect("Failed to write image data to loader");
 
         // Then we write out the loader metadata (known as the 'header')
         let header_bytes = unsafe { struct_to_bytes(&self.header) };
         loader_buf
-            .write_all(header_bytes)
+            .write(header_bytes)
             .expect("Failed to write header data to loader");
         // For each region, we need to write out the region metadata as well
         for region in &self.region_metadata {
             let region_metadata_bytes = unsafe { struct_to_bytes(region) };
             loader_buf
-                .write_all(region_metadata_bytes)
+                .write(region_metadata_bytes)
                 .expect("Failed to write region metadata to loader");
         }
 
-        // Now we can write out all the region data
-        for (_, data) in &self.regions {
+        // Now we can write out all the region data. In-place regions may leave gaps
+        // between the data, which are left as holes.
+        let mut order: Vec<usize> = (0..self.region_data.len()).collect();
+        order.sort_by_key(|&i| self.region_metadata[i].offset);
+        let mut offset = 0;
+        for i in order {
+            let region_offset = self.region_metadata[i].offset;
+            assert!(region_offset >= offset);
+            loader_buf.skip(region_offset - offset);
             loader_buf
-                .write_all(data)
+                .write(&self.region_data[i])
                 .expect("Failed to write region data to loader");
+            offset = region_offset + self.region_data[i].len() as u64;
         }
 
-        loader_buf.flush().unwrap();
+        loader_buf
+            .finish()
+            .expect("Failed to finish writing loader");
     }
 
     fn riscv64_setup_pagetables(
@@ -0,0 +1,158 @@
+//
+// Copyright 2025, Capabilities Limited
+//
+// SPDX-License-Identifier: BSD-2-Clause
+//
+
+//! A small compressor for the LZ4 block format, used to shrink the regions
+//! of the loader image. The matching decompressor lives in the loader itself
+//! (see `lz4_decompress` in loader/src/loader.c).
+//!
+//! This is a simple greedy compressor with a single-entry hash table. It does
+//! not try to match the ratio of the reference implementation; loader regions
+//! tend to be dominated by zero padding and repeated ELF data, which even a
+//! simple matcher compresses well.
+
+const MIN_MATCH: usize = 4;
+/// The format requires the last 5 bytes of a block to be literals.
+const LAST_LITERALS: usize = 5;
+/// The format requires the last match to start at least 12 bytes before the end.
+const MF_LIMIT: usize = 12;
+const MAX_DISTANCE: usize = 65535;
+const HASH_BITS: u32 = 16;
+
+fn read_u32(data: &[u8], i: usize) -> u32 {
+    u32::from_le_bytes(data[i..i + 4].try_into().unwrap())
+}
+
+fn hash(seq: u32) -> usize {
+    (seq.wrapping_mul(2654435761) >> (32 - HASH_BITS)) as usize
+}
+
+fn write_length(out: &mut Vec<u8>, mut len: usize) {
+    while len >= 255 {
+        out.push(255);
+        len -= 255;
+    }
+    out.push(len as u8);
+}
+
+fn write_sequence(out: &mut Vec<u8>, literals: &[u8], offset_and_len: Option<(usize, usize)>) {
+    let lit_len = literals.len();
+    let match_len = offset_and_len.map_or(0, |(_, len)| len - MIN_MATCH);
+
+    let token = ((lit_len.min(15) as u8) << 4) | (match_len.min(15) as u8);
+    out.push(token);
+    if lit_len >= 15 {
+        write_length(out, lit_len - 15);
+    }
+    out.extend_from_slice(literals);
+
+    if let Some((offset, _)) = offset_and_len {
+        out.extend_from_slice(&(offset as u16).to_le_bytes());
+        if match_len >= 15 {
+            write_length(out, match_len - 15);
+        }
+    }
+}
+
+/// Compress 'input' into a single LZ4 block.
+pub fn compress(input: &[u8]) -> Vec<u8> {
+    let mut out = Vec::with_capacity(input.len() / 2);
+    let mut table = vec![usize::MAX; 1 << HASH_BITS];
+
+    let mut anchor = 0;
+    let mut i = 0;
+    if input.len() > MF_LIMIT {
+        let match_limit = input.len() - MF_LIMIT;
+        let extend_limit = input.len() - LAST_LITERALS;
+        while i < match_limit {
+            let seq = read_u32(input, i);
+            let h = hash(seq);
+            let candidate = table[h];
+            table[h] = i;
+
+            if candidate != usize::MAX
+                && i - candidate <= MAX_DISTANCE
+                && read_u32(input, candidate) == seq
+            {
+                let mut len = MIN_MATCH;
+                while i + len < extend_limit && input[candidate + len] == input[i + len] {
+                    len += 1;
+                }
+                write_sequence(&mut out, &input[anchor..i], Some((i - candidate, len)));
+                i += len;
+                anchor = i;
+            } else {
+                // Skip ahead faster through data that is not compressing.
+                i += 1 + ((i - anchor) >> 6);
+            }
+        }
+    }
+
+    write_sequence(&mut out, &input[anchor..], None);
+
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn decompress(input: &[u8], size: usize) -> Vec<u8> {
+        let mut out = Vec::with_capacity(size);
+        let mut s = 0;
+        let read_length = |s: &mut usize, mut len: usize| {
+            if len == 15 {
+                loop {
+                    let b = input[*s];
+                    *s += 1;
+                    len += b as usize;
+                    if b != 255 {
+                        break;
+                    }
+                }
+            }
+            len
+        };
+        while out.len() < size {
+            let token = input[s];
+            s += 1;
+            let lit_len = read_length(&mut s, (token >> 4) as usize);
+            out.extend_from_slice(&input[s..s + lit_len]);
+            s += lit_len;
+            if out.len() >= size {
+                break;
+            }
+            let offset = u16::from_le_bytes([input[s], input[s + 1]]) as usize;
+            s += 2;
+            let match_len = read_length(&mut s, (token & 0xf) as usize) + MIN_MATCH;
+            let start = out.len() - offset;
+            for j in 0..match_len {
+                out.push(out[start + j]);
+            }
+        }
+        // The whole block should have been consumed, apart from the single
+        // empty sequence of an empty block which the loader never reads.
+        if size > 0 {
+            assert_eq!(s, input.len());
+        }
+        out
+    }
+
+    #[test]
+    fn test_roundtrip() {
+        let mut data = vec![0u8; 100_000];
+        for (i, b) in data.iter_mut().enumerate().skip(5000).take(20_000) {
+            *b = (i * 7 % 251) as u8;
+        }
+        data.extend_from_slice(b"abcabcabcabcabcabcabc");
+        data.extend((0..300).map(|i: u32| (i.wrapping_mul(2654435761) >> 24) as u8));
+
+        for len in [0, 1, 12, 13, 17, 4096, data.len()] {
+            let compressed = compress(&data[..len]);
+            assert_eq!(decompress(&compressed, len), &data[..len]);
+        }
+        assert!(compress(&data).len() < data.len() / 4);
+    }
+}
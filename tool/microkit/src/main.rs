@@ -10,21 +10,23 @@
 mod cheri;
 
 use elf::ElfFile;
-use loader::Loader;
+use loader::{InitialTask, Loader, LoaderRegionInfo};
 use microkit_tool::{
-    elf, loader, sdf, sel4, util, DisjointMemoryRegion, FindFixedError, MemoryRegion,
-    ObjectAllocator, Region, UntypedObject, MAX_PDS, MAX_VMS, PD_MAX_NAME_LENGTH,
-    VM_MAX_NAME_LENGTH,
+    elf, host, loader, sdf, sel4, stats, timings, util, DisjointMemoryRegion, FindFixedError, MemoryRegion,
+    ObjectAllocator, Region, UntypedObject, MAX_BROADCASTS, MAX_BROADCAST_CONSUMERS, MAX_CHANNELS,
+    MAX_PDS, MAX_TEMPLATE_INSTANCES, MAX_VMS, PD_MAX_NAME_LENGTH, VM_MAX_NAME_LENGTH,
 };
 use sdf::{
-    parse, Channel, ProtectionDomain, SysMap, SysMapPerms, SysMemoryRegion, SysMemoryRegionKind,
-    SystemDescription, VirtualMachine,
+    parse, Broadcast, Channel, PdTemplate, ProtectionDomain, SysMap, SysMapPerms, SysMemoryRegion,
+    SysMemoryRegionKind, SystemDescription, VirtualMachine,
 };
 use sel4::{
     default_vm_attr, Aarch64Regs, Arch, ArmVmAttributes, BootInfo, Config, Invocation,
     InvocationArgs, Object, ObjectType, PageSize, PlatformConfig, Rights, Riscv64Regs,
     RiscvVirtualMemory, RiscvVmAttributes,
 };
+use stats::{BuildStats, CountAndBytes, ImagePart};
+use timings::{CountingAlloc, Timings};
 use std::cmp::{max, min};
 use std::collections::{HashMap, HashSet};
 use std::fs;
@@ -37,9 +39,19 @@ use util::{
     monitor_serialise_names, monitor_serialise_u64_vec, struct_to_bytes,
 };
 
+#[global_allocator]
+static ALLOC: CountingAlloc = CountingAlloc;
+
 // Corresponds to the IPC buffer symbol in libmicrokit and the monitor
 const SYMBOL_IPC_BUFFER: &str = "__sel4_ipc_buffer_obj";
 
+// Events handled by the event loop linked into a PD, from
+// 'microkit_event_loop_events'. Must match event.h in libmicrokit.
+const SYMBOL_EVENT_LOOP_EVENTS: &str = "microkit_event_loop_events";
+const EVENT_LOOP_PPCS: u64 = 1 << 0;
+const EVENT_LOOP_FAULTS: u64 = 1 << 1;
+const EVENT_LOOP_POLL: u64 = 1 << 2;
+
 const FAULT_BADGE: u64 = 1 << 62;
 const PPC_BADGE: u64 = 1 << 63;
 
@@ -58,16 +70,27 @@ const BASE_IRQ_CAP: u64 = BASE_OUTPUT_ENDPOINT_CAP + 64;
 const BASE_PD_TCB_CAP: u64 = BASE_IRQ_CAP + 64;
 const BASE_VM_TCB_CAP: u64 = BASE_PD_TCB_CAP + 64;
 const BASE_VCPU_CAP: u64 = BASE_VM_TCB_CAP + 64;
+const BASE_BROADCAST_CAP: u64 = BASE_VCPU_CAP + 64;
 
 const MAX_SYSTEM_INVOCATION_SIZE: u64 = util::mb(128);
 
+// The monitor's fault endpoint badges for the instances of templates start
+// after those of the PDs. Must match MAX_PDS in the monitor.
+const TEMPLATE_INSTANCE_BADGE: u64 = MAX_PDS as u64 + 1;
+
 const PD_CAP_SIZE: u64 = 512;
 const PD_CAP_BITS: u64 = PD_CAP_SIZE.ilog2() as u64;
 const PD_SCHEDCONTEXT_SIZE: u64 = 1 << 8;
+// seL4_CoreSchedContextBytes and seL4_RefillSizeBytes
+const SCHEDCONTEXT_CORE_SIZE: u64 = 10 * 8 + 6 * 8;
+const SCHEDCONTEXT_REFILL_SIZE: u64 = 2 * 8;
 
 const SLOT_BITS: u64 = 5;
 const SLOT_SIZE: u64 = 1 << SLOT_BITS;
 
+// The monitor runs at the highest priority, above all PDs
+const MONITOR_PRIORITY: u64 = 255;
+
 const INIT_NULL_CAP_ADDRESS: u64 = 0;
 const INIT_TCB_CAP_ADDRESS: u64 = 1;
 const INIT_CNODE_CAP_ADDRESS: u64 = 2;
@@ -105,6 +128,252 @@ struct MonitorRegion64 {
     is_device: u64,
 }
 
+/// Corresponds to 'struct template_instance' in the monitor
+/// This struct assumes a 64-bit target
+#[repr(C)]
+struct MonitorTemplateInstance64 {
+    /// Badge of the parent PD's cap to the monitor
+    parent: u64,
+    template: u64,
+    channel: u64,
+    tcb: u64,
+    /// Word offsets into the system invocation data and number of steps of
+    /// the recipes that create and destroy the instance
+    spawn_offset: u64,
+    spawn_count: u64,
+    destroy_offset: u64,
+    destroy_count: u64,
+    name: [u8; PD_MAX_NAME_LENGTH],
+}
+
+/// A step in the recipe for creating an instance of a template. Apart from
+/// invocations, the monitor copies the program image into the pages of the
+/// instance, which it maps for the duration of the copy.
+enum RecipeStep {
+    Invocation(Invocation),
+    /// Copy 'size' bytes at 'offset' in the template images to 'vaddr'
+    Copy { offset: u64, vaddr: u64, size: u64 },
+}
+
+impl RecipeStep {
+    // Must match RECIPE_COPY in the monitor, 0 is never a valid invocation label
+    const COPY_LABEL: u64 = 0;
+
+    fn add_raw(&self, config: &Config, images_offset: u64, data: &mut Vec<u8>) {
+        match self {
+            RecipeStep::Invocation(invocation) => invocation.add_raw_invocation(config, data),
+            RecipeStep::Copy {
+                offset,
+                vaddr,
+                size,
+            } => {
+                let tag = Invocation::message_info_new(RecipeStep::COPY_LABEL, 0, 0, 3);
+                for word in [tag, 0, images_offset + offset, *vaddr, *size] {
+                    data.extend(word.to_le_bytes());
+                }
+            }
+        }
+    }
+}
+
+/// The size of a scheduling context with room for the given number of extra
+/// refills. The default size already has room for a few.
+fn sched_context_size(refills: u64) -> u64 {
+    max(
+        PD_SCHEDCONTEXT_SIZE,
+        (SCHEDCONTEXT_CORE_SIZE + refills * SCHEDCONTEXT_REFILL_SIZE).next_power_of_two(),
+    )
+}
+
+/// A page of a template's program image: its virtual address, the permissions
+/// it is mapped with and, if any of it comes from the ELF file, the offset
+/// within the page and size of that part and where it is in the template images.
+type TemplateElfPage = (u64, u8, Option<(u64, u64, u64)>);
+
+/// The pages, page tables and other objects that make up an instance of a
+/// template.
+struct TemplateLayout {
+    elf_pages: Vec<TemplateElfPage>,
+    ipc_buffer_vaddr: u64,
+    stack_pages: u64,
+    /// The virtual addresses of the page tables, in the order they are mapped
+    page_tables: Vec<u64>,
+    /// The number of page caps for the template's maps
+    map_pages: u64,
+    sched_context_size: u64,
+}
+
+impl TemplateLayout {
+    /// Kernel objects of each instance: type, size for the retype, and number.
+    /// Objects are sorted by size, largest first, so that none of them need
+    /// padding and the untyped for an instance can be exactly the right size.
+    fn objects(&self, config: &Config) -> Vec<(ObjectType, Option<u64>, u64)> {
+        let frames = self.elf_pages.len() as u64 + 1 + self.stack_pages;
+        let mut objects = vec![
+            (ObjectType::CNode, Some(PD_CAP_SIZE), 1),
+            (ObjectType::VSpace, None, 1),
+            (ObjectType::SmallPage, None, frames),
+            (ObjectType::PageTable, None, self.page_tables.len() as u64),
+            (ObjectType::Tcb, None, 1),
+            (ObjectType::SchedContext, Some(self.sched_context_size), 1),
+            (ObjectType::Notification, None, 1),
+        ];
+        objects.retain(|(_, _, count)| *count > 0);
+        objects.sort_by_key(|(object_type, size, _)| {
+            std::cmp::Reverse(template_object_size(config, *object_type, *size))
+        });
+
+        objects
+    }
+
+    fn untyped_size(&self, config: &Config) -> u64 {
+        self.objects(config)
+            .iter()
+            .map(|(object_type, size, count)| template_object_size(config, *object_type, *size) * count)
+            .sum::<u64>()
+            .next_power_of_two()
+    }
+}
+
+fn template_object_size(config: &Config, object_type: ObjectType, size: Option<u64>) -> u64 {
+    match object_type {
+        ObjectType::CNode => size.unwrap() * SLOT_SIZE,
+        ObjectType::SchedContext => size.unwrap(),
+        _ => object_type.fixed_size(config).unwrap(),
+    }
+}
+
+/// The rights and attributes of the pages of a map with the given permissions
+fn map_rights_attrs(config: &Config, perms: u8, cached: bool) -> (u64, u64) {
+    let mut rights: u64 = Rights::None as u64;
+    let mut attrs = match config.arch {
+        Arch::Aarch64 => ArmVmAttributes::ParityEnabled as u64,
+        Arch::Riscv64 => 0,
+    };
+    if perms & SysMapPerms::Read as u8 != 0 {
+        rights |= Rights::Read as u64;
+    }
+    if perms & SysMapPerms::Write as u8 != 0 {
+        rights |= Rights::Write as u64;
+    }
+    if perms & SysMapPerms::Execute as u8 == 0 {
+        match config.arch {
+            Arch::Aarch64 => attrs |= ArmVmAttributes::ExecuteNever as u64,
+            Arch::Riscv64 => attrs |= RiscvVmAttributes::ExecuteNever as u64,
+        }
+    }
+    if cached {
+        match config.arch {
+            Arch::Aarch64 => attrs |= ArmVmAttributes::Cacheable as u64,
+            Arch::Riscv64 => {}
+        }
+    }
+
+    (rights, attrs)
+}
+
+/// Work out the pages and page tables of an instance of a template and add
+/// the parts of its program image that are not zero to 'images'.
+fn template_layout(
+    config: &Config,
+    elf: &ElfFile,
+    template: &PdTemplate,
+    all_mr_by_name: &HashMap<&str, &SysMemoryRegion>,
+    images: &mut Vec<u8>,
+) -> TemplateLayout {
+    let page_size = config.minimum_page_size;
+    let mut elf_pages = Vec::new();
+    for segment in elf.segments.iter().filter(|s| s.loadable) {
+        let mut perms = 0;
+        if segment.is_readable() {
+            perms |= SysMapPerms::Read as u8;
+        }
+        if segment.is_writable() {
+            perms |= SysMapPerms::Write as u8;
+        }
+        if segment.is_executable() {
+            perms |= SysMapPerms::Execute as u8;
+        }
+
+        let segment_end = segment.virt_addr + segment.mem_size();
+        let mut vaddr = util::round_down(segment.virt_addr, page_size);
+        while vaddr < segment_end {
+            let start = max(vaddr, segment.virt_addr);
+            let end = min(vaddr + page_size, segment_end);
+            let data = &segment.data[(start - segment.virt_addr) as usize..(end - segment.virt_addr) as usize];
+            // Pages start out zeroed, so only the rest needs to be copied
+            let copy = if data.iter().all(|b| *b == 0) {
+                None
+            } else {
+                let offset = images.len() as u64;
+                images.extend(data);
+                images.resize(util::round_up(images.len() as u64, 8) as usize, 0);
+                Some((start - vaddr, data.len() as u64, offset))
+            };
+            elf_pages.push((vaddr, perms, copy));
+            vaddr += page_size;
+        }
+    }
+
+    let (ipc_buffer_vaddr, _) = elf
+        .find_symbol(SYMBOL_IPC_BUFFER)
+        .unwrap_or_else(|_| panic!("Could not find {}", SYMBOL_IPC_BUFFER));
+    let stack_pages = template.stack_size / page_size;
+
+    let mut vaddrs: Vec<(u64, PageSize)> = elf_pages
+        .iter()
+        .map(|(vaddr, _, _)| (*vaddr, PageSize::Small))
+        .collect();
+    vaddrs.push((ipc_buffer_vaddr, PageSize::Small));
+    for idx in 0..stack_pages {
+        vaddrs.push((config.pd_stack_bottom(template.stack_size) + idx * page_size, PageSize::Small));
+    }
+    let mut map_pages = 0;
+    for map in &template.maps {
+        let mr = all_mr_by_name[map.mr.as_str()];
+        let mut vaddr = map.vaddr;
+        for _ in map.pages(mr) {
+            vaddrs.push((vaddr, mr.page_size));
+            vaddr += mr.page_size_bytes();
+            map_pages += 1;
+        }
+    }
+
+    // The same levels of page table as for PDs, mapped from the top down
+    let mut upper_directory_vaddrs = HashSet::new();
+    let mut directory_vaddrs = HashSet::new();
+    let mut page_table_vaddrs = HashSet::new();
+    for (vaddr, page_size) in vaddrs {
+        match config.arch {
+            Arch::Aarch64 => {
+                if !config.aarch64_vspace_s2_start_l1() {
+                    upper_directory_vaddrs.insert(util::mask_bits(vaddr, 12 + 9 + 9 + 9));
+                }
+            }
+            Arch::Riscv64 => {}
+        }
+        directory_vaddrs.insert(util::mask_bits(vaddr, 12 + 9 + 9));
+        if page_size == PageSize::Small {
+            page_table_vaddrs.insert(util::mask_bits(vaddr, 12 + 9));
+        }
+    }
+    let mut page_tables = Vec::new();
+    for level_vaddrs in [upper_directory_vaddrs, directory_vaddrs, page_table_vaddrs] {
+        let mut level_vaddrs: Vec<u64> = level_vaddrs.into_iter().collect();
+        level_vaddrs.sort();
+        page_tables.extend(level_vaddrs);
+    }
+
+    TemplateLayout {
+        elf_pages,
+        ipc_buffer_vaddr,
+        stack_pages,
+        page_tables,
+        map_pages,
+        sched_context_size: sched_context_size(template.refills),
+    }
+}
+
 struct MonitorConfig {
     untyped_info_symbol_name: &'static str,
     bootstrap_invocation_count_symbol_name: &'static str,
@@ -164,28 +433,69 @@ impl<'a> InitSystem<'a> {
         }
     }
 
+    /// Allocate physically contiguous fixed objects of the same type starting at
+    /// `phys_address`, one for each name given. Objects that reside in the same
+    /// untyped are created together to reduce the number of retype invocations.
     /// Note: Fixed objects must be allocated in order!
-    pub fn allocate_fixed_object(
+    pub fn allocate_fixed_objects(
         &mut self,
         phys_address: u64,
         object_type: ObjectType,
-        name: String,
-    ) -> Object {
-        assert!(phys_address >= self.last_fixed_address);
+        names: Vec<String>,
+    ) -> Vec<Object> {
         assert!(object_type.fixed_size(self.config).is_some());
 
         let alloc_size = object_type.fixed_size(self.config).unwrap();
 
+        let mut objects = Vec::with_capacity(names.len());
+        let mut remaining = names.len() as u64;
+        let mut names = names.into_iter();
+        let mut phys_addr = phys_address;
+        while remaining > 0 {
+            // A single retype can only create objects from one untyped. If the address is
+            // not in any untyped we still go ahead so the error can be reported.
+            let ut_end = self
+                .device_untyped
+                .untyped
+                .iter()
+                .chain(self.normal_untyped.untyped.iter())
+                .find(|ut| phys_addr >= ut.base() && phys_addr < ut.end())
+                .map_or(phys_addr + alloc_size, |ut| ut.end());
+            let count = max(1, min(remaining, (ut_end - phys_addr) / alloc_size));
+            let count = min(count, self.config.fan_out_limit);
+
+            let batch_names = names.by_ref().take(count as usize).collect();
+            objects.extend(self.allocate_fixed_batch(phys_addr, object_type, batch_names));
+
+            phys_addr += count * alloc_size;
+            remaining -= count;
+        }
+
+        objects
+    }
+
+    fn allocate_fixed_batch(
+        &mut self,
+        phys_address: u64,
+        object_type: ObjectType,
+        names: Vec<String>,
+    ) -> Vec<Object> {
+        assert!(phys_address >= self.last_fixed_address);
+
+        let count = names.len() as u64;
+        let alloc_size = object_type.fixed_size(self.config).unwrap();
+        let name = &names[0];
+
         // Find an untyped that contains the given address, it could either be
         // in device memory or normal memory.
-        let device_ut = self.device_untyped.find_fixed(phys_address, alloc_size).unwrap_or_else(|err| {
+        let device_ut = self.device_untyped.find_fixed(phys_address, alloc_size * count).unwrap_or_else(|err| {
             match err {
                 FindFixedError::AlreadyAllocated => eprintln!("ERROR: attempted to allocate object '{}' at 0x{:x} from reserved region, pick another physical address", name, phys_address),
                 FindFixedError::TooLarge => eprintln!("ERROR: attempted too allocate too large of an object '{}' for this physical address 0x{:x}", name, phys_address),
             }
             std::process::exit(1);
         });
-        let normal_ut = self.normal_untyped.find_fixed(phys_address, alloc_size).unwrap_or_else(|err| {
+        let normal_ut = self.normal_untyped.find_fixed(phys_address, alloc_size * count).unwrap_or_else(|err| {
             match err {
                 FindFixedError::AlreadyAllocated => eprintln!("ERROR: attempted to allocate object '{}' at 0x{:x} from reserved region, pick another physical address", name, phys_address),
                 FindFixedError::TooLarge => eprintln!("ERROR: attempted too allocate too large of an object '{}' for this physical address 0x{:x}", name, phys_address),
@@ -235,8 +545,8 @@ impl<'a> InitSystem<'a> {
             }
         }
 
-        let object_cap = self.cap_slot;
-        self.cap_slot += 1;
+        let base_cap_slot = self.cap_slot;
+        self.cap_slot += count;
         self.invocations.push(Invocation::new(
             self.config,
             InvocationArgs::UntypedRetype {
@@ -246,22 +556,28 @@ impl<'a> InitSystem<'a> {
                 root: self.cnode_cap,
                 node_index: 1,
                 node_depth: 1,
-                node_offset: object_cap,
-                num_objects: 1,
+                node_offset: base_cap_slot,
+                num_objects: count,
             },
         ));
 
-        self.last_fixed_address = phys_address + alloc_size;
-        let cap_addr = self.cnode_mask | object_cap;
-        let kernel_object = Object {
-            object_type,
-            cap_addr,
-            phys_addr: phys_address,
-        };
-        self.objects.push(kernel_object);
-        self.cap_address_names.insert(cap_addr, name);
+        self.last_fixed_address = phys_address + alloc_size * count;
 
-        kernel_object
+        let mut kernel_objects = Vec::with_capacity(names.len());
+        for (idx, name) in names.into_iter().enumerate() {
+            let cap_addr = self.cnode_mask | (base_cap_slot + idx as u64);
+            let kernel_object = Object {
+                object_type,
+                cap_addr,
+                phys_addr: phys_address + idx as u64 * alloc_size,
+                size: alloc_size,
+            };
+            kernel_objects.push(kernel_object);
+            self.objects.push(kernel_object);
+            self.cap_address_names.insert(cap_addr, name);
+        }
+
+        kernel_objects
     }
 
     pub fn allocate_objects(
@@ -284,7 +600,10 @@ impl<'a> InitSystem<'a> {
             assert!(size.is_none());
             alloc_size = object_size;
             api_size = 0;
-        } else if object_type == ObjectType::CNode || object_type == ObjectType::SchedContext {
+        } else if object_type == ObjectType::CNode
+            || object_type == ObjectType::SchedContext
+            || object_type == ObjectType::Untyped
+        {
             let sz = size.unwrap();
             assert!(util::is_power_of_two(sz));
             api_size = sz.ilog2() as u64;
@@ -342,6 +661,7 @@ impl<'a> InitSystem<'a> {
                 object_type,
                 cap_addr,
                 phys_addr,
+                size: alloc_size,
             };
             kernel_objects.push(kernel_object);
             self.cap_address_names.insert(cap_addr, name);
@@ -363,6 +683,11 @@ struct BuiltSystem {
     system_invocations: Vec<Invocation>,
     kernel_boot_info: BootInfo,
     reserved_region: MemoryRegion,
+    boot_log_region: Option<MemoryRegion>,
+    boot_log_vaddr: u64,
+    kernel_log_cap: u64,
+    /// Index of the system invocation before which the kernel log is set up
+    kernel_log_invocation: u64,
     fault_ep_cap_address: u64,
     reply_cap_address: u64,
     cap_lookup: HashMap<u64, String>,
@@ -376,11 +701,62 @@ struct BuiltSystem {
     kernel_objects: Vec<Object>,
     initial_task_virt_region: MemoryRegion,
     initial_task_phys_region: MemoryRegion,
+    untyped_total: u64,
+    untyped_free: u64,
+    untyped_max_alloc: u64,
+    template_instances: Vec<MonitorTemplateInstance64>,
+}
+
+/// A PD picks its event loop when it is linked, so check that the loop handles
+/// everything the system description lets the PD receive, and that it polls
+/// exactly when the PD has mode="poll". Program images that are not linked
+/// against libmicrokit do not have the symbol and are left alone.
+fn check_event_loop(
+    elf: &ElfFile,
+    name: &str,
+    program_image: &Path,
+    receives: u64,
+) -> Result<(), String> {
+    let Ok((vaddr, size)) = elf.find_symbol(SYMBOL_EVENT_LOOP_EVENTS) else {
+        return Ok(());
+    };
+    let events = match elf.get_data(vaddr, size) {
+        Some(data) if size == 8 => u64::from_le_bytes(data.try_into().unwrap()),
+        _ => {
+            return Err(format!(
+                "Invalid symbol '{}' in ELF '{}' for PD '{}'",
+                SYMBOL_EVENT_LOOP_EVENTS,
+                program_image.display(),
+                name
+            ))
+        }
+    };
+
+    let missing = receives & !events;
+    let problem = if missing & EVENT_LOOP_PPCS != 0 {
+        "receives protected procedure calls, which its event loop does not handle"
+    } else if missing & EVENT_LOOP_FAULTS != 0 {
+        "receives faults of its children, which its event loop does not handle"
+    } else if missing & EVENT_LOOP_POLL != 0 {
+        "has mode 'poll' but is not linked with the polling event loop"
+    } else if (events & !receives) & EVENT_LOOP_POLL != 0 {
+        "is linked with the polling event loop but does not have mode 'poll'"
+    } else {
+        return Ok(());
+    };
+
+    Err(format!(
+        "PD '{}' {} (ELF '{}')",
+        name,
+        problem,
+        program_image.display()
+    ))
 }
 
 pub fn pd_write_symbols(
     pds: &[ProtectionDomain],
     channels: &[Channel],
+    broadcasts: &[Broadcast],
     pd_elf_files: &mut [ElfFile],
     pd_setvar_values: &[Vec<u64>],
 ) -> Result<(), String> {
@@ -393,7 +769,13 @@ pub fn pd_write_symbols(
 
         let mut notification_bits: u64 = 0;
         let mut pp_bits: u64 = 0;
+        let mut receives_ppcs = false;
         for channel in channels {
+            if (channel.end_a.pp && channel.end_b.pd == i)
+                || (channel.end_b.pp && channel.end_a.pd == i)
+            {
+                receives_ppcs = true;
+            }
             if channel.end_a.pd == i {
                 if channel.end_a.notify {
                     notification_bits |= 1 << channel.end_a.id;
@@ -412,10 +794,80 @@ pub fn pd_write_symbols(
             }
         }
 
+        // Parents are notified by each instance of a template on its own channel
+        let mut template_bits: u64 = 0;
+        for template in &pd.templates {
+            template_bits |= 1 << template.id;
+            for idx in 0..template.instances {
+                notification_bits |= 1 << (template.channel + idx);
+            }
+        }
+
         elf.write_symbol("microkit_irqs", &pd.irq_bits().to_le_bytes())?;
         elf.write_symbol("microkit_notifications", &notification_bits.to_le_bytes())?;
         elf.write_symbol("microkit_pps", &pp_bits.to_le_bytes())?;
 
+        // Without any dispatch priorities libmicrokit never looks at the order
+        let (dispatch_mask, dispatch_order) = pd.dispatch_order(i, channels);
+        if dispatch_mask != 0 {
+            elf.write_symbol("microkit_dispatch_mask", &dispatch_mask.to_le_bytes())?;
+            elf.write_symbol("microkit_dispatch_order", &dispatch_order)?;
+        }
+        let mut receives = 0;
+        if receives_ppcs {
+            receives |= EVENT_LOOP_PPCS;
+        }
+        if pd.has_children || pd.virtual_machine.is_some() {
+            receives |= EVENT_LOOP_FAULTS;
+        }
+        if pd.poll {
+            receives |= EVENT_LOOP_POLL;
+        }
+        check_event_loop(elf, &pd.name, &pd.program_image, receives)?;
+
+        // Consumers find the message of a broadcast as the buffer of the channel they are notified on
+        let mut buffers: Vec<(u64, u64, u64)> = Channel::pd_buffers(channels, i)
+            .into_iter()
+            .map(|(id, vaddr, buffer)| (id, vaddr, buffer.size))
+            .collect();
+        buffers.extend(Broadcast::pd_consumer_buffers(broadcasts, i));
+        if !buffers.is_empty() {
+            let mut buffer_vaddrs = vec![0; MAX_CHANNELS * 8];
+            let mut buffer_sizes = vec![0; MAX_CHANNELS * 8];
+            for (id, vaddr, size) in buffers {
+                let idx = id as usize * 8;
+                buffer_vaddrs[idx..idx + 8].copy_from_slice(&vaddr.to_le_bytes());
+                buffer_sizes[idx..idx + 8].copy_from_slice(&size.to_le_bytes());
+            }
+            elf.write_symbol("microkit_channel_buffer_vaddrs", &buffer_vaddrs)?;
+            elf.write_symbol("microkit_channel_buffer_sizes", &buffer_sizes)?;
+        }
+
+        if template_bits != 0 {
+            elf.write_symbol("microkit_templates", &template_bits.to_le_bytes())?;
+        }
+
+        let produced: Vec<&Broadcast> = broadcasts.iter().filter(|b| b.producer == i).collect();
+        if !produced.is_empty() {
+            let mut broadcast_vaddrs = vec![0; MAX_BROADCASTS * 8];
+            let mut broadcast_sizes = vec![0; MAX_BROADCASTS * 8];
+            let mut broadcast_caps = vec![0; MAX_BROADCASTS * 8];
+            let mut broadcast_consumers = vec![0; MAX_BROADCASTS * 8];
+            for broadcast in produced {
+                let idx = broadcast.id as usize * 8;
+                let first_cap = BASE_BROADCAST_CAP + broadcast.first_cap;
+                let consumers = broadcast.consumers.len() as u64;
+                broadcast_vaddrs[idx..idx + 8].copy_from_slice(&broadcast.vaddr.to_le_bytes());
+                broadcast_sizes[idx..idx + 8].copy_from_slice(&broadcast.size.to_le_bytes());
+                broadcast_caps[idx..idx + 8].copy_from_slice(&first_cap.to_le_bytes());
+                broadcast_consumers[idx..idx + 8].copy_from_slice(&consumers.to_le_bytes());
+            }
+            elf.write_symbol("microkit_broadcast_vaddrs", &broadcast_vaddrs)?;
+            elf.write_symbol("microkit_broadcast_sizes", &broadcast_sizes)?;
+            elf.write_symbol("microkit_broadcast_caps", &broadcast_caps)?;
+            elf.write_symbol("microkit_broadcast_consumers", &broadcast_consumers)?;
+        }
+
         for (setvar_idx, setvar) in pd.setvars.iter().enumerate() {
             let value = pd_setvar_values[i][setvar_idx];
             let result = elf.write_symbol(&setvar.symbol, &value.to_le_bytes());
@@ -433,6 +885,25 @@ pub fn pd_write_symbols(
     Ok(())
 }
 
+/// Templates are patched before the system is built, since each copy of the
+/// program image is made by the monitor from the image in the invocation data.
+/// An instance only has channel 0, to its parent.
+pub fn template_write_symbols(
+    pds: &[ProtectionDomain],
+    template_elf_files: &mut [ElfFile],
+) -> Result<(), String> {
+    let templates = pds.iter().flat_map(|pd| pd.templates.iter());
+    for (template, elf) in zip(templates, template_elf_files) {
+        let name = template.name.as_bytes();
+        let name_length = min(name.len(), PD_MAX_NAME_LENGTH);
+        elf.write_symbol("microkit_name", &name[..name_length])?;
+        elf.write_symbol("microkit_notifications", &1_u64.to_le_bytes())?;
+        check_event_loop(elf, &template.name, &template.program_image, 0)?;
+    }
+
+    Ok(())
+}
+
 /// Determine the physical memory regions for an ELF file with a given
 /// alignment.
 ///
@@ -493,6 +964,51 @@ fn virt_mem_region_from_elf(elf: &ElfFile, alignment: u64) -> MemoryRegion {
     virt_mem_regions_from_elf(elf, alignment)[0]
 }
 
+/// Channel buffers and broadcast messages are placed when the system
+/// description is parsed, before the program images are known, below the
+/// stack and any other maps of the PD. Check that none of them ended up on top
+/// of the PD's program image.
+fn check_channel_buffers(
+    config: &Config,
+    system: &SystemDescription,
+    pd_elf_files: &[ElfFile],
+) -> Result<(), String> {
+    for (pd_idx, (pd, elf)) in zip(&system.protection_domains, pd_elf_files).enumerate() {
+        let mut buffers: Vec<(String, u64, u64)> = Channel::pd_buffers(&system.channels, pd_idx)
+            .into_iter()
+            .map(|(id, vaddr, buffer)| (format!("the buffer of channel {}", id), vaddr, buffer.size))
+            .collect();
+        for broadcast in &system.broadcasts {
+            if broadcast.producer == pd_idx {
+                buffers.push((format!("broadcast '{}'", broadcast.name), broadcast.vaddr, broadcast.size));
+            }
+            for consumer in broadcast.consumers.iter().filter(|c| c.pd == pd_idx) {
+                buffers.push((format!("broadcast '{}'", broadcast.name), consumer.vaddr, broadcast.size));
+            }
+        }
+
+        for (what, vaddr, size) in buffers {
+            let segment = virt_mem_regions_from_elf(elf, config.minimum_page_size)
+                .into_iter()
+                .find(|segment| segment.base < vaddr + size && segment.end > vaddr);
+            if let Some(segment) = segment {
+                return Err(format!(
+                    "{} in protection domain '{}' at [0x{:x}..0x{:x}) overlaps its program image '{}' at [0x{:x}..0x{:x})",
+                    what,
+                    pd.name,
+                    vaddr,
+                    vaddr + size,
+                    pd.program_image.display(),
+                    segment.base,
+                    segment.end
+                ));
+            }
+        }
+    }
+
+    Ok(())
+}
+
 fn get_full_path(path: &Path, search_paths: &Vec<PathBuf>) -> Option<PathBuf> {
     for search_path in search_paths {
         let full_path = search_path.join(path);
@@ -732,15 +1248,28 @@ fn emulate_kernel_boot(
     }
 }
 
+/// The program images that the system is built from.
+struct SystemElfs<'a> {
+    kernel: &'a ElfFile,
+    monitor: &'a ElfFile,
+    pds: &'a Vec<ElfFile>,
+    /// In the same order as the PDs the templates belong to
+    templates: &'a [ElfFile],
+}
+
 fn build_system(
     config: &Config,
-    pd_elf_files: &Vec<ElfFile>,
-    kernel_elf: &ElfFile,
-    monitor_elf: &ElfFile,
+    elfs: &SystemElfs,
     system: &SystemDescription,
+    boot_log: Option<&SysMemoryRegion>,
+    kernel_log: Option<&SysMemoryRegion>,
     invocation_table_size: u64,
     system_cnode_size: u64,
 ) -> Result<BuiltSystem, String> {
+    let kernel_elf = elfs.kernel;
+    let monitor_elf = elfs.monitor;
+    let pd_elf_files = elfs.pds;
+    let template_elf_files = elfs.templates;
     assert!(util::is_power_of_two(system_cnode_size));
     assert!(invocation_table_size % config.minimum_page_size == 0);
     assert!(invocation_table_size <= MAX_SYSTEM_INVOCATION_SIZE);
@@ -773,7 +1302,11 @@ fn build_system(
             pd_elf_size += r.size();
         }
     }
-    let reserved_size = invocation_table_size + pd_elf_size;
+    // With '--boot-log', the boot log is placed directly after the invocation table
+    // so that the loader can write to it before the kernel starts and the monitor
+    // can map it along with the table.
+    let boot_log_size = boot_log.map_or(0, |mr| mr.size);
+    let reserved_size = invocation_table_size + boot_log_size + pd_elf_size;
 
     // Now that the size is determined, find a free region in the physical memory
     // space.
@@ -805,6 +1338,12 @@ fn build_system(
     // all the ELF segments
     let invocation_table_region =
         MemoryRegion::new(reserved_base, reserved_base + invocation_table_size);
+    let boot_log_region = boot_log.map(|_| {
+        MemoryRegion::new(
+            invocation_table_region.end,
+            invocation_table_region.end + boot_log_size,
+        )
+    });
 
     // 1.3 With both the initial task region and reserved region determined the kernel
     // boot can be emulated. This provides the boot info information which is needed
@@ -1006,14 +1545,22 @@ fn build_system(
     // page size. It would be good in the future to use super pages (when
     // it makes sense to - this would reduce memory usage, and the number of
     // invocations required to set up the address space
-    let pages_required = invocation_table_size / config.minimum_page_size;
+    let table_pages = invocation_table_size / config.minimum_page_size;
+    let boot_log_pages = boot_log_size / config.minimum_page_size;
+    let pages_required = table_pages + boot_log_pages;
     let base_page_cap = 0;
-    for pta in base_page_cap..base_page_cap + pages_required {
+    for pta in base_page_cap..base_page_cap + table_pages {
         cap_address_names.insert(
             system_cap_address_mask | pta,
             "SmallPage: monitor invocation table".to_string(),
         );
     }
+    for pta in base_page_cap + table_pages..base_page_cap + pages_required {
+        cap_address_names.insert(
+            system_cap_address_mask | pta,
+            "SmallPage: boot log".to_string(),
+        );
+    }
 
     let mut remaining_pages = pages_required;
     let mut invocation_table_allocations = Vec::new();
@@ -1068,8 +1615,18 @@ fn build_system(
     // Before mapping it is necessary to install page tables that can cover the region.
     let large_page_size = ObjectType::LargePage.fixed_size(config).unwrap();
     let page_table_size = ObjectType::PageTable.fixed_size(config).unwrap();
+    // When there are templates, the page after the boot log is where the monitor
+    // maps the pages of an instance while it copies the program image to them.
+    let templates: Vec<(usize, &PdTemplate)> = system
+        .protection_domains
+        .iter()
+        .enumerate()
+        .flat_map(|(pd_idx, pd)| pd.templates.iter().map(move |template| (pd_idx, template)))
+        .collect();
+    assert!(templates.len() == template_elf_files.len());
+    let scratch_size = if templates.is_empty() { 0 } else { config.minimum_page_size };
     let page_tables_required =
-        util::round_up(invocation_table_size, large_page_size) / large_page_size;
+        util::round_up(invocation_table_size + boot_log_size + scratch_size, large_page_size) / large_page_size;
     let page_table_allocation = kao
         .alloc_n(page_table_size, page_tables_required)
         .unwrap_or_else(|| panic!("Internal error: failed to allocate page tables"));
@@ -1141,7 +1698,7 @@ fn build_system(
         },
     );
     map_invocation.repeat(
-        pages_required as u32,
+        table_pages as u32,
         InvocationArgs::PageMap {
             page: 1,
             vspace: 0,
@@ -1152,6 +1709,32 @@ fn build_system(
     );
     bootstrap_invocations.push(map_invocation);
 
+    // The boot log follows the table and is the only part the monitor writes to
+    let boot_log_vaddr = page_vaddr + invocation_table_size;
+    if boot_log_pages > 0 {
+        let mut map_invocation = Invocation::new(
+            config,
+            InvocationArgs::PageMap {
+                page: system_cap_address_mask | (base_page_cap + table_pages),
+                vspace: INIT_VSPACE_CAP_ADDRESS,
+                vaddr: boot_log_vaddr,
+                rights: Rights::Read as u64 | Rights::Write as u64,
+                attr: bootstrap_page_attr,
+            },
+        );
+        map_invocation.repeat(
+            boot_log_pages as u32,
+            InvocationArgs::PageMap {
+                page: 1,
+                vspace: 0,
+                vaddr: config.minimum_page_size,
+                rights: 0,
+                attr: 0,
+            },
+        );
+        bootstrap_invocations.push(map_invocation);
+    }
+
     // 3. Now we can start setting up the system based on the information
     // the user provided in the System Description Format.
     //
@@ -1169,7 +1752,7 @@ fn build_system(
     //     as needed by MRs
     //  Page table structs:
     //     as needed by protection domains based on mappings required
-    let mut phys_addr_next = reserved_base + invocation_table_size;
+    let mut phys_addr_next = reserved_base + invocation_table_size + boot_log_size;
     // Now we create additional MRs (and mappings) for the ELF files.
     let mut pd_elf_regions: Vec<Vec<Region>> = Vec::with_capacity(system.protection_domains.len());
     let mut extra_mrs = Vec::new();
@@ -1223,6 +1806,8 @@ fn build_system(
                 vaddr: base_vaddr,
                 perms,
                 cached: true,
+                offset: 0,
+                size: None,
                 text_pos: None,
             };
             if let Some(extra_maps) = pd_extra_maps.get_mut(pd) {
@@ -1237,7 +1822,7 @@ fn build_system(
         }
     }
 
-    assert!(phys_addr_next - (reserved_base + invocation_table_size) == pd_elf_size);
+    assert!(phys_addr_next - (reserved_base + invocation_table_size + boot_log_size) == pd_elf_size);
 
     // Here we create a memory region/mapping for the stack for each PD.
     // We allocate the stack at the highest possible virtual address that the
@@ -1259,6 +1844,8 @@ fn build_system(
             vaddr: config.pd_stack_bottom(pd.stack_size),
             perms: SysMapPerms::Read as u8 | SysMapPerms::Write as u8,
             cached: true,
+            offset: 0,
+            size: None,
             text_pos: None,
         };
 
@@ -1278,6 +1865,44 @@ fn build_system(
     let all_mr_by_name: HashMap<&str, &SysMemoryRegion> =
         all_mrs.iter().map(|mr| (mr.name.as_str(), *mr)).collect();
 
+    let mut template_images = Vec::new();
+    let template_layouts: Vec<TemplateLayout> = zip(&templates, template_elf_files)
+        .map(|((_, template), elf)| {
+            template_layout(config, elf, template, &all_mr_by_name, &mut template_images)
+        })
+        .collect();
+
+    // If any PDs are marked as 'early', the pages of MRs that are not used by
+    // any early PD are 'deferred'. They are allocated, minted and mapped only
+    // after the early PDs have been started, so that the early PDs do not have
+    // to wait for all of the system's memory to be set up.
+    let has_early_pds = system.protection_domains.iter().any(|pd| pd.early);
+    let mut early_mr_names: HashSet<&str> = HashSet::new();
+    for pd in system.protection_domains.iter().filter(|pd| pd.early) {
+        for map_set in [&pd.maps, &pd_extra_maps[pd]] {
+            for map in map_set {
+                early_mr_names.insert(map.mr.as_str());
+            }
+        }
+        if let Some(vm) = &pd.virtual_machine {
+            for map in &vm.maps {
+                early_mr_names.insert(map.mr.as_str());
+            }
+        }
+    }
+    // Fixed MRs are never deferred as their pages must be allocated in order of
+    // physical address. Nor is the kernel log, which the monitor gives to the
+    // kernel before any PD is started.
+    let is_boot_log = |mr: &SysMemoryRegion| boot_log.is_some_and(|log| log.name == mr.name);
+    let is_kernel_log = |mr: &SysMemoryRegion| kernel_log.is_some_and(|log| log.name == mr.name);
+    let mr_deferred = |mr: &SysMemoryRegion| {
+        has_early_pds
+            && mr.phys_addr.is_none()
+            && !is_boot_log(mr)
+            && !is_kernel_log(mr)
+            && !early_mr_names.contains(mr.name.as_str())
+    };
+
     let mut system_invocations: Vec<Invocation> = Vec::new();
     let mut init_system = InitSystem::new(
         config,
@@ -1293,38 +1918,54 @@ fn build_system(
     init_system.reserve(invocation_table_allocations);
     let mut mr_pages: HashMap<&SysMemoryRegion, Vec<Object>> = HashMap::new();
 
-    // 3.1 Work out how many fixed page objects are required
-
-    // First we need to find all the requested pages and sorted them
-    let mut fixed_pages = Vec::new();
-    for mr in &all_mrs {
-        if let Some(mut phys_addr) = mr.phys_addr {
-            mr_pages.insert(mr, vec![]);
-            for _ in 0..mr.page_count {
-                fixed_pages.push((phys_addr, mr));
-                phys_addr += mr.page_size_bytes();
-            }
-        }
+    // The pages of the boot log were created and mapped into the monitor by the
+    // bootstrap invocations, PDs that map it share those pages.
+    if let (Some(mr), Some(region)) = (boot_log, boot_log_region) {
+        let pages = (0..boot_log_pages)
+            .map(|idx| Object {
+                object_type: ObjectType::SmallPage,
+                cap_addr: system_cap_address_mask | (base_page_cap + table_pages + idx),
+                phys_addr: region.base + idx * config.minimum_page_size,
+                size: 0,
+            })
+            .collect();
+        mr_pages.insert(mr, pages);
     }
 
-    // Sort based on the starting physical address
-    fixed_pages.sort_by_key(|p| p.0);
+    // 3.1 Work out how many fixed page objects are required
+
+    // Fixed MRs cannot overlap, so the pages of each fixed MR form one physically
+    // contiguous run. Allocating the MRs in order of their starting physical address
+    // keeps the fixed allocations in order while letting all the pages of an MR that
+    // are in the same untyped be created by a single retype invocation.
+    let mut fixed_mrs: Vec<&SysMemoryRegion> = all_mrs
+        .iter()
+        .filter(|mr| mr.phys_addr.is_some())
+        .copied()
+        .collect();
+    fixed_mrs.sort_by_key(|mr| mr.phys_addr.unwrap());
 
-    // FIXME: At this point we can recombine them into
-    // groups to optimize allocation
-    for (phys_addr, mr) in fixed_pages {
+    for mr in fixed_mrs {
         let obj_type = match mr.page_size {
             PageSize::Small => ObjectType::SmallPage,
             PageSize::Large => ObjectType::LargePage,
         };
 
         let (page_size_human, page_size_label) = util::human_size_strict(mr.page_size as u64);
-        let name = format!(
-            "Page({} {}): MR={} @ {:x}",
-            page_size_human, page_size_label, mr.name, phys_addr
-        );
-        let page = init_system.allocate_fixed_object(phys_addr, obj_type, name);
-        mr_pages.get_mut(mr).unwrap().push(page);
+        let base_phys_addr = mr.phys_addr.unwrap();
+        let names = (0..mr.page_count)
+            .map(|idx| {
+                format!(
+                    "Page({} {}): MR={} @ {:x}",
+                    page_size_human,
+                    page_size_label,
+                    mr.name,
+                    base_phys_addr + idx * mr.page_size_bytes()
+                )
+            })
+            .collect();
+        let pages = init_system.allocate_fixed_objects(base_phys_addr, obj_type, names);
+        mr_pages.insert(mr, pages);
     }
 
     // 3.2 Work out how many regular (non-fixed) page objects are required
@@ -1341,7 +1982,7 @@ fn build_system(
     }
 
     for mr in &all_mrs {
-        if mr.phys_addr.is_some() {
+        if mr.phys_addr.is_some() || mr_deferred(mr) || is_boot_log(mr) {
             continue;
         }
 
@@ -1370,7 +2011,7 @@ fn build_system(
     let mut page_large_idx = 0;
 
     for mr in &all_mrs {
-        if mr.phys_addr.is_some() {
+        if mr.phys_addr.is_some() || mr_deferred(mr) || is_boot_log(mr) {
             continue;
         }
 
@@ -1438,11 +2079,31 @@ fn build_system(
         }
     }
     sched_context_names.extend(vm_sched_context_names);
-    let sched_context_objs = init_system.allocate_objects(
-        ObjectType::SchedContext,
-        sched_context_names,
-        Some(PD_SCHEDCONTEXT_SIZE),
-    );
+    let sched_context_sizes: Vec<u64> = system
+        .protection_domains
+        .iter()
+        .map(|pd| sched_context_size(pd.refills))
+        .chain(std::iter::repeat(PD_SCHEDCONTEXT_SIZE))
+        .take(sched_context_names.len())
+        .collect();
+    // Scheduling contexts with extra refills are larger, each size needs its
+    // own retype. Larger sizes are allocated first so that none need padding.
+    let mut sizes: Vec<u64> = sched_context_sizes.clone();
+    sizes.sort_by(|a, b| b.cmp(a));
+    sizes.dedup();
+    let mut sched_context_slots: Vec<Option<Object>> = vec![None; sched_context_names.len()];
+    for size in sizes {
+        let idxs: Vec<usize> = (0..sched_context_names.len())
+            .filter(|idx| sched_context_sizes[*idx] == size)
+            .collect();
+        let names = idxs.iter().map(|idx| sched_context_names[*idx].clone()).collect();
+        let objs = init_system.allocate_objects(ObjectType::SchedContext, names, Some(size));
+        for (idx, obj) in zip(idxs, objs) {
+            sched_context_slots[idx] = Some(obj);
+        }
+    }
+    let sched_context_objs: Vec<Object> =
+        sched_context_slots.into_iter().map(|obj| obj.unwrap()).collect();
     let sched_context_caps: Vec<u64> = sched_context_objs.iter().map(|sc| sc.cap_addr).collect();
 
     let pd_sched_context_objs = &sched_context_objs[..system.protection_domains.len()];
@@ -1529,7 +2190,7 @@ fn build_system(
             for map in map_set {
                 let mr = all_mr_by_name[map.mr.as_str()];
                 let mut vaddr = map.vaddr;
-                for _ in 0..mr.page_count {
+                for _ in map.pages(mr) {
                     vaddrs.push((vaddr, mr.page_size));
                     vaddr += mr.page_size_bytes();
                 }
@@ -1589,7 +2250,7 @@ fn build_system(
         for map in &vm.maps {
             let mr = all_mr_by_name[map.mr.as_str()];
             let mut vaddr = map.vaddr;
-            for _ in 0..mr.page_count {
+            for _ in map.pages(mr) {
                 vaddrs.push((vaddr, mr.page_size));
                 vaddr += mr.page_size_bytes();
             }
@@ -1712,8 +2373,62 @@ fn build_system(
 
     let vm_cnode_objs = &cnode_objs[system.protection_domains.len()..];
 
+    // Each instance of a template gets an untyped that is exactly big enough for
+    // its objects, so that the monitor can destroy the instance by revoking it and
+    // create it again from the same memory.
+    let mut template_untyped_objs = Vec::with_capacity(templates.len());
+    for ((pd_idx, template), layout) in zip(&templates, &template_layouts) {
+        let names = (0..template.instances)
+            .map(|idx| {
+                format!(
+                    "Untyped: PD={} TEMPLATE={} #{}",
+                    pd_names[*pd_idx], template.name, idx
+                )
+            })
+            .collect();
+        template_untyped_objs.push(init_system.allocate_objects(
+            ObjectType::Untyped,
+            names,
+            Some(layout.untyped_size(config)),
+        ));
+    }
+
+    // Pages for deferred MRs are allocated last so that their retypes are the
+    // last ones made from each untyped and can be moved to after the early PDs
+    // have been resumed without changing where any other object is placed.
+    let deferred_retypes_start = init_system.invocations.len();
+    for page_size in [PageSize::Large, PageSize::Small] {
+        let deferred_mrs: Vec<&SysMemoryRegion> = all_mrs
+            .iter()
+            .filter(|mr| mr.page_size == page_size && mr_deferred(mr))
+            .copied()
+            .collect();
+        let (page_size_human, page_size_label) = util::human_size_strict(page_size as u64);
+        let mut page_names = Vec::new();
+        for mr in &deferred_mrs {
+            for idx in 0..mr.page_count {
+                page_names.push(format!(
+                    "Page({} {}): MR={} #{}",
+                    page_size_human, page_size_label, mr.name, idx
+                ));
+            }
+        }
+        let object_type = match page_size {
+            PageSize::Small => ObjectType::SmallPage,
+            PageSize::Large => ObjectType::LargePage,
+        };
+        let page_objs = init_system.allocate_objects(object_type, page_names, None);
+        let mut idx = 0;
+        for mr in deferred_mrs {
+            mr_pages.insert(mr, page_objs[idx..idx + mr.page_count as usize].to_vec());
+            idx += mr.page_count as usize;
+        }
+    }
+
     let mut cap_slot = init_system.cap_slot;
     let kernel_objects = init_system.objects;
+    let deferred_retypes = system_invocations.split_off(deferred_retypes_start);
+    let mut deferred_invocations = Vec::new();
 
     // Create all the necessary interrupt handler objects. These aren't
     // created through retype though!
@@ -1765,7 +2480,7 @@ fn build_system(
             for extra_map in curr_pd_extra_maps {
                 let mr = all_mr_by_name[pd_map.mr.as_str()];
                 let base = pd_map.vaddr;
-                let end = base + mr.size;
+                let end = base + pd_map.size(mr);
                 let extra_mr = all_mr_by_name[extra_map.mr.as_str()];
                 let extra_map_base = extra_map.vaddr;
                 let extra_map_end = extra_map_base + extra_mr.size;
@@ -1802,33 +2517,12 @@ fn build_system(
     // Mint copies of required pages, while also determining what's required
     // for later mapping
     let mut pd_page_descriptors = Vec::new();
+    let mut deferred_pd_page_descriptors = Vec::new();
     for (pd_idx, pd) in system.protection_domains.iter().enumerate() {
         for map_set in [&pd.maps, &pd_extra_maps[pd]] {
             for mp in map_set {
                 let mr = all_mr_by_name[mp.mr.as_str()];
-                let mut rights: u64 = Rights::None as u64;
-                let mut attrs = match config.arch {
-                    Arch::Aarch64 => ArmVmAttributes::ParityEnabled as u64,
-                    Arch::Riscv64 => 0,
-                };
-                if mp.perms & SysMapPerms::Read as u8 != 0 {
-                    rights |= Rights::Read as u64;
-                }
-                if mp.perms & SysMapPerms::Write as u8 != 0 {
-                    rights |= Rights::Write as u64;
-                }
-                if mp.perms & SysMapPerms::Execute as u8 == 0 {
-                    match config.arch {
-                        Arch::Aarch64 => attrs |= ArmVmAttributes::ExecuteNever as u64,
-                        Arch::Riscv64 => attrs |= RiscvVmAttributes::ExecuteNever as u64,
-                    }
-                }
-                if mp.cached {
-                    match config.arch {
-                        Arch::Aarch64 => attrs |= ArmVmAttributes::Cacheable as u64,
-                        Arch::Riscv64 => {}
-                    }
-                }
+                let (rights, mut attrs) = map_rights_attrs(config, mp.perms, mp.cached);
 
                 /* Enable CHERI capability reads/writes by default. */
                 if config.cheri {
@@ -1838,8 +2532,9 @@ fn build_system(
                     }
                 }
 
-                assert!(!mr_pages[mr].is_empty());
-                assert!(util::objects_adjacent(&mr_pages[mr]));
+                let pages = &mr_pages[mr][mp.pages(mr)];
+                assert!(!pages.is_empty());
+                assert!(util::objects_adjacent(pages));
 
                 let mut invocation = Invocation::new(
                     config,
@@ -1848,14 +2543,14 @@ fn build_system(
                         dest_index: cap_slot,
                         dest_depth: system_cnode_bits,
                         src_root: root_cnode_cap,
-                        src_obj: mr_pages[mr][0].cap_addr,
+                        src_obj: pages[0].cap_addr,
                         src_depth: config.cap_address_bits,
                         rights,
                         badge: 0,
                     },
                 );
                 invocation.repeat(
-                    mr_pages[mr].len() as u32,
+                    pages.len() as u32,
                     InvocationArgs::CnodeMint {
                         cnode: 0,
                         dest_index: 1,
@@ -1867,65 +2562,50 @@ fn build_system(
                         badge: 0,
                     },
                 );
-                system_invocations.push(invocation);
-
-                pd_page_descriptors.push((
+                let page_descriptor = (
                     system_cap_address_mask | cap_slot,
                     pd_idx,
                     mp.vaddr,
                     rights,
                     attrs,
-                    mr_pages[mr].len() as u64,
+                    pages.len() as u64,
                     mr.page_size_bytes(),
-                ));
+                );
+                if mr_deferred(mr) {
+                    deferred_invocations.push(invocation);
+                    deferred_pd_page_descriptors.push(page_descriptor);
+                } else {
+                    system_invocations.push(invocation);
+                    pd_page_descriptors.push(page_descriptor);
+                }
 
-                for idx in 0..mr_pages[mr].len() {
+                for idx in 0..pages.len() {
                     cap_address_names.insert(
                         system_cap_address_mask | (cap_slot + idx as u64),
                         format!(
                             "{} (derived)",
                             cap_address_names
-                                .get(&(mr_pages[mr][0].cap_addr + idx as u64))
+                                .get(&(pages[0].cap_addr + idx as u64))
                                 .unwrap()
                         ),
                     );
                 }
 
-                cap_slot += mr_pages[mr].len() as u64;
+                cap_slot += pages.len() as u64;
             }
         }
     }
 
     let mut vm_page_descriptors = Vec::new();
+    let mut deferred_vm_page_descriptors = Vec::new();
     for (vm_idx, vm) in virtual_machines.iter().enumerate() {
         for mp in &vm.maps {
             let mr = all_mr_by_name[mp.mr.as_str()];
-            let mut rights: u64 = Rights::None as u64;
-            let mut attrs = match config.arch {
-                Arch::Aarch64 => ArmVmAttributes::ParityEnabled as u64,
-                Arch::Riscv64 => 0,
-            };
-            if mp.perms & SysMapPerms::Read as u8 != 0 {
-                rights |= Rights::Read as u64;
-            }
-            if mp.perms & SysMapPerms::Write as u8 != 0 {
-                rights |= Rights::Write as u64;
-            }
-            if mp.perms & SysMapPerms::Execute as u8 == 0 {
-                match config.arch {
-                    Arch::Aarch64 => attrs |= ArmVmAttributes::ExecuteNever as u64,
-                    Arch::Riscv64 => attrs |= RiscvVmAttributes::ExecuteNever as u64,
-                }
-            }
-            if mp.cached {
-                match config.arch {
-                    Arch::Aarch64 => attrs |= ArmVmAttributes::Cacheable as u64,
-                    Arch::Riscv64 => {}
-                }
-            }
+            let (rights, attrs) = map_rights_attrs(config, mp.perms, mp.cached);
 
-            assert!(!mr_pages[mr].is_empty());
-            assert!(util::objects_adjacent(&mr_pages[mr]));
+            let pages = &mr_pages[mr][mp.pages(mr)];
+            assert!(!pages.is_empty());
+            assert!(util::objects_adjacent(pages));
 
             let mut invocation = Invocation::new(
                 config,
@@ -1934,14 +2614,14 @@ fn build_system(
                     dest_index: cap_slot,
                     dest_depth: system_cnode_bits,
                     src_root: root_cnode_cap,
-                    src_obj: mr_pages[mr][0].cap_addr,
+                    src_obj: pages[0].cap_addr,
                     src_depth: config.cap_address_bits,
                     rights,
                     badge: 0,
                 },
             );
             invocation.repeat(
-                mr_pages[mr].len() as u32,
+                pages.len() as u32,
                 InvocationArgs::CnodeMint {
                     cnode: 0,
                     dest_index: 1,
@@ -1953,31 +2633,36 @@ fn build_system(
                     badge: 0,
                 },
             );
-            system_invocations.push(invocation);
-
-            vm_page_descriptors.push((
+            let page_descriptor = (
                 system_cap_address_mask | cap_slot,
                 vm_idx,
                 mp.vaddr,
                 rights,
                 attrs,
-                mr_pages[mr].len() as u64,
+                pages.len() as u64,
                 mr.page_size_bytes(),
-            ));
+            );
+            if mr_deferred(mr) {
+                deferred_invocations.push(invocation);
+                deferred_vm_page_descriptors.push(page_descriptor);
+            } else {
+                system_invocations.push(invocation);
+                vm_page_descriptors.push(page_descriptor);
+            }
 
-            for idx in 0..mr_pages[mr].len() {
+            for idx in 0..pages.len() {
                 cap_address_names.insert(
                     system_cap_address_mask | (cap_slot + idx as u64),
                     format!(
                         "{} (derived)",
                         cap_address_names
-                            .get(&(mr_pages[mr][0].cap_addr + idx as u64))
+                            .get(&(pages[0].cap_addr + idx as u64))
                             .unwrap()
                     ),
                 );
             }
 
-            cap_slot += mr_pages[mr].len() as u64;
+            cap_slot += pages.len() as u64;
         }
     }
 
@@ -2085,6 +2770,404 @@ fn build_system(
         }
     }
 
+    // Templates: the monitor creates and destroys instances at run time by
+    // following recipes of invocations made here. Each instance has slots for
+    // its objects, for copies of the pages it maps from MRs, and for its badged
+    // fault endpoint, which outlives the instance.
+    let scratch_vaddr = page_vaddr + invocation_table_size + boot_log_size;
+    let ipc_buffer_attr = match config.arch {
+        Arch::Aarch64 => ArmVmAttributes::default() | ArmVmAttributes::ExecuteNever as u64,
+        Arch::Riscv64 => RiscvVmAttributes::default() | RiscvVmAttributes::ExecuteNever as u64,
+    };
+    let mut template_instances: Vec<MonitorTemplateInstance64> = Vec::new();
+    let mut template_recipes: Vec<(Vec<RecipeStep>, Vec<RecipeStep>)> = Vec::new();
+    for (((pd_idx, template), layout), (elf, untyped_objs)) in zip(
+        zip(&templates, &template_layouts),
+        zip(template_elf_files, &template_untyped_objs),
+    ) {
+        let objects = layout.objects(config);
+        let object_slots: u64 = objects.iter().map(|(_, _, count)| count).sum();
+        for (idx, untyped_obj) in untyped_objs.iter().enumerate() {
+            let instance_name = format!("{}_{}", template.name, idx);
+            let channel = template.channel + idx as u64;
+            let fault_ep_slot = cap_slot;
+            let map_slot = fault_ep_slot + 1;
+            let mut slot = map_slot + layout.map_pages;
+            cap_slot = slot + object_slots;
+
+            let badge = TEMPLATE_INSTANCE_BADGE + template_instances.len() as u64;
+            system_invocations.push(Invocation::new(
+                config,
+                InvocationArgs::CnodeMint {
+                    cnode: system_cnode_cap,
+                    dest_index: fault_ep_slot,
+                    dest_depth: system_cnode_bits,
+                    src_root: root_cnode_cap,
+                    src_obj: fault_ep_endpoint_object.cap_addr,
+                    src_depth: config.cap_address_bits,
+                    rights: Rights::All as u64,
+                    badge,
+                },
+            ));
+            cap_address_names.insert(
+                system_cap_address_mask | fault_ep_slot,
+                format!("EP: Monitor Fault (badge=0x{:x})", badge),
+            );
+
+            let mut spawn = Vec::new();
+            let mut object_caps: HashMap<ObjectType, Vec<u64>> = HashMap::new();
+            for (object_type, size, count) in objects.iter().copied() {
+                let mut remaining = count;
+                while remaining > 0 {
+                    let num_objects = min(remaining, config.fan_out_limit);
+                    spawn.push(RecipeStep::Invocation(Invocation::new(
+                        config,
+                        InvocationArgs::UntypedRetype {
+                            untyped: untyped_obj.cap_addr,
+                            object_type,
+                            size_bits: size.map_or(0, |sz| sz.ilog2() as u64),
+                            root: root_cnode_cap,
+                            node_index: 1,
+                            node_depth: 1,
+                            node_offset: slot,
+                            num_objects,
+                        },
+                    )));
+                    remaining -= num_objects;
+                    slot += num_objects;
+                }
+                object_caps.insert(
+                    object_type,
+                    (slot - count..slot).map(|s| system_cap_address_mask | s).collect(),
+                );
+            }
+            let cnode = object_caps[&ObjectType::CNode][0];
+            let vspace = object_caps[&ObjectType::VSpace][0];
+            let tcb = object_caps[&ObjectType::Tcb][0];
+            let sched_context = object_caps[&ObjectType::SchedContext][0];
+            let notification = object_caps[&ObjectType::Notification][0];
+            let frames = &object_caps[&ObjectType::SmallPage];
+            let (elf_frames, frames) = frames.split_at(layout.elf_pages.len());
+            let (ipc_buffer_frame, stack_frames) = frames.split_first().unwrap();
+
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::AsidPoolAssign {
+                    asid_pool: INIT_ASID_POOL_CAP_ADDRESS,
+                    vspace,
+                },
+            )));
+            let page_table_caps = object_caps.get(&ObjectType::PageTable).map_or(&[][..], |caps| caps);
+            for (vaddr, page_table) in zip(&layout.page_tables, page_table_caps) {
+                spawn.push(RecipeStep::Invocation(Invocation::new(
+                    config,
+                    InvocationArgs::PageTableMap {
+                        page_table: *page_table,
+                        vspace,
+                        vaddr: *vaddr,
+                        attr: default_vm_attr(config),
+                    },
+                )));
+            }
+
+            // Copy in the program image through the monitor's scratch page
+            for ((_, perms, copy), frame) in zip(&layout.elf_pages, elf_frames) {
+                let Some((page_offset, size, offset)) = copy else {
+                    continue;
+                };
+                spawn.push(RecipeStep::Invocation(Invocation::new(
+                    config,
+                    InvocationArgs::PageMap {
+                        page: *frame,
+                        vspace: INIT_VSPACE_CAP_ADDRESS,
+                        vaddr: scratch_vaddr,
+                        rights: Rights::Read as u64 | Rights::Write as u64,
+                        attr: bootstrap_page_attr,
+                    },
+                )));
+                spawn.push(RecipeStep::Copy {
+                    offset: *offset,
+                    vaddr: scratch_vaddr + page_offset,
+                    size: *size,
+                });
+                // On RISC-V, the monitor synchronises the instruction cache itself
+                if perms & SysMapPerms::Execute as u8 != 0 && matches!(config.arch, Arch::Aarch64) {
+                    spawn.push(RecipeStep::Invocation(Invocation::new(
+                        config,
+                        InvocationArgs::PageUnifyInstruction {
+                            page: *frame,
+                            start: 0,
+                            end: config.minimum_page_size,
+                        },
+                    )));
+                }
+                spawn.push(RecipeStep::Invocation(Invocation::new(
+                    config,
+                    InvocationArgs::PageUnmap { page: *frame },
+                )));
+            }
+
+            let mut page_maps = Vec::new();
+            for ((vaddr, perms, _), frame) in zip(&layout.elf_pages, elf_frames) {
+                let (rights, attr) = map_rights_attrs(config, *perms, true);
+                page_maps.push((*frame, *vaddr, rights, attr));
+            }
+            page_maps.push((
+                *ipc_buffer_frame,
+                layout.ipc_buffer_vaddr,
+                Rights::Read as u64 | Rights::Write as u64,
+                ipc_buffer_attr,
+            ));
+            let (stack_rights, stack_attr) =
+                map_rights_attrs(config, SysMapPerms::Read as u8 | SysMapPerms::Write as u8, true);
+            for (page_idx, frame) in stack_frames.iter().enumerate() {
+                let vaddr = config.pd_stack_bottom(template.stack_size)
+                    + page_idx as u64 * config.minimum_page_size;
+                page_maps.push((*frame, vaddr, stack_rights, stack_attr));
+            }
+            for (page, vaddr, rights, attr) in page_maps {
+                spawn.push(RecipeStep::Invocation(Invocation::new(
+                    config,
+                    InvocationArgs::PageMap {
+                        page,
+                        vspace,
+                        vaddr,
+                        rights,
+                        attr,
+                    },
+                )));
+            }
+
+            let mut map_slot_next = map_slot;
+            for mp in &template.maps {
+                let mr = all_mr_by_name[mp.mr.as_str()];
+                let (rights, attr) = map_rights_attrs(config, mp.perms, mp.cached);
+                let pages = &mr_pages[mr][mp.pages(mr)];
+                assert!(util::objects_adjacent(pages));
+                let page_copy = system_cap_address_mask | map_slot_next;
+                let mut mint_invocation = Invocation::new(
+                    config,
+                    InvocationArgs::CnodeMint {
+                        cnode: system_cnode_cap,
+                        dest_index: map_slot_next,
+                        dest_depth: system_cnode_bits,
+                        src_root: root_cnode_cap,
+                        src_obj: pages[0].cap_addr,
+                        src_depth: config.cap_address_bits,
+                        rights,
+                        badge: 0,
+                    },
+                );
+                mint_invocation.repeat(
+                    pages.len() as u32,
+                    InvocationArgs::CnodeMint {
+                        cnode: 0,
+                        dest_index: 1,
+                        dest_depth: 0,
+                        src_root: 0,
+                        src_obj: 1,
+                        src_depth: 0,
+                        rights: 0,
+                        badge: 0,
+                    },
+                );
+                spawn.push(RecipeStep::Invocation(mint_invocation));
+                let mut map_invocation = Invocation::new(
+                    config,
+                    InvocationArgs::PageMap {
+                        page: page_copy,
+                        vspace,
+                        vaddr: mp.vaddr,
+                        rights,
+                        attr,
+                    },
+                );
+                map_invocation.repeat(
+                    pages.len() as u32,
+                    InvocationArgs::PageMap {
+                        page: 1,
+                        vspace: 0,
+                        vaddr: mr.page_size_bytes(),
+                        rights: 0,
+                        attr: 0,
+                    },
+                );
+                spawn.push(RecipeStep::Invocation(map_invocation));
+                map_slot_next += pages.len() as u64;
+            }
+            assert!(map_slot_next == map_slot + layout.map_pages);
+
+            // The instance's channel 0 is to its parent, which has it as 'channel'
+            for (dest_cnode, dest_index, src_obj, badge) in [
+                (cnode, INPUT_CAP_IDX, notification, 0),
+                (
+                    cnode,
+                    BASE_OUTPUT_NOTIFICATION_CAP,
+                    notification_objs[*pd_idx].cap_addr,
+                    1 << channel,
+                ),
+                (
+                    cnode_objs[*pd_idx].cap_addr,
+                    BASE_OUTPUT_NOTIFICATION_CAP + channel,
+                    notification,
+                    1,
+                ),
+            ] {
+                spawn.push(RecipeStep::Invocation(Invocation::new(
+                    config,
+                    InvocationArgs::CnodeMint {
+                        cnode: dest_cnode,
+                        dest_index,
+                        dest_depth: PD_CAP_BITS,
+                        src_root: root_cnode_cap,
+                        src_obj,
+                        src_depth: config.cap_address_bits,
+                        rights: Rights::All as u64,
+                        badge,
+                    },
+                )));
+            }
+
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::SchedControlConfigureFlags {
+                    sched_control: kernel_boot_info.sched_control_cap,
+                    sched_context,
+                    budget: template.budget,
+                    period: template.period,
+                    extra_refills: template.refills,
+                    badge: 0x100 + badge,
+                    flags: 0,
+                },
+            )));
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::TcbSetSchedParams {
+                    tcb,
+                    authority: INIT_TCB_CAP_ADDRESS,
+                    mcp: template.priority as u64,
+                    priority: template.priority as u64,
+                    sched_context,
+                    // This gets over-written by the call to TCB_SetSpace
+                    fault_ep: fault_ep_endpoint_object.cap_addr,
+                },
+            )));
+            if config.benchmark {
+                spawn.push(RecipeStep::Invocation(Invocation::new(
+                    config,
+                    InvocationArgs::CnodeCopy {
+                        cnode,
+                        dest_index: TCB_CAP_IDX,
+                        dest_depth: PD_CAP_BITS,
+                        src_root: root_cnode_cap,
+                        src_obj: tcb,
+                        src_depth: config.cap_address_bits,
+                        rights: Rights::All as u64,
+                    },
+                )));
+            }
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::TcbSetSpace {
+                    tcb,
+                    fault_ep: system_cap_address_mask | fault_ep_slot,
+                    cspace_root: cnode,
+                    cspace_root_data: config.cap_address_bits - PD_CAP_BITS,
+                    vspace_root: vspace,
+                    vspace_root_data: 0,
+                },
+            )));
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::TcbSetIpcBuffer {
+                    tcb,
+                    buffer: layout.ipc_buffer_vaddr,
+                    buffer_frame: *ipc_buffer_frame,
+                },
+            )));
+            let regs = match config.arch {
+                Arch::Aarch64 => Aarch64Regs {
+                    pc: elf.entry,
+                    sp: config.pd_stack_top(),
+                    ..Default::default()
+                }
+                .field_names(),
+                Arch::Riscv64 => Riscv64Regs {
+                    pc: elf.entry,
+                    sp: config.pd_stack_top(),
+                    ..Default::default()
+                }
+                .field_names(),
+            };
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::TcbWriteRegisters {
+                    tcb,
+                    resume: false,
+                    arch_flags: 0,
+                    count: regs.len() as u64,
+                    regs,
+                },
+            )));
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::TcbBindNotification { tcb, notification },
+            )));
+            spawn.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::TcbResume { tcb },
+            )));
+
+            // Unmapping the pages of MRs first means that the VSpace is not
+            // deleted while they are mapped in it.
+            let mut destroy = Vec::new();
+            if layout.map_pages > 0 {
+                let mut delete_invocation = Invocation::new(
+                    config,
+                    InvocationArgs::CnodeDelete {
+                        cnode: root_cnode_cap,
+                        index: system_cap_address_mask | map_slot,
+                        depth: config.cap_address_bits,
+                    },
+                );
+                delete_invocation.repeat(
+                    layout.map_pages as u32,
+                    InvocationArgs::CnodeDelete {
+                        cnode: 0,
+                        index: 1,
+                        depth: 0,
+                    },
+                );
+                destroy.push(RecipeStep::Invocation(delete_invocation));
+            }
+            destroy.push(RecipeStep::Invocation(Invocation::new(
+                config,
+                InvocationArgs::CnodeRevoke {
+                    cnode: root_cnode_cap,
+                    index: untyped_obj.cap_addr,
+                    depth: config.cap_address_bits,
+                },
+            )));
+
+            let mut name = [0; PD_MAX_NAME_LENGTH];
+            let name_length = min(instance_name.len(), PD_MAX_NAME_LENGTH - 1);
+            name[..name_length].copy_from_slice(&instance_name.as_bytes()[..name_length]);
+            template_instances.push(MonitorTemplateInstance64 {
+                // The badge of the parent's cap to the monitor
+                parent: *pd_idx as u64 + 1,
+                template: template.id,
+                channel,
+                tcb,
+                spawn_offset: 0,
+                spawn_count: spawn.len() as u64,
+                destroy_offset: 0,
+                destroy_count: destroy.len() as u64,
+                name,
+            });
+            template_recipes.push((spawn, destroy));
+        }
+    }
+
     let final_cap_slot = cap_slot;
 
     // Minting in the address space
@@ -2328,9 +3411,32 @@ fn build_system(
         }
     }
 
-    // Mint a cap between monitor and passive PDs.
+    // The producer of a broadcast gets a cap to each consumer's notification,
+    // in consecutive slots so that it can signal them all in a loop.
+    assert!(BASE_BROADCAST_CAP + MAX_BROADCAST_CONSUMERS as u64 <= PD_CAP_SIZE);
+    for broadcast in &system.broadcasts {
+        let producer_pd = &system.protection_domains[broadcast.producer];
+        let producer_cnode_obj = cnode_objs_by_pd[producer_pd];
+        for (i, consumer) in broadcast.consumers.iter().enumerate() {
+            system_invocations.push(Invocation::new(
+                config,
+                InvocationArgs::CnodeMint {
+                    cnode: producer_cnode_obj.cap_addr,
+                    dest_index: BASE_BROADCAST_CAP + broadcast.first_cap + i as u64,
+                    dest_depth: PD_CAP_BITS,
+                    src_root: root_cnode_cap,
+                    src_obj: notification_objs[consumer.pd].cap_addr,
+                    src_depth: config.cap_address_bits,
+                    rights: Rights::All as u64, // FIXME: Check rights
+                    badge: 1 << consumer.id,
+                },
+            ));
+        }
+    }
+
+    // Mint a cap between monitor and passive PDs, and PDs with templates.
     for (pd_idx, pd) in system.protection_domains.iter().enumerate() {
-        if pd.passive {
+        if pd.passive || !pd.templates.is_empty() {
             let cnode_obj = &cnode_objs[pd_idx];
             system_invocations.push(Invocation::new(
                 config,
@@ -2433,58 +3539,64 @@ fn build_system(
     }
 
     // Now map all the pages
-    for (page_cap_address, pd_idx, vaddr, rights, attr, count, vaddr_incr) in &pd_page_descriptors {
-        let mut invocation = Invocation::new(
-            config,
-            InvocationArgs::PageMap {
-                page: *page_cap_address,
-                vspace: pd_vspace_objs[*pd_idx].cap_addr,
-                vaddr: *vaddr,
-                rights: *rights,
-                attr: *attr,
-            },
-        );
-        invocation.repeat(
-            *count as u32,
-            InvocationArgs::PageMap {
-                page: 1,
-                vspace: 0,
-                vaddr: *vaddr_incr,
-                rights: 0,
-                attr: 0,
-            },
-        );
-        system_invocations.push(invocation);
+    for (page_descriptors, invocations) in [
+        (&pd_page_descriptors, &mut system_invocations),
+        (&deferred_pd_page_descriptors, &mut deferred_invocations),
+    ] {
+        for (page_cap_address, pd_idx, vaddr, rights, attr, count, vaddr_incr) in page_descriptors {
+            let mut invocation = Invocation::new(
+                config,
+                InvocationArgs::PageMap {
+                    page: *page_cap_address,
+                    vspace: pd_vspace_objs[*pd_idx].cap_addr,
+                    vaddr: *vaddr,
+                    rights: *rights,
+                    attr: *attr,
+                },
+            );
+            invocation.repeat(
+                *count as u32,
+                InvocationArgs::PageMap {
+                    page: 1,
+                    vspace: 0,
+                    vaddr: *vaddr_incr,
+                    rights: 0,
+                    attr: 0,
+                },
+            );
+            invocations.push(invocation);
+        }
     }
-    for (page_cap_address, vm_idx, vaddr, rights, attr, count, vaddr_incr) in &vm_page_descriptors {
-        let mut invocation = Invocation::new(
-            config,
-            InvocationArgs::PageMap {
-                page: *page_cap_address,
-                vspace: vm_vspace_objs[*vm_idx].cap_addr,
-                vaddr: *vaddr,
-                rights: *rights,
-                attr: *attr,
-            },
-        );
-        invocation.repeat(
-            *count as u32,
-            InvocationArgs::PageMap {
-                page: 1,
-                vspace: 0,
-                vaddr: *vaddr_incr,
-                rights: 0,
-                attr: 0,
-            },
-        );
-        system_invocations.push(invocation);
+    for (page_descriptors, invocations) in [
+        (&vm_page_descriptors, &mut system_invocations),
+        (&deferred_vm_page_descriptors, &mut deferred_invocations),
+    ] {
+        for (page_cap_address, vm_idx, vaddr, rights, attr, count, vaddr_incr) in page_descriptors {
+            let mut invocation = Invocation::new(
+                config,
+                InvocationArgs::PageMap {
+                    page: *page_cap_address,
+                    vspace: vm_vspace_objs[*vm_idx].cap_addr,
+                    vaddr: *vaddr,
+                    rights: *rights,
+                    attr: *attr,
+                },
+            );
+            invocation.repeat(
+                *count as u32,
+                InvocationArgs::PageMap {
+                    page: 1,
+                    vspace: 0,
+                    vaddr: *vaddr_incr,
+                    rights: 0,
+                    attr: 0,
+                },
+            );
+            invocations.push(invocation);
+        }
     }
 
     // And, finally, map all the IPC buffers
-    let ipc_buffer_attr = match config.arch {
-        Arch::Aarch64 => ArmVmAttributes::default() | ArmVmAttributes::ExecuteNever as u64,
-        Arch::Riscv64 => RiscvVmAttributes::default() | RiscvVmAttributes::ExecuteNever as u64,
-    };
     for pd_idx in 0..system.protection_domains.len() {
         let (vaddr, _) = pd_elf_files[pd_idx]
             .find_symbol(SYMBOL_IPC_BUFFER)
@@ -2530,7 +3642,7 @@ fn build_system(
                 sched_context: pd_sched_context_objs[pd_idx].cap_addr,
                 budget: pd.budget,
                 period: pd.period,
-                extra_refills: 0,
+                extra_refills: pd.refills,
                 badge: 0x100 + pd_idx as u64,
                 flags: 0,
             },
@@ -2689,14 +3801,15 @@ fn build_system(
             pd.setvars
                 .iter()
                 .map(|setvar| match &setvar.kind {
-                    sdf::SysSetVarKind::Size { mr } => {
+                    sdf::SysSetVarKind::Size { mr, offset, size } => size.unwrap_or(
                         system
                             .memory_regions
                             .iter()
                             .find(|m| m.name == *mr)
                             .unwrap()
                             .size
-                    }
+                            - offset,
+                    ),
                     sdf::SysSetVarKind::Vaddr { address, .. } => *address,
                     sdf::SysSetVarKind::Paddr { region } => {
                         let mr = system
@@ -2761,9 +3874,9 @@ fn build_system(
                 let value = pd_setvar_values[pd_idx][setvar_idx];
 
                 /* Get the associated memory mapped region's name for this setvar */
-                let mr_name = match &setvar.kind {
-                    sdf::SysSetVarKind::Vaddr { address:_ , mr } => mr.clone(),
-                    _ => "".to_string()
+                let (mr_name, address) = match &setvar.kind {
+                    sdf::SysSetVarKind::Vaddr { address, mr } => (mr.clone(), *address),
+                    _ => ("".to_string(), 0)
                 };
 
                 /* Search for the actual memory region by name */
@@ -2772,14 +3885,17 @@ fn build_system(
                         .iter()
                         .find(|m| m.name == mr_name);
 
-                let size = mr.map(|region| region.size).unwrap_or(0);
-
-                /* Search for the memory mapped permissions for this setvar */
+                /* Search for the mapping of this setvar, the MR may be mapped more than once */
                 let mmapped = &pd.maps
                     .iter()
-                    .find(|m| m.mr == mr_name);
+                    .find(|m| m.mr == mr_name && m.vaddr == address);
                 let perms = mmapped.map(|region| region.perms).unwrap_or(0);
 
+                let size = match (mr, mmapped) {
+                    (Some(region), Some(map)) => map.size(region),
+                    _ => 0,
+                };
+
                 /* Generate an invocation to write a CHERI cap to this setvar_vaddr */
                 cheri::cheri_arch_write_sym_cap(
                     config,
@@ -2795,6 +3911,21 @@ fn build_system(
                     perms
                 );
             }
+
+            let cheri_pd = cheri::CheriPd {
+                elf: &pd_elf_files[pd_idx],
+                idx: pd_idx,
+                tcb_cptr: tcb_objs[pd_idx].cap_addr,
+                vspace_cptr: vspace_objs[pd_idx].cap_addr,
+                page_descriptors: &pd_page_descriptors,
+            };
+            cheri::cheri_arch_write_channel_buffer_caps(
+                config,
+                &mut system_invocations,
+                &cheri_pd,
+                &system.channels,
+                &system.broadcasts,
+            );
         }
     }
     // AArch64 and RISC-V expect the stack pointer to be 16-byte aligned
@@ -2841,17 +3972,73 @@ fn build_system(
     }
 
     // Resume (start) all the threads that belong to PDs (VMs are not started upon system init)
-    let mut resume_invocation = Invocation::new(
-        config,
-        InvocationArgs::TcbResume {
-            tcb: tcb_objs[0].cap_addr,
-        },
-    );
-    resume_invocation.repeat(
-        system.protection_domains.len() as u32,
-        InvocationArgs::TcbResume { tcb: 1 },
-    );
-    system_invocations.push(resume_invocation);
+    let kernel_log_invocation = system_invocations.len() as u64;
+    if has_early_pds {
+        // Early PDs are started first. The monitor then drops below their priority
+        // so that it only sets up the deferred MRs when the early PDs are not busy.
+        for (pd_idx, _) in system.protection_domains.iter().enumerate().filter(|(_, pd)| pd.early) {
+            system_invocations.push(Invocation::new(
+                config,
+                InvocationArgs::TcbResume {
+                    tcb: tcb_objs[pd_idx].cap_addr,
+                },
+            ));
+        }
+        let min_early_priority = system
+            .protection_domains
+            .iter()
+            .filter(|pd| pd.early)
+            .map(|pd| pd.priority)
+            .min()
+            .unwrap();
+        system_invocations.push(Invocation::new(
+            config,
+            InvocationArgs::TcbSetPriority {
+                tcb: INIT_TCB_CAP_ADDRESS,
+                authority: INIT_TCB_CAP_ADDRESS,
+                priority: min_early_priority.saturating_sub(1) as u64,
+            },
+        ));
+
+        system_invocations.extend(deferred_retypes);
+        system_invocations.extend(deferred_invocations);
+
+        // The monitor goes back to its original priority before starting the
+        // remaining PDs. Otherwise a passive PD above the lowered priority would
+        // run as soon as it is resumed, and its request to the monitor to become
+        // passive would be dropped since the monitor is not yet waiting for it.
+        system_invocations.push(Invocation::new(
+            config,
+            InvocationArgs::TcbSetPriority {
+                tcb: INIT_TCB_CAP_ADDRESS,
+                authority: INIT_TCB_CAP_ADDRESS,
+                priority: MONITOR_PRIORITY,
+            },
+        ));
+
+        for (pd_idx, _) in system.protection_domains.iter().enumerate().filter(|(_, pd)| !pd.early) {
+            system_invocations.push(Invocation::new(
+                config,
+                InvocationArgs::TcbResume {
+                    tcb: tcb_objs[pd_idx].cap_addr,
+                },
+            ));
+        }
+    } else {
+        assert!(deferred_retypes.is_empty() && deferred_invocations.is_empty());
+
+        let mut resume_invocation = Invocation::new(
+            config,
+            InvocationArgs::TcbResume {
+                tcb: tcb_objs[0].cap_addr,
+            },
+        );
+        resume_invocation.repeat(
+            system.protection_domains.len() as u32,
+            InvocationArgs::TcbResume { tcb: 1 },
+        );
+        system_invocations.push(resume_invocation);
+    }
 
     // All of the objects are created at this point; we don't need both
     // the allocators from here.
@@ -2863,6 +4050,25 @@ fn build_system(
         system_invocation.add_raw_invocation(config, &mut system_invocation_data);
     }
 
+    // The program images of templates and then the recipes for their instances
+    // follow the system invocations.
+    let images_offset = system_invocation_data.len() as u64;
+    system_invocation_data.extend(&template_images);
+    for (instance, (spawn, destroy)) in zip(&mut template_instances, &template_recipes) {
+        instance.spawn_offset = system_invocation_data.len() as u64 / 8;
+        for step in spawn {
+            step.add_raw(config, images_offset, &mut system_invocation_data);
+        }
+        instance.destroy_offset = system_invocation_data.len() as u64 / 8;
+        for step in destroy {
+            step.add_raw(config, images_offset, &mut system_invocation_data);
+        }
+    }
+
+    // The monitor hands the first (and only) page of the kernel log region to the
+    // kernel just before the first PD is resumed, so every PD's entries are logged.
+    let kernel_log_cap = kernel_log.map_or(0, |mr| mr_pages[mr][0].cap_addr);
+
     Ok(BuiltSystem {
         number_of_system_caps: final_cap_slot,
         invocation_data_size: system_invocation_data.len() as u64,
@@ -2871,6 +4077,10 @@ fn build_system(
         system_invocations,
         kernel_boot_info,
         reserved_region,
+        boot_log_region,
+        boot_log_vaddr,
+        kernel_log_cap,
+        kernel_log_invocation,
         fault_ep_cap_address: fault_ep_endpoint_object.cap_addr,
         reply_cap_address: reply_obj.cap_addr,
         cap_lookup: cap_address_names,
@@ -2884,6 +4094,10 @@ fn build_system(
         kernel_objects,
         initial_task_phys_region,
         initial_task_virt_region,
+        untyped_total: kao.init_capacity,
+        untyped_free: kao.capacity(),
+        untyped_max_alloc: kao.max_alloc_size(),
+        template_instances,
     })
 }
 
@@ -2892,6 +4106,7 @@ fn write_report<W: std::io::Write>(
     config: &Config,
     built_system: &BuiltSystem,
     bootstrap_invocation_data: &[u8],
+    loader_regions: &[LoaderRegionInfo],
 ) -> std::io::Result<()> {
     writeln!(buf, "# Kernel Boot Info\n")?;
 
@@ -2921,6 +4136,35 @@ fn write_report<W: std::io::Write>(
             writeln!(buf, "       {}", region)?;
         }
     }
+    writeln!(buf, "\n# Loader Image Regions\n")?;
+    for region in loader_regions {
+        let compression = if region.in_place {
+            "in-place".to_string()
+        } else if region.compressed {
+            format!(
+                "compressed {:>12} ({:.1}%)",
+                comma_sep_u64(region.stored_size),
+                100.0 * region.stored_size as f64 / region.size as f64
+            )
+        } else {
+            "uncompressed".to_string()
+        };
+        writeln!(
+            buf,
+            "       addr=0x{:x} size={:>12} {}",
+            region.load_addr,
+            comma_sep_u64(region.size),
+            compression
+        )?;
+    }
+    let total_size: u64 = loader_regions.iter().map(|r| r.size).sum();
+    let total_stored: u64 = loader_regions.iter().map(|r| r.stored_size).sum();
+    writeln!(
+        buf,
+        "       total size: {} stored: {}",
+        comma_sep_u64(total_size),
+        comma_sep_u64(total_stored)
+    )?;
     writeln!(buf, "\n# Monitor (Initial Task) Info\n")?;
     writeln!(
         buf,
@@ -2932,6 +4176,9 @@ fn write_report<W: std::io::Write>(
         "     physical memory: {}",
         built_system.initial_task_phys_region
     )?;
+    if let Some(region) = built_system.boot_log_region {
+        writeln!(buf, "     boot log       : {}", region)?;
+    }
     writeln!(buf, "\n# Allocated Kernel Objects Summary\n")?;
     writeln!(
         buf,
@@ -2987,8 +4234,68 @@ fn write_report<W: std::io::Write>(
     Ok(())
 }
 
+/// Summarise the resources used by the built system. 'image_part_names' names
+/// what each region of the loader image holds.
+fn build_stats(
+    config: &Config,
+    built_system: &BuiltSystem,
+    loader_regions: &[LoaderRegionInfo],
+    image_part_names: &[String],
+    image_size: u64,
+) -> BuildStats {
+    let mut stats = BuildStats {
+        image_size,
+        untyped_total: built_system.untyped_total,
+        untyped_free: built_system.untyped_free,
+        untyped_max_alloc: built_system.untyped_max_alloc,
+        ..Default::default()
+    };
+
+    for ko in &built_system.kernel_objects {
+        let objs = stats
+            .kernel_objects
+            .entry(ko.object_type.to_str().to_string())
+            .or_default();
+        objs.count += 1;
+        objs.bytes += ko.size;
+
+        match ko.object_type {
+            ObjectType::SmallPage | ObjectType::LargePage | ObjectType::HugePage => {}
+            _ => stats.kernel_memory += ko.size,
+        }
+
+        // Paging structures are named after the PD or VM that they belong to
+        if ko.object_type == ObjectType::PageTable {
+            let name = &built_system.cap_lookup[&ko.cap_addr];
+            if let Some(owner) = name
+                .strip_prefix("PageTable: ")
+                .and_then(|s| s.split(' ').next())
+            {
+                *stats.page_tables.entry(owner.to_string()).or_default() += 1;
+            }
+        }
+    }
+
+    for invocation in &built_system.system_invocations {
+        let mut data = Vec::new();
+        invocation.add_raw_invocation(config, &mut data);
+        let invocations: &mut CountAndBytes = stats.invocations.entry(invocation.label_name()).or_default();
+        invocations.count += invocation.count();
+        invocations.bytes += data.len() as u64;
+    }
+
+    for (region, name) in zip(loader_regions, image_part_names) {
+        let part: &mut ImagePart = stats.image_parts.entry(name.clone()).or_default();
+        part.size += region.size;
+        part.stored_size += region.stored_size;
+    }
+
+    stats
+}
+
 fn print_usage() {
-    println!("usage: microkit [-h] [-o OUTPUT] [-r REPORT] --board BOARD --config CONFIG [--search-path [SEARCH_PATH ...]] system")
+    println!("usage: microkit [-h] [-o OUTPUT] [-r REPORT] [--stats STATS] [--boot-log MR] [--kernel-log MR] [--timings] [--timings-trace TRACE] [--compress] [--in-place] [--host] --board BOARD --config CONFIG [--search-path [SEARCH_PATH ...]] system");
+    println!("       microkit diff OLD_STATS NEW_STATS")
 }
 
 fn print_help(available_boards: &[String]) {
@@ -2999,9 +4306,18 @@ fn print_help(available_boards: &[String]) {
     println!("  -h, --help, show this help message and exit");
     println!("  -o, --output OUTPUT");
     println!("  -r, --report REPORT");
+    println!("  --stats STATS, write a summary of the resources used by the system, for 'microkit diff'");
+    println!("  --boot-log MR, keep the loader and monitor output in memory region MR rather than printing it");
+    println!("  --kernel-log MR, have the kernel log its benchmark events to memory region MR");
+    println!("  --timings, print the time and memory taken by each phase of the build");
+    println!("  --timings-trace TRACE, also write the phases as a Chrome trace");
+    println!("  --compress, compress the regions of the loader image");
+    println!("  --in-place, place regions of the loader image at their load address where possible");
+    println!("  --host, run the system on this machine rather than building an image");
     println!("  --board {}", available_boards.join("\n          "));
     println!("  --config CONFIG");
     println!("  --search-path [SEARCH_PATH ...]");
+    println!("\nmicrokit diff compares the summaries written with --stats by two builds.");
 }
 
 struct Args<'a> {
@@ -3009,7 +4325,15 @@ struct Args<'a> {
     board: &'a str,
     config: &'a str,
     report: &'a str,
+    stats: Option<&'a str>,
+    boot_log: Option<&'a str>,
+    kernel_log: Option<&'a str>,
+    timings: bool,
+    timings_trace: Option<&'a str>,
     output: &'a str,
+    compress: bool,
+    in_place: bool,
+    host: bool,
     search_paths: Vec<&'a String>,
 }
 
@@ -3018,6 +4342,14 @@ impl<'a> Args<'a> {
         // Default arguments
         let mut output = "loader.img";
         let mut report = "report.txt";
+        let mut stats = None;
+        let mut boot_log = None;
+        let mut kernel_log = None;
+        let mut timings = false;
+        let mut timings_trace = None;
+        let mut compress = false;
+        let mut in_place = false;
+        let mut host = false;
         let mut search_paths = Vec::new();
         // Arguments expected to be provided by the user
         let mut system = None;
@@ -3058,6 +4390,62 @@ impl<'a> Args<'a> {
                         std::process::exit(1);
                     }
                 }
+                "--stats" => {
+                    in_search_path = false;
+                    if i < args.len() - 1 {
+                        stats = Some(args[i + 1].as_str());
+                        i += 1;
+                    } else {
+                        eprintln!("microkit: error: argument --stats: expected one argument");
+                        std::process::exit(1);
+                    }
+                }
+                "--boot-log" => {
+                    in_search_path = false;
+                    if i < args.len() - 1 {
+                        boot_log = Some(args[i + 1].as_str());
+                        i += 1;
+                    } else {
+                        eprintln!("microkit: error: argument --boot-log: expected one argument");
+                        std::process::exit(1);
+                    }
+                }
+                "--kernel-log" => {
+                    in_search_path = false;
+                    if i < args.len() - 1 {
+                        kernel_log = Some(args[i + 1].as_str());
+                        i += 1;
+                    } else {
+                        eprintln!("microkit: error: argument --kernel-log: expected one argument");
+                        std::process::exit(1);
+                    }
+                }
+                "--timings" => {
+                    in_search_path = false;
+                    timings = true;
+                }
+                "--timings-trace" => {
+                    in_search_path = false;
+                    if i < args.len() - 1 {
+                        timings_trace = Some(args[i + 1].as_str());
+                        i += 1;
+                    } else {
+                        eprintln!("microkit: error: argument --timings-trace: expected one argument");
+                        std::process::exit(1);
+                    }
+                }
+                "--compress" => {
+                    in_search_path = false;
+                    compress = true;
+                }
+                "--in-place" => {
+                    in_search_path = false;
+                    in_place = true;
+                }
+                "--host" => {
+                    in_search_path = false;
+                    host = true;
+                }
                 "--board" => {
                     in_search_path = false;
                     if i < args.len() - 1 {
@@ -3107,10 +4495,11 @@ impl<'a> Args<'a> {
         }
 
         let mut missing_args = Vec::new();
-        if board.is_none() {
+        // Running on the host does not involve a board or kernel configuration
+        if board.is_none() && !host {
             missing_args.push("--board");
         }
-        if config.is_none() {
+        if config.is_none() && !host {
             missing_args.push("--config");
         }
         if system.is_none() {
@@ -3128,16 +4517,98 @@ impl<'a> Args<'a> {
 
         Args {
             system: system.unwrap(),
-            board: board.unwrap(),
-            config: config.unwrap(),
+            board: board.map_or("", |b| b.as_str()),
+            config: config.map_or("", |c| c.as_str()),
             report,
+            stats,
+            boot_log,
+            kernel_log,
+            timings,
+            timings_trace,
             output,
+            compress,
+            in_place,
+            host,
             search_paths,
         }
     }
 }
 
+fn read_stats(path: &str) -> Result<BuildStats, String> {
+    let data = fs::read_to_string(path)
+        .map_err(|e| format!("Could not read stats file '{}': {}", path, e))?;
+    serde_json::from_str(&data).map_err(|e| format!("Could not parse stats file '{}': {}", path, e))
+}
+
+/// 'microkit diff OLD_STATS NEW_STATS': print what changed between two builds.
+fn run_diff(args: &[String]) -> Result<(), String> {
+    if args.len() != 2 {
+        print_usage();
+        eprintln!("microkit: error: diff expects two arguments: OLD_STATS NEW_STATS");
+        std::process::exit(1);
+    }
+
+    let old = read_stats(&args[0])?;
+    let new = read_stats(&args[1])?;
+    let lines = BuildStats::diff(&old, &new);
+    if lines.is_empty() {
+        println!("No differences");
+    }
+    for line in lines {
+        println!("{}", line);
+    }
+
+    Ok(())
+}
+
+/// Run the system natively on this machine, see host.rs.
+fn run_host(args: &Args) -> Result<(), String> {
+    let system_path = Path::new(args.system);
+    if !system_path.exists() {
+        eprintln!(
+            "Error: system description file '{}' does not exist",
+            system_path.display()
+        );
+        std::process::exit(1);
+    }
+
+    let xml: String = fs::read_to_string(args.system).unwrap();
+    let system = match parse(args.system, &xml, &host::config()) {
+        Ok(system) => system,
+        Err(err) => {
+            eprintln!("{err}");
+            std::process::exit(1);
+        }
+    };
+
+    let mut search_paths = vec![std::env::current_dir().unwrap()];
+    for path in &args.search_paths {
+        search_paths.push(PathBuf::from(path));
+    }
+
+    let mut program_paths = Vec::with_capacity(system.protection_domains.len());
+    for pd in &system.protection_domains {
+        match get_full_path(&pd.program_image, &search_paths) {
+            Some(path) => program_paths.push(path),
+            None => {
+                return Err(format!(
+                    "unable to find program image: '{}'",
+                    pd.program_image.display()
+                ))
+            }
+        }
+    }
+
+    host::run(system, &program_paths)
+}
+
 fn main() -> Result<(), String> {
+    let env_args: Vec<_> = std::env::args().collect();
+    // Comparing two builds does not involve the SDK
+    if env_args.get(1).map(String::as_str) == Some("diff") {
+        return run_diff(&env_args[2..]);
+    }
+
     let exe_path = std::env::current_exe().unwrap();
     let sdk_env = std::env::var("MICROKIT_SDK");
     let sdk_dir = match sdk_env {
@@ -3181,9 +4652,12 @@ fn main() -> Result<(), String> {
     }
     available_boards.sort();
 
-    let env_args: Vec<_> = std::env::args().collect();
     let args = Args::parse(&env_args, &available_boards);
 
+    if args.host {
+        return run_host(&args);
+    }
+
     let board_path = boards_path.join(args.board);
     if !board_path.exists() {
         eprintln!(
@@ -3301,6 +4775,8 @@ fn main() -> Result<(), String> {
         std::process::exit(1);
     }
 
+    let mut timings = Timings::new(args.timings || args.timings_trace.is_some());
+
     let xml: String = fs::read_to_string(args.system).unwrap();
 
     let kernel_config_json: serde_json::Value =
@@ -3347,6 +4823,11 @@ fn main() -> Result<(), String> {
         Arch::Riscv64 => 1 << 21,
     };
 
+    // Only kernels that track kernel entries or tracepoints have a log buffer,
+    // other kernels do not necessarily define the option at all.
+    let kernel_log_buffer =
+        json_str_as_bool(&kernel_config_json, "KERNEL_LOG_BUFFER").unwrap_or(false);
+
     let kernel_config = Config {
         arch,
         word_size: json_str_as_u64(&kernel_config_json, "WORD_SIZE")?,
@@ -3358,7 +4839,7 @@ fn main() -> Result<(), String> {
         fan_out_limit: json_str_as_u64(&kernel_config_json, "RETYPE_FAN_OUT_LIMIT")?,
         cheri: json_str_as_bool(&kernel_config_json, "HAVE_CHERI")?,
         hypervisor,
-        benchmark: args.config == "benchmark",
+        benchmark: args.config == "benchmark" || kernel_log_buffer,
         fpu: json_str_as_bool(&kernel_config_json, "HAVE_FPU")?,
         arm_pa_size_bits,
         arm_smc,
@@ -3380,6 +4861,7 @@ fn main() -> Result<(), String> {
         "Microkit tool has various assumptions about the word size being 64-bits."
     );
 
+    let phase = timings.start("SDF parse");
     let system = match parse(args.system, &xml, &kernel_config) {
         Ok(system) => system,
         Err(err) => {
@@ -3387,6 +4869,7 @@ fn main() -> Result<(), String> {
             std::process::exit(1);
         }
     };
+    timings.end(phase);
 
     let monitor_config = MonitorConfig {
         untyped_info_symbol_name: "untyped_info",
@@ -3395,6 +4878,7 @@ fn main() -> Result<(), String> {
         system_invocation_count_symbol_name: "system_invocation_count",
     };
 
+    let phase = timings.start("ELF loading");
     let kernel_elf = ElfFile::from_path(&kernel_elf_path)?;
     let mut monitor_elf = ElfFile::from_path(&monitor_elf_path)?;
 
@@ -3428,21 +4912,107 @@ fn main() -> Result<(), String> {
             }
         }
     }
+    check_channel_buffers(&kernel_config, &system, &pd_elf_files)?;
+    // Get the elf files for each template, in the same order as the PDs they belong to
+    let mut template_elf_files = Vec::new();
+    for template in system.protection_domains.iter().flat_map(|pd| pd.templates.iter()) {
+        match get_full_path(&template.program_image, &search_paths) {
+            Some(path) => {
+                let elf = ElfFile::from_path(&path).unwrap();
+                template_elf_files.push(elf);
+            }
+            None => {
+                return Err(format!(
+                    "unable to find program image: '{}'",
+                    template.program_image.display()
+                ))
+            }
+        }
+    }
+    template_write_symbols(&system.protection_domains, &mut template_elf_files)?;
+    timings.end(phase);
+
+    let boot_log = match args.boot_log {
+        Some(name) => match system.memory_regions.iter().find(|mr| mr.name == name) {
+            Some(mr) if mr.phys_addr.is_some() => {
+                return Err(format!(
+                    "boot log memory region '{}' cannot have a physical address",
+                    name
+                ))
+            }
+            Some(mr) if mr.page_size_bytes() != kernel_config.minimum_page_size => {
+                return Err(format!(
+                    "boot log memory region '{}' must use the smallest page size",
+                    name
+                ))
+            }
+            Some(mr) => Some(mr),
+            None => {
+                return Err(format!(
+                    "boot log memory region '{}' does not exist",
+                    name
+                ))
+            }
+        },
+        None => None,
+    };
+
+    let kernel_log = match args.kernel_log {
+        Some(_) if !kernel_log_buffer => {
+            return Err(format!(
+                "the kernel for configuration '{}' does not have a log buffer, use the 'benchmark_trace' configuration",
+                args.config
+            ))
+        }
+        Some(name) => match system.memory_regions.iter().find(|mr| mr.name == name) {
+            Some(mr) if mr.phys_addr.is_some() => {
+                return Err(format!(
+                    "kernel log memory region '{}' cannot have a physical address",
+                    name
+                ))
+            }
+            Some(mr) if mr.page_size != PageSize::Large || mr.page_count != 1 => {
+                return Err(format!(
+                    "kernel log memory region '{}' must be a single large page (0x{:x} bytes)",
+                    name,
+                    PageSize::Large as u64
+                ))
+            }
+            Some(mr) => Some(mr),
+            None => {
+                return Err(format!(
+                    "kernel log memory region '{}' does not exist",
+                    name
+                ))
+            }
+        },
+        None => None,
+    };
 
     let mut invocation_table_size = kernel_config.minimum_page_size;
     let mut system_cnode_size = 2;
 
     let mut built_system;
+    let mut pass = 1;
     loop {
+        let phase = timings.start(format!("build_system pass {}", pass));
+        let elfs = SystemElfs {
+            kernel: &kernel_elf,
+            monitor: &monitor_elf,
+            pds: &pd_elf_files,
+            templates: &template_elf_files,
+        };
         built_system = build_system(
             &kernel_config,
-            &pd_elf_files,
-            &kernel_elf,
-            &monitor_elf,
+            &elfs,
             &system,
+            boot_log,
+            kernel_log,
             invocation_table_size,
             system_cnode_size,
         )?;
+        timings.end(phase);
+        pass += 1;
         println!("BUILT: system_cnode_size={} built_system.number_of_system_caps={} invocation_table_size={} built_system.invocation_data_size={}",
                  system_cnode_size, built_system.number_of_system_caps, invocation_table_size, built_system.invocation_data_size);
 
@@ -3523,10 +5093,14 @@ fn main() -> Result<(), String> {
     }
     monitor_elf.write_symbol(monitor_config.untyped_info_symbol_name, &untyped_info_data)?;
 
+    let phase = timings.start("invocation serialisation");
     let mut bootstrap_invocation_data: Vec<u8> = Vec::new();
     for invocation in &built_system.bootstrap_invocations {
         invocation.add_raw_invocation(&kernel_config, &mut bootstrap_invocation_data);
     }
+    timings.end(phase);
+
+    let phase = timings.start("symbol patching");
 
     let (_, bootstrap_invocation_data_size) =
         monitor_elf.find_symbol(monitor_config.bootstrap_invocation_data_symbol_name)?;
@@ -3567,6 +5141,20 @@ fn main() -> Result<(), String> {
     let ntfn_cap_bytes = monitor_serialise_u64_vec(&built_system.ntfn_caps);
     let pd_stack_addrs_bytes = monitor_serialise_u64_vec(&built_system.pd_stack_addrs);
 
+    let (boot_log_vaddr, boot_log_size) = match built_system.boot_log_region {
+        Some(region) => (built_system.boot_log_vaddr, region.size()),
+        None => (0, 0),
+    };
+    monitor_elf.write_symbol("boot_log_vaddr", &boot_log_vaddr.to_le_bytes())?;
+    monitor_elf.write_symbol("boot_log_size", &boot_log_size.to_le_bytes())?;
+    monitor_elf.write_symbol(
+        "kernel_log_buffer",
+        &built_system.kernel_log_cap.to_le_bytes(),
+    )?;
+    monitor_elf.write_symbol(
+        "kernel_log_invocation",
+        &built_system.kernel_log_invocation.to_le_bytes(),
+    )?;
     monitor_elf.write_symbol("fault_ep", &built_system.fault_ep_cap_address.to_le_bytes())?;
     monitor_elf.write_symbol("reply", &built_system.reply_cap_address.to_le_bytes())?;
     monitor_elf.write_symbol("pd_tcbs", &pd_tcb_cap_bytes)?;
@@ -3593,6 +5181,18 @@ fn main() -> Result<(), String> {
         .filter_map(|pd| pd.virtual_machine.as_ref().map(|vm| &vm.name))
         .collect();
     monitor_elf.write_symbol("vm_names_len", &vm_names.len().to_le_bytes())?;
+    if !built_system.template_instances.is_empty() {
+        assert!(built_system.template_instances.len() <= MAX_TEMPLATE_INSTANCES);
+        let mut template_instance_bytes = Vec::new();
+        for instance in &built_system.template_instances {
+            template_instance_bytes.extend(unsafe { struct_to_bytes(instance) });
+        }
+        monitor_elf.write_symbol("template_instances", &template_instance_bytes)?;
+        monitor_elf.write_symbol(
+            "template_instances_len",
+            &built_system.template_instances.len().to_le_bytes(),
+        )?;
+    }
     monitor_elf.write_symbol(
         "vm_names",
         &monitor_serialise_names(vm_names, MAX_VMS, VM_MAX_NAME_LENGTH),
@@ -3602,11 +5202,80 @@ fn main() -> Result<(), String> {
     pd_write_symbols(
         &system.protection_domains,
         &system.channels,
+        &system.broadcasts,
         &mut pd_elf_files,
         &built_system.pd_setvar_values,
     )?;
+    timings.end(phase);
+
+    let phase = timings.start("loader image layout");
+    let mut loader_regions: Vec<(u64, &[u8])> = vec![(
+        built_system.reserved_region.base,
+        &built_system.invocation_data,
+    )];
+    for (i, regions) in built_system.pd_elf_regions.iter().enumerate() {
+        for r in regions {
+            loader_regions.push((r.addr, r.data(&pd_elf_files[i])));
+        }
+    }
+
+    let loader = Loader::new(
+        &kernel_config,
+        Path::new(&loader_elf_path),
+        &kernel_elf,
+        InitialTask {
+            elf: &monitor_elf,
+            phys_base: Some(built_system.initial_task_phys_region.base),
+            reserved_region: built_system.reserved_region,
+            boot_log_region: built_system.boot_log_region,
+        },
+        loader_regions,
+        args.compress,
+        args.in_place,
+    );
+    timings.end(phase);
+
+    let phase = timings.start("build summary");
+    // The loader image holds the kernel's segments, the monitor, the invocation
+    // table and then the regions of each PD, in the order given to the loader.
+    let kernel_segment_count = kernel_elf.segments.iter().filter(|s| s.loadable).count();
+    let mut image_part_names = vec!["kernel".to_string(); kernel_segment_count];
+    image_part_names.push("monitor".to_string());
+    image_part_names.push("invocation_table".to_string());
+    for (pd, regions) in zip(&system.protection_domains, &built_system.pd_elf_regions) {
+        for _ in regions {
+            image_part_names.push(format!("PD={}", pd.name));
+        }
+    }
+    let stats = build_stats(
+        &kernel_config,
+        &built_system,
+        &loader.region_info(),
+        &image_part_names,
+        loader.image_size(),
+    );
+
+    let exceeded = stats.check_limits(&system.limits);
+    if !exceeded.is_empty() {
+        for limit in exceeded {
+            eprintln!("ERROR: {}", limit);
+        }
+        std::process::exit(1);
+    }
+
+    if let Some(stats_path) = args.stats {
+        let json = serde_json::to_string_pretty(&stats).unwrap();
+        if let Err(e) = fs::write(stats_path, json) {
+            return Err(format!(
+                "Could not write stats file '{}': {}",
+                stats_path, e
+            ));
+        }
+    }
+    timings.end(phase);
 
     // Generate the report
+    let phase = timings.start("report writing");
     let report = match std::fs::File::create(args.report) {
         Ok(file) => file,
         Err(e) => {
@@ -3623,6 +5292,7 @@ fn main() -> Result<(), String> {
         &kernel_config,
         &built_system,
         &bootstrap_invocation_data,
+        &loader.region_info(),
     ) {
         Ok(()) => report_buf.flush().unwrap(),
         Err(err) => {
@@ -3633,27 +5303,16 @@ fn main() -> Result<(), String> {
         }
     }
     report_buf.flush().unwrap();
+    timings.end(phase);
 
-    let mut loader_regions: Vec<(u64, &[u8])> = vec![(
-        built_system.reserved_region.base,
-        &built_system.invocation_data,
-    )];
-    for (i, regions) in built_system.pd_elf_regions.iter().enumerate() {
-        for r in regions {
-            loader_regions.push((r.addr, r.data(&pd_elf_files[i])));
-        }
-    }
-
-    let loader = Loader::new(
-        &kernel_config,
-        Path::new(&loader_elf_path),
-        &kernel_elf,
-        &monitor_elf,
-        Some(built_system.initial_task_phys_region.base),
-        built_system.reserved_region,
-        loader_regions,
-    );
+    let phase = timings.start("Loader::write_image");
     loader.write_image(Path::new(args.output));
+    timings.end(phase);
+
+    timings.print();
+    if let Some(trace_path) = args.timings_trace {
+        timings.write_chrome_trace(trace_path)?;
+    }
 
     Ok(())
 }
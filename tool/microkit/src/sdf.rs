@@ -17,8 +17,8 @@
 /// XML. The roxmltree project allows us to work on a lower-level than something based
 /// on serde and so we can report proper user errors.
 use crate::sel4::{Config, IrqTrigger, PageSize};
-use crate::util::str_to_bool;
-use crate::MAX_PDS;
+use crate::util::{round_down, str_to_bool};
+use crate::{MAX_BROADCASTS, MAX_BROADCAST_CONSUMERS, MAX_PDS, MAX_TEMPLATES, MAX_TEMPLATE_INSTANCES};
 use std::path::{Path, PathBuf};
 
 /// Events that come through entry points (e.g notified or protected) are given an
@@ -36,12 +36,44 @@ const VCPU_MAX_ID: u64 = PD_MAX_ID;
 const PD_MAX_PRIORITY: u8 = 254;
 /// In microseconds
 const BUDGET_DEFAULT: u64 = 1000;
+/// Keeps the scheduling context of a PD within 32 KiB
+const PD_MAX_REFILLS: u64 = 1024;
 
 /// Default to a stack size of a single page
 const PD_DEFAULT_STACK_SIZE: u64 = 0x1000;
 const PD_MIN_STACK_SIZE: u64 = 0x1000;
 const PD_MAX_STACK_SIZE: u64 = 1024 * 1024 * 16;
 
+/// Extra refills only help a scheduling context whose budget is less than its
+/// period, otherwise it is round-robin and the kernel only uses the minimum.
+fn parse_refills(
+    xml_sdf: &XmlSystemDescription,
+    node: &roxmltree::Node,
+    budget: u64,
+    period: u64,
+) -> Result<u64, String> {
+    let refills = match node.attribute("refills") {
+        Some(xml_refills) => sdf_parse_number(xml_refills, node)?,
+        None => return Ok(0),
+    };
+    if refills > PD_MAX_REFILLS {
+        return Err(value_error(
+            xml_sdf,
+            node,
+            format!("refills must be at most {}", PD_MAX_REFILLS),
+        ));
+    }
+    if refills > 0 && budget == period {
+        return Err(value_error(
+            xml_sdf,
+            node,
+            "refills requires budget to be less than period".to_string(),
+        ));
+    }
+
+    Ok(refills)
+}
+
 /// The purpose of this function is to parse an integer that could
 /// either be in decimal or hex format, unlike the normal parsing
 /// functionality that the Rust standard library provides.
@@ -85,6 +117,11 @@ pub struct SysMap {
     pub vaddr: u64,
     pub perms: u8,
     pub cached: bool,
+    /// Offset into the memory region of the first byte mapped
+    pub offset: u64,
+    /// Number of bytes mapped, if only part of the memory region is mapped.
+    /// Use `SysMap::size` to get the size of the mapping.
+    pub size: Option<u64>,
     /// Location in the parsed SDF file. Because this struct is
     /// used in a non-XML context, we make the position optional.
     pub text_pos: Option<roxmltree::TextPos>,
@@ -135,6 +172,7 @@ pub struct SysIrq {
     pub irq: u64,
     pub id: u64,
     pub trigger: IrqTrigger,
+    pub dispatch_priority: u8,
 }
 
 #[derive(Debug, PartialEq, Eq, Hash)]
@@ -142,7 +180,7 @@ pub enum SysSetVarKind {
     // For size we do not store the size since when we parse mappings
     // we do not have access to the memory region yet. The size is resolved
     // when we actually need to perform the setvar.
-    Size { mr: String },
+    Size { mr: String, offset: u64, size: Option<u64> },
     Vaddr { address: u64, mr: String },
     Paddr { region: String },
 }
@@ -159,12 +197,50 @@ pub struct ChannelEnd {
     pub id: u64,
     pub notify: bool,
     pub pp: bool,
+    pub dispatch_priority: u8,
+}
+
+/// A memory region that the tool creates for a channel and maps into
+/// the PDs at both ends, at addresses it picks.
+#[derive(Debug)]
+pub struct ChannelBuffer {
+    pub mr: String,
+    pub size: u64,
+    pub vaddr_a: u64,
+    pub vaddr_b: u64,
 }
 
 #[derive(Debug)]
 pub struct Channel {
     pub end_a: ChannelEnd,
     pub end_b: ChannelEnd,
+    pub buffer: Option<ChannelBuffer>,
+}
+
+#[derive(Debug, Clone)]
+pub struct BroadcastConsumer {
+    pub pd: usize,
+    /// The channel ID that the consumer is notified on
+    pub id: u64,
+    pub vaddr: u64,
+}
+
+/// A broadcast from one PD to many. The tool creates a memory region for the
+/// message, which the producer maps read-write and the consumers read-only,
+/// and gives the producer a notification cap for each consumer.
+#[derive(Debug)]
+pub struct Broadcast {
+    pub name: String,
+    pub mr: String,
+    pub size: u64,
+    pub producer: usize,
+    /// The broadcast ID in the producer, separate from its channel IDs
+    pub id: u64,
+    pub vaddr: u64,
+    pub consumers: Vec<BroadcastConsumer>,
+    /// Index of the producer's cap for the first consumer, counting from the
+    /// first of its broadcast caps
+    pub first_cap: u64,
 }
 
 #[derive(Debug, PartialEq, Eq, Hash)]
@@ -175,14 +251,23 @@ pub struct ProtectionDomain {
     pub priority: u8,
     pub budget: u64,
     pub period: u64,
+    /// Extra sporadic server refills, beyond the kernel's minimum
+    pub refills: u64,
     pub passive: bool,
+    /// Busy-poll for events rather than blocking in the kernel
+    pub poll: bool,
     pub stack_size: u64,
     pub smc: bool,
+    /// Early PDs are started before the memory regions that are only
+    /// used by other PDs have been set up.
+    pub early: bool,
     pub program_image: PathBuf,
     pub maps: Vec<SysMap>,
     pub irqs: Vec<SysIrq>,
     pub setvars: Vec<SysSetVar>,
     pub virtual_machine: Option<VirtualMachine>,
+    /// PDs that this PD can spawn at run time
+    pub templates: Vec<PdTemplate>,
     /// Only used when parsing child PDs. All elements will be removed
     /// once we flatten each PD and its children into one list.
     pub child_pds: Vec<ProtectionDomain>,
@@ -209,6 +294,29 @@ pub struct VirtualCpu {
     pub id: u64,
 }
 
+/// A PD that is not started with the system but that its parent can spawn, and
+/// later destroy, at run time. The memory for each instance is set aside when
+/// the system is built.
+#[derive(Debug, PartialEq, Eq, Hash)]
+pub struct PdTemplate {
+    pub name: String,
+    /// The ID the parent spawns the template with
+    pub id: u64,
+    /// The parent's channel to the first instance, the other instances have
+    /// the channels that follow it. Each instance's channel to its parent is 0.
+    pub channel: u64,
+    /// The most instances that can exist at once
+    pub instances: u64,
+    pub priority: u8,
+    pub budget: u64,
+    pub period: u64,
+    pub refills: u64,
+    pub stack_size: u64,
+    pub program_image: PathBuf,
+    pub maps: Vec<SysMap>,
+    text_pos: roxmltree::TextPos,
+}
+
 /// To avoid code duplication for handling protection domains
 /// and virtual machines, which have a lot in common.
 trait ExecutionContext {
@@ -236,6 +344,16 @@ impl ExecutionContext for VirtualMachine {
     }
 }
 
+impl ExecutionContext for PdTemplate {
+    fn name(&self) -> &String {
+        &self.name
+    }
+
+    fn kind(&self) -> &'static str {
+        "template"
+    }
+}
+
 impl SysMapPerms {
     fn from_str(s: &str) -> Result<u8, ()> {
         let mut perms = 0;
@@ -260,7 +378,7 @@ impl SysMap {
         allow_setvar: bool,
         max_vaddr: u64,
     ) -> Result<SysMap, String> {
-        let mut attrs = vec!["mr", "vaddr", "perms", "cached"];
+        let mut attrs = vec!["mr", "vaddr", "perms", "cached", "offset", "size"];
         if allow_setvar {
             attrs.push("setvar_vaddr");
             attrs.push("setvar_size");
@@ -319,16 +437,49 @@ impl SysMap {
             true
         };
 
+        let offset = match node.attribute("offset") {
+            Some(xml_offset) => sdf_parse_number(xml_offset, node)?,
+            None => 0,
+        };
+        let size = match node.attribute("size") {
+            Some(xml_size) => Some(sdf_parse_number(xml_size, node)?),
+            None => None,
+        };
+        if size == Some(0) {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "size must be greater than zero".to_string(),
+            ));
+        }
+
         Ok(SysMap {
             mr,
             vaddr,
             perms,
             cached,
+            offset,
+            size,
             text_pos: Some(xml_sdf.doc.text_pos_at(node.range().start)),
         })
     }
 }
 
+impl SysMap {
+    /// Size in bytes of the part of 'mr' that is mapped. This is also used
+    /// before check_maps, so an offset past the end gives an empty map.
+    pub fn size(&self, mr: &SysMemoryRegion) -> u64 {
+        self.size.unwrap_or(mr.size.saturating_sub(self.offset))
+    }
+
+    /// Indexes of the pages of 'mr' that are mapped.
+    pub fn pages(&self, mr: &SysMemoryRegion) -> std::ops::Range<usize> {
+        let first = self.offset / mr.page_size_bytes();
+        let count = self.size(mr) / mr.page_size_bytes();
+        first as usize..(first + count) as usize
+    }
+}
+
 impl ProtectionDomain {
     pub fn needs_ep(&self, self_id: usize, channels: &[Channel]) -> bool {
         self.has_children
@@ -348,6 +499,30 @@ impl ProtectionDomain {
         irqs
     }
 
+    /// The channels of this PD that have a non-zero dispatch priority, as a
+    /// bit mask and as a list of IDs in the order that they should be serviced:
+    /// highest priority first and then by ID.
+    pub fn dispatch_order(&self, pd_idx: usize, channels: &[Channel]) -> (u64, Vec<u8>) {
+        let mut prioritised: Vec<(u8, u64)> = self
+            .irqs
+            .iter()
+            .map(|irq| (irq.dispatch_priority, irq.id))
+            .collect();
+        for channel in channels {
+            for end in [&channel.end_a, &channel.end_b] {
+                if end.pd == pd_idx {
+                    prioritised.push((end.dispatch_priority, end.id));
+                }
+            }
+        }
+        prioritised.retain(|(priority, _)| *priority > 0);
+        prioritised.sort_by(|(p1, id1), (p2, id2)| p2.cmp(p1).then(id1.cmp(id2)));
+
+        let mask = prioritised.iter().fold(0, |mask, (_, id)| mask | (1 << id));
+        let order = prioritised.iter().map(|(_, id)| *id as u8).collect();
+        (mask, order)
+    }
+
     fn from_xml(
         config: &Config,
         xml_sdf: &XmlSystemDescription,
@@ -359,11 +534,14 @@ impl ProtectionDomain {
             "priority",
             "budget",
             "period",
+            "refills",
             "passive",
             "stack_size",
             // The SMC field is only available in certain configurations
             // but we do the error-checking further down.
             "smc",
+            "early",
+            "mode",
         ];
         if is_child {
             attrs.push("id");
@@ -402,6 +580,7 @@ impl ProtectionDomain {
                 ),
             ));
         }
+        let refills = parse_refills(xml_sdf, node, budget, period)?;
 
         let passive = if let Some(xml_passive) = node.attribute("passive") {
             match str_to_bool(xml_passive) {
@@ -439,6 +618,53 @@ impl ProtectionDomain {
             false
         };
 
+        let early = if let Some(xml_early) = node.attribute("early") {
+            match str_to_bool(xml_early) {
+                Some(val) => val,
+                None => {
+                    return Err(value_error(
+                        xml_sdf,
+                        node,
+                        "early must be 'true' or 'false'".to_string(),
+                    ))
+                }
+            }
+        } else {
+            false
+        };
+
+        let poll = match node.attribute("mode") {
+            None | Some("event") => false,
+            Some("poll") => true,
+            Some(_) => {
+                return Err(value_error(
+                    xml_sdf,
+                    node,
+                    "mode must be 'event' or 'poll'".to_string(),
+                ))
+            }
+        };
+
+        // A polling PD never gives up its scheduling context
+        if poll && passive {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "passive protection domains cannot poll".to_string(),
+            ));
+        }
+
+        // A passive PD signals the monitor with a non-blocking send once it has
+        // initialised, which would be lost while the monitor is still busy setting
+        // up the rest of the system.
+        if early && passive {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "passive protection domains cannot be early".to_string(),
+            ));
+        }
+
         if smc {
             match config.arm_smc {
                 Some(smc_allowed) => {
@@ -482,6 +708,7 @@ impl ProtectionDomain {
         let mut irqs = Vec::new();
         let mut setvars: Vec<SysSetVar> = Vec::new();
         let mut child_pds = Vec::new();
+        let mut templates: Vec<PdTemplate> = Vec::new();
 
         let mut program_image = None;
         let mut virtual_machine = None;
@@ -556,14 +783,22 @@ impl ProtectionDomain {
 
                         setvars.push(SysSetVar {
                             symbol: setvar_size.to_string(),
-                            kind: SysSetVarKind::Size { mr: map.mr.clone() },
+                            kind: SysSetVarKind::Size {
+                                mr: map.mr.clone(),
+                                offset: map.offset,
+                                size: map.size,
+                            },
                         });
                     }
 
                     maps.push(map);
                 }
                 "irq" => {
-                    check_attributes(xml_sdf, &child, &["irq", "id", "trigger"])?;
+                    check_attributes(
+                        xml_sdf,
+                        &child,
+                        &["irq", "id", "trigger", "dispatch_priority"],
+                    )?;
                     let irq = checked_lookup(xml_sdf, &child, "irq")?
                         .parse::<u64>()
                         .unwrap();
@@ -598,10 +833,13 @@ impl ProtectionDomain {
                         IrqTrigger::Level
                     };
 
+                    let dispatch_priority = parse_dispatch_priority(xml_sdf, &child)?;
+
                     let irq = SysIrq {
                         irq,
                         id: id as u64,
                         trigger,
+                        dispatch_priority,
                     };
                     irqs.push(irq);
                 }
@@ -625,7 +863,15 @@ impl ProtectionDomain {
                     })
                 }
                 "protection_domain" => {
-                    child_pds.push(ProtectionDomain::from_xml(config, xml_sdf, &child, true)?)
+                    let child_pd = ProtectionDomain::from_xml(config, xml_sdf, &child, true)?;
+                    if early && !child_pd.early {
+                        return Err(value_error(
+                            xml_sdf,
+                            &child,
+                            "child of an early protection domain must also be early".to_string(),
+                        ));
+                    }
+                    child_pds.push(child_pd)
                 }
                 "virtual_machine" => {
                     if virtual_machine.is_some() {
@@ -638,6 +884,17 @@ impl ProtectionDomain {
 
                     virtual_machine = Some(VirtualMachine::from_xml(config, xml_sdf, &child)?);
                 }
+                "template" => {
+                    let template = PdTemplate::from_xml(config, xml_sdf, &child)?;
+                    if templates.iter().any(|t| t.id == template.id) {
+                        return Err(value_error(
+                            xml_sdf,
+                            &child,
+                            format!("duplicate template id {}", template.id),
+                        ));
+                    }
+                    templates.push(template);
+                }
                 _ => {
                     let pos = xml_sdf.doc.text_pos_at(child.range().start);
                     return Err(format!(
@@ -666,15 +923,19 @@ impl ProtectionDomain {
             priority: priority as u8,
             budget,
             period,
+            refills,
             passive,
+            poll,
             stack_size,
             smc,
+            early,
             program_image: program_image.unwrap(),
             maps,
             irqs,
             setvars,
             child_pds,
             virtual_machine,
+            templates,
             has_children,
             parent: None,
             text_pos: xml_sdf.doc.text_pos_at(node.range().start),
@@ -793,6 +1054,197 @@ impl VirtualMachine {
     }
 }
 
+impl PdTemplate {
+    fn from_xml(
+        config: &Config,
+        xml_sdf: &XmlSystemDescription,
+        node: &roxmltree::Node,
+    ) -> Result<PdTemplate, String> {
+        check_attributes(
+            xml_sdf,
+            node,
+            &[
+                "name",
+                "id",
+                "channel",
+                "instances",
+                "priority",
+                "budget",
+                "period",
+                "refills",
+                "stack_size",
+            ],
+        )?;
+
+        let name = checked_lookup(xml_sdf, node, "name")?.to_string();
+        let id = sdf_parse_number(checked_lookup(xml_sdf, node, "id")?, node)?;
+        if id >= MAX_TEMPLATES as u64 {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                format!("id must be < {}", MAX_TEMPLATES),
+            ));
+        }
+
+        let instances = sdf_parse_number(checked_lookup(xml_sdf, node, "instances")?, node)?;
+        if instances == 0 {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "instances must be at least 1".to_string(),
+            ));
+        }
+
+        let channel = sdf_parse_number(checked_lookup(xml_sdf, node, "channel")?, node)?;
+        if channel + instances - 1 > PD_MAX_ID {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                format!(
+                    "the channels of the instances must be < {}",
+                    PD_MAX_ID + 1
+                ),
+            ));
+        }
+
+        // If we do not have an explicit budget the period is equal to the default budget.
+        let budget = if let Some(xml_budget) = node.attribute("budget") {
+            sdf_parse_number(xml_budget, node)?
+        } else {
+            BUDGET_DEFAULT
+        };
+        let period = if let Some(xml_period) = node.attribute("period") {
+            sdf_parse_number(xml_period, node)?
+        } else {
+            budget
+        };
+        if budget > period {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                format!(
+                    "budget ({}) must be less than, or equal to, period ({})",
+                    budget, period
+                ),
+            ));
+        }
+        let refills = parse_refills(xml_sdf, node, budget, period)?;
+
+        // Default to minimum priority
+        let priority = if let Some(xml_priority) = node.attribute("priority") {
+            sdf_parse_number(xml_priority, node)?
+        } else {
+            0
+        };
+        if priority > PD_MAX_PRIORITY as u64 {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                format!("priority must be between 0 and {}", PD_MAX_PRIORITY),
+            ));
+        }
+
+        let stack_size = if let Some(xml_stack_size) = node.attribute("stack_size") {
+            sdf_parse_number(xml_stack_size, node)?
+        } else {
+            PD_DEFAULT_STACK_SIZE
+        };
+        #[allow(clippy::manual_range_contains)]
+        if stack_size < PD_MIN_STACK_SIZE || stack_size > PD_MAX_STACK_SIZE {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                format!(
+                    "stack size must be between 0x{:x} bytes and 0x{:x} bytes",
+                    PD_MIN_STACK_SIZE, PD_MAX_STACK_SIZE
+                ),
+            ));
+        }
+        if stack_size % config.page_sizes()[0] != 0 {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                format!(
+                    "stack size must be aligned to the smallest page size, {} bytes",
+                    config.page_sizes()[0]
+                ),
+            ));
+        }
+
+        // The monitor copies the program image of each instance itself, it
+        // does not know how to construct CHERI capabilities for it.
+        if config.cheri {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "templates are not supported on CHERI kernels".to_string(),
+            ));
+        }
+
+        let mut program_image = None;
+        let mut maps = Vec::new();
+        for child in node.children() {
+            if !child.is_element() {
+                continue;
+            }
+
+            match child.tag_name().name() {
+                "program_image" => {
+                    check_attributes(xml_sdf, &child, &["path"])?;
+                    if program_image.is_some() {
+                        return Err(value_error(
+                            xml_sdf,
+                            node,
+                            "program_image must only be specified once".to_string(),
+                        ));
+                    }
+
+                    let program_image_path = checked_lookup(xml_sdf, &child, "path")?;
+                    program_image = Some(Path::new(program_image_path).to_path_buf());
+                }
+                "map" => {
+                    // All instances share one program image, so there is nothing
+                    // a setvar could be written to for each instance
+                    let map_max_vaddr = config.pd_map_max_vaddr(stack_size);
+                    maps.push(SysMap::from_xml(xml_sdf, &child, false, map_max_vaddr)?);
+                }
+                _ => {
+                    let pos = xml_sdf.doc.text_pos_at(child.range().start);
+                    return Err(format!(
+                        "Error: invalid XML element '{}': {}",
+                        child.tag_name().name(),
+                        loc_string(xml_sdf, pos)
+                    ));
+                }
+            }
+        }
+
+        if program_image.is_none() {
+            return Err(format!(
+                "Error: missing 'program_image' element on template: '{}'",
+                name
+            ));
+        }
+
+        Ok(PdTemplate {
+            name,
+            id,
+            channel,
+            instances,
+            // This downcast is safe as we have checked that this is less than
+            // the maximum PD priority, which fits in a u8.
+            priority: priority as u8,
+            budget,
+            period,
+            refills,
+            stack_size,
+            program_image: program_image.unwrap(),
+            maps,
+            text_pos: xml_sdf.doc.text_pos_at(node.range().start),
+        })
+    }
+}
+
 impl SysMemoryRegion {
     fn from_xml(
         config: &Config,
@@ -871,7 +1323,11 @@ impl ChannelEnd {
             ));
         }
 
-        check_attributes(xml_sdf, node, &["pd", "id", "pp", "notify"])?;
+        check_attributes(
+            xml_sdf,
+            node,
+            &["pd", "id", "pp", "notify", "dispatch_priority"],
+        )?;
         let end_pd = checked_lookup(xml_sdf, node, "pd")?;
         let end_id = checked_lookup(xml_sdf, node, "id")?.parse::<i64>().unwrap();
 
@@ -907,12 +1363,15 @@ impl ChannelEnd {
                 value_error(xml_sdf, node, "pp must be 'true' or 'false'".to_string())
             })?;
 
+        let dispatch_priority = parse_dispatch_priority(xml_sdf, node)?;
+
         if let Some(pd_idx) = pds.iter().position(|pd| pd.name == end_pd) {
             Ok(ChannelEnd {
                 pd: pd_idx,
                 id: end_id.try_into().unwrap(),
                 notify,
                 pp,
+                dispatch_priority,
             })
         } else {
             Err(value_error(
@@ -925,15 +1384,33 @@ impl ChannelEnd {
 }
 
 impl Channel {
+    /// The buffers of the channels with an end in 'pd', as the channel ID at
+    /// that end, the address the buffer is mapped at, and the buffer.
+    pub fn pd_buffers(channels: &[Channel], pd: usize) -> Vec<(u64, u64, &ChannelBuffer)> {
+        let mut buffers = Vec::new();
+        for channel in channels {
+            if let Some(buffer) = &channel.buffer {
+                if channel.end_a.pd == pd {
+                    buffers.push((channel.end_a.id, buffer.vaddr_a, buffer));
+                }
+                if channel.end_b.pd == pd {
+                    buffers.push((channel.end_b.id, buffer.vaddr_b, buffer));
+                }
+            }
+        }
+        buffers
+    }
+
     /// It should be noted that this function assumes that `pds` is populated
     /// with all the Protection Domains that could potentially be connected with
     /// the channel.
     fn from_xml<'a>(
+        config: &Config,
         xml_sdf: &'a XmlSystemDescription,
         node: &'a roxmltree::Node,
         pds: &[ProtectionDomain],
     ) -> Result<Channel, String> {
-        check_attributes(xml_sdf, node, &[])?;
+        check_attributes(xml_sdf, node, &["buffer"])?;
 
         let [ref end_a, ref end_b] = node
             .children()
@@ -956,9 +1433,153 @@ impl Channel {
             ));
         }
 
+        let buffer = if let Some(xml_buffer) = node.attribute("buffer") {
+            let size = sdf_parse_number(xml_buffer, node)?;
+            if size == 0 || size % config.page_sizes()[0] != 0 {
+                return Err(value_error(
+                    xml_sdf,
+                    node,
+                    "buffer size must be a non-zero multiple of the page size".to_string(),
+                ));
+            }
+            Some(ChannelBuffer {
+                mr: format!(
+                    "channel_buffer_{}_{}_{}_{}",
+                    pds[end_a.pd].name, end_a.id, pds[end_b.pd].name, end_b.id
+                ),
+                size,
+                // Chosen once all PDs' maps are known
+                vaddr_a: 0,
+                vaddr_b: 0,
+            })
+        } else {
+            None
+        };
+
         Ok(Channel {
             end_a: end_a.clone(),
             end_b: end_b.clone(),
+            buffer,
+        })
+    }
+}
+
+impl Broadcast {
+    /// The message buffers of the broadcasts that 'pd' consumes, as the channel
+    /// ID it is notified on, the address the buffer is mapped at, and its size.
+    pub fn pd_consumer_buffers(broadcasts: &[Broadcast], pd: usize) -> Vec<(u64, u64, u64)> {
+        let mut buffers = Vec::new();
+        for broadcast in broadcasts {
+            for consumer in &broadcast.consumers {
+                if consumer.pd == pd {
+                    buffers.push((consumer.id, consumer.vaddr, broadcast.size));
+                }
+            }
+        }
+        buffers
+    }
+
+    fn from_xml<'a>(
+        config: &Config,
+        xml_sdf: &'a XmlSystemDescription,
+        node: &'a roxmltree::Node,
+        pds: &[ProtectionDomain],
+    ) -> Result<Broadcast, String> {
+        check_attributes(xml_sdf, node, &["name", "size"])?;
+
+        let name = checked_lookup(xml_sdf, node, "name")?;
+        let page_size = config.page_sizes()[0];
+        let size = match node.attribute("size") {
+            Some(xml_size) => sdf_parse_number(xml_size, node)?,
+            None => page_size,
+        };
+        if size == 0 || size % page_size != 0 {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "size must be a non-zero multiple of the page size".to_string(),
+            ));
+        }
+
+        let lookup_end = |child: &roxmltree::Node, max_id: u64| -> Result<(usize, u64), String> {
+            check_attributes(xml_sdf, child, &["pd", "id"])?;
+            let end_pd = checked_lookup(xml_sdf, child, "pd")?;
+            let id = sdf_parse_number(checked_lookup(xml_sdf, child, "id")?, child)?;
+            if id > max_id {
+                return Err(value_error(
+                    xml_sdf,
+                    child,
+                    format!("id must be < {}", max_id + 1),
+                ));
+            }
+            match pds.iter().position(|pd| pd.name == end_pd) {
+                Some(pd_idx) => Ok((pd_idx, id)),
+                None => Err(value_error(
+                    xml_sdf,
+                    child,
+                    format!("invalid PD name '{end_pd}'"),
+                )),
+            }
+        };
+
+        let mut producer = None;
+        let mut consumers = Vec::new();
+        for child in node.children().filter(|child| child.is_element()) {
+            match child.tag_name().name() {
+                "producer" => {
+                    if producer.is_some() {
+                        return Err(value_error(
+                            xml_sdf,
+                            node,
+                            "exactly one producer element must be specified".to_string(),
+                        ));
+                    }
+                    producer = Some(lookup_end(&child, MAX_BROADCASTS as u64 - 1)?);
+                }
+                "consumer" => {
+                    let (pd, id) = lookup_end(&child, PD_MAX_ID)?;
+                    consumers.push(BroadcastConsumer {
+                        pd,
+                        id,
+                        // Chosen once all PDs' maps are known
+                        vaddr: 0,
+                    });
+                }
+                child_name => {
+                    let pos = xml_sdf.doc.text_pos_at(child.range().start);
+                    return Err(format!(
+                        "Error: invalid XML element '{}': {}",
+                        child_name,
+                        loc_string(xml_sdf, pos)
+                    ));
+                }
+            }
+        }
+
+        let Some((producer, id)) = producer else {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "exactly one producer element must be specified".to_string(),
+            ));
+        };
+        if consumers.is_empty() {
+            return Err(value_error(
+                xml_sdf,
+                node,
+                "at least one consumer element must be specified".to_string(),
+            ));
+        }
+
+        Ok(Broadcast {
+            name: name.to_string(),
+            mr: format!("broadcast_{}", name),
+            size,
+            producer,
+            id,
+            vaddr: 0,
+            consumers,
+            first_cap: 0,
         })
     }
 }
@@ -973,6 +1594,67 @@ pub struct SystemDescription {
     pub protection_domains: Vec<ProtectionDomain>,
     pub memory_regions: Vec<SysMemoryRegion>,
     pub channels: Vec<Channel>,
+    pub broadcasts: Vec<Broadcast>,
+    pub limits: SysLimits,
+}
+
+/// Budgets for the resources used by the system, the build fails if the
+/// built system exceeds any of them.
+#[derive(Debug, Default)]
+pub struct SysLimits {
+    pub max_invocations: Option<u64>,
+    pub max_kernel_memory: Option<u64>,
+    pub max_image_size: Option<u64>,
+}
+
+impl SysLimits {
+    fn from_xml(xml_sdf: &XmlSystemDescription, node: &roxmltree::Node) -> Result<SysLimits, String> {
+        check_attributes(
+            xml_sdf,
+            node,
+            &["max_invocations", "max_kernel_memory", "max_image_size"],
+        )?;
+
+        let limit = |attr: &str| match node.attribute(attr) {
+            Some(value) => sdf_parse_number(value, node).map(Some),
+            None => Ok(None),
+        };
+
+        Ok(SysLimits {
+            max_invocations: limit("max_invocations")?,
+            max_kernel_memory: limit("max_kernel_memory")?,
+            max_image_size: limit("max_image_size")?,
+        })
+    }
+}
+
+/// Pick the highest address for a channel buffer of 'size' bytes in 'pd' that
+/// does not overlap any of its maps. Maps of unknown memory regions are ignored
+/// here, they are reported by check_maps.
+fn channel_buffer_vaddr(
+    config: &Config,
+    mrs: &[SysMemoryRegion],
+    pd: &ProtectionDomain,
+    size: u64,
+) -> Option<u64> {
+    let page_size = config.page_sizes()[0];
+    let mut top = config.pd_map_max_vaddr(pd.stack_size);
+    loop {
+        let vaddr = round_down(top.checked_sub(size)?, page_size);
+        let overlap = pd
+            .maps
+            .iter()
+            .filter_map(|map| {
+                let mr = mrs.iter().find(|mr| mr.name == map.mr)?;
+                let end = map.vaddr.saturating_add(map.size(mr));
+                (map.vaddr < vaddr + size && end > vaddr).then_some(map.vaddr)
+            })
+            .min();
+        match overlap {
+            Some(start) => top = start,
+            None => return Some(vaddr),
+        }
+    }
 }
 
 fn check_maps(
@@ -994,8 +1676,35 @@ fn check_maps(
                     ));
                 }
 
+                if map.offset % mr.page_size_bytes() != 0 {
+                    return Err(format!(
+                        "Error: invalid offset alignment on 'map' @ {}",
+                        loc_string(xml_sdf, pos)
+                    ));
+                }
+
+                if let Some(size) = map.size {
+                    if size % mr.page_size_bytes() != 0 {
+                        return Err(format!(
+                            "Error: invalid size alignment on 'map' @ {}",
+                            loc_string(xml_sdf, pos)
+                        ));
+                    }
+                }
+
+                if map.offset >= mr.size || map.size.is_some_and(|size| size > mr.size - map.offset) {
+                    return Err(format!(
+                        "Error: map for '{}' with offset 0x{:x} and size 0x{:x} is outside of the memory region of size 0x{:x} @ {}",
+                        map.mr,
+                        map.offset,
+                        map.size(mr),
+                        mr.size,
+                        loc_string(xml_sdf, pos)
+                    ));
+                }
+
                 let map_start = map.vaddr;
-                let map_end = map.vaddr + mr.size;
+                let map_end = map.vaddr + map.size(mr);
                 for (name, start, end) in &checked_maps {
                     if !(map_start >= *end || map_end <= *start) {
                         return Err(
@@ -1067,6 +1776,26 @@ fn checked_lookup<'a>(
     }
 }
 
+fn parse_dispatch_priority(
+    xml_sdf: &XmlSystemDescription,
+    node: &roxmltree::Node,
+) -> Result<u8, String> {
+    match node.attribute("dispatch_priority") {
+        Some(xml_priority) => {
+            let priority = sdf_parse_number(xml_priority, node)?;
+            if priority > u8::MAX as u64 {
+                return Err(value_error(
+                    xml_sdf,
+                    node,
+                    format!("dispatch_priority must be between 0 and {}", u8::MAX),
+                ));
+            }
+            Ok(priority as u8)
+        }
+        None => Ok(0),
+    }
+}
+
 fn value_error(xml_sdf: &XmlSystemDescription, node: &roxmltree::Node, err: String) -> String {
     let pos = xml_sdf.doc.text_pos_at(node.range().start);
     format!(
@@ -1201,6 +1930,8 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
     let mut root_pds = vec![];
     let mut mrs = vec![];
     let mut channels = vec![];
+    let mut broadcasts = vec![];
+    let mut limits = None;
 
     let system = doc
         .root()
@@ -1215,6 +1946,7 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
     // via an index in the list of PDs. This means that we have to parse all PDs first and
     // then parse the channels.
     let mut channel_nodes = Vec::new();
+    let mut broadcast_nodes = Vec::new();
 
     for child in system.children() {
         if !child.is_element() {
@@ -1227,7 +1959,18 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
                 root_pds.push(ProtectionDomain::from_xml(config, &xml_sdf, &child, false)?)
             }
             "channel" => channel_nodes.push(child),
+            "broadcast" => broadcast_nodes.push(child),
             "memory_region" => mrs.push(SysMemoryRegion::from_xml(config, &xml_sdf, &child)?),
+            "limits" => {
+                if limits.is_some() {
+                    let pos = xml_sdf.doc.text_pos_at(child.range().start);
+                    return Err(format!(
+                        "Error: duplicate limits element: {}",
+                        loc_string(&xml_sdf, pos)
+                    ));
+                }
+                limits = Some(SysLimits::from_xml(&xml_sdf, &child)?);
+            }
             "virtual_machine" => {
                 let pos = xml_sdf.doc.text_pos_at(child.range().start);
                 return Err(format!(
@@ -1246,10 +1989,84 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
         }
     }
 
-    let pds = pd_flatten(&xml_sdf, root_pds)?;
+    let mut pds = pd_flatten(&xml_sdf, root_pds)?;
 
     for node in channel_nodes {
-        channels.push(Channel::from_xml(&xml_sdf, &node, &pds)?);
+        let mut channel = Channel::from_xml(config, &xml_sdf, &node, &pds)?;
+        if let Some(buffer) = &mut channel.buffer {
+            let pos = xml_sdf.doc.text_pos_at(node.range().start);
+            mrs.push(SysMemoryRegion {
+                name: buffer.mr.clone(),
+                size: buffer.size,
+                page_size: config.page_sizes()[0].into(),
+                page_count: buffer.size / config.page_sizes()[0],
+                phys_addr: None,
+                text_pos: Some(pos),
+                kind: SysMemoryRegionKind::User,
+            });
+            for (end, vaddr) in [
+                (&channel.end_a, &mut buffer.vaddr_a),
+                (&channel.end_b, &mut buffer.vaddr_b),
+            ] {
+                let pd = &mut pds[end.pd];
+                *vaddr = channel_buffer_vaddr(config, &mrs, pd, buffer.size).ok_or(format!(
+                    "Error: no room for the buffer of channel {} in protection domain '{}' @ {}",
+                    end.id,
+                    pd.name,
+                    loc_string(&xml_sdf, pos)
+                ))?;
+                pd.maps.push(SysMap {
+                    mr: buffer.mr.clone(),
+                    vaddr: *vaddr,
+                    perms: SysMapPerms::Read as u8 | SysMapPerms::Write as u8,
+                    cached: true,
+                    offset: 0,
+                    size: None,
+                    text_pos: Some(pos),
+                });
+            }
+        }
+        channels.push(channel);
+    }
+
+    for node in broadcast_nodes {
+        let mut broadcast = Broadcast::from_xml(config, &xml_sdf, &node, &pds)?;
+        let pos = xml_sdf.doc.text_pos_at(node.range().start);
+        mrs.push(SysMemoryRegion {
+            name: broadcast.mr.clone(),
+            size: broadcast.size,
+            page_size: config.page_sizes()[0].into(),
+            page_count: broadcast.size / config.page_sizes()[0],
+            phys_addr: None,
+            text_pos: Some(pos),
+            kind: SysMemoryRegionKind::User,
+        });
+        let read_write = SysMapPerms::Read as u8 | SysMapPerms::Write as u8;
+        let ends = std::iter::once((broadcast.producer, &mut broadcast.vaddr, read_write)).chain(
+            broadcast
+                .consumers
+                .iter_mut()
+                .map(|consumer| (consumer.pd, &mut consumer.vaddr, SysMapPerms::Read as u8)),
+        );
+        for (pd_idx, vaddr, perms) in ends {
+            let pd = &mut pds[pd_idx];
+            *vaddr = channel_buffer_vaddr(config, &mrs, pd, broadcast.size).ok_or(format!(
+                "Error: no room for broadcast '{}' in protection domain '{}' @ {}",
+                broadcast.name,
+                pd.name,
+                loc_string(&xml_sdf, pos)
+            ))?;
+            pd.maps.push(SysMap {
+                mr: broadcast.mr.clone(),
+                vaddr: *vaddr,
+                perms,
+                cached: true,
+                offset: 0,
+                size: None,
+                text_pos: Some(pos),
+            });
+        }
+        broadcasts.push(broadcast);
     }
 
     // Now that we have parsed everything in the system description we can validate any
@@ -1285,6 +2102,28 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
         }
     }
 
+    // The monitor names the instances of a template after it
+    let mut template_names: Vec<&String> = vec![];
+    let mut template_instances = 0;
+    for pd in &pds {
+        for template in &pd.templates {
+            if template_names.contains(&&template.name) || pds.iter().any(|x| x.name == template.name) {
+                return Err(format!(
+                    "Error: duplicate template name '{}'.",
+                    template.name
+                ));
+            }
+            template_names.push(&template.name);
+            template_instances += template.instances;
+        }
+    }
+    if template_instances > MAX_TEMPLATE_INSTANCES as u64 {
+        return Err(format!(
+            "Error: too many template instances ({}) defined. Maximum is {}.",
+            template_instances, MAX_TEMPLATE_INSTANCES
+        ));
+    }
+
     let mut vms = vec![];
     for pd in &pds {
         if let Some(vm) = &pd.virtual_machine {
@@ -1364,12 +2203,71 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
         ch_ids[ch.end_b.pd].push(ch.end_b.id);
     }
 
+    for broadcast in &broadcasts {
+        for consumer in &broadcast.consumers {
+            let pd = &pds[consumer.pd];
+            if ch_ids[consumer.pd].contains(&consumer.id) {
+                return Err(format!(
+                    "Error: duplicate channel id: {} in protection domain: '{}' @ {}:{}:{}",
+                    consumer.id, pd.name, filename, pd.text_pos.row, pd.text_pos.col
+                ));
+            }
+            ch_ids[consumer.pd].push(consumer.id);
+        }
+    }
+
+    // Each instance of a template takes one of its parent's channels
+    for (pd_idx, pd) in pds.iter().enumerate() {
+        for template in &pd.templates {
+            for id in template.channel..template.channel + template.instances {
+                if ch_ids[pd_idx].contains(&id) {
+                    return Err(format!(
+                        "Error: duplicate channel id: {} in protection domain: '{}' @ {}:{}:{}",
+                        id, pd.name, filename, template.text_pos.row, template.text_pos.col
+                    ));
+                }
+                ch_ids[pd_idx].push(id);
+            }
+        }
+    }
+
+    // Broadcast IDs are separate from channel IDs. The producer's caps for the
+    // consumers of its broadcasts are laid out in order of broadcast ID.
+    for (pd_idx, pd) in pds.iter().enumerate() {
+        let mut produced: Vec<usize> = (0..broadcasts.len())
+            .filter(|&i| broadcasts[i].producer == pd_idx)
+            .collect();
+        produced.sort_by_key(|&i| broadcasts[i].id);
+        for pair in produced.windows(2) {
+            if broadcasts[pair[0]].id == broadcasts[pair[1]].id {
+                return Err(format!(
+                    "Error: duplicate broadcast id: {} in protection domain: '{}' @ {}:{}:{}",
+                    broadcasts[pair[1]].id, pd.name, filename, pd.text_pos.row, pd.text_pos.col
+                ));
+            }
+        }
+        let mut first_cap = 0;
+        for i in produced {
+            broadcasts[i].first_cap = first_cap;
+            first_cap += broadcasts[i].consumers.len() as u64;
+        }
+        if first_cap > MAX_BROADCAST_CONSUMERS as u64 {
+            return Err(format!(
+                "Error: too many broadcast consumers ({}) for protection domain '{}'. Maximum is {}.",
+                first_cap, pd.name, MAX_BROADCAST_CONSUMERS
+            ));
+        }
+    }
+
     // Ensure that all maps are correct
     for pd in &pds {
         check_maps(&xml_sdf, &mrs, pd, &pd.maps)?;
         if let Some(vm) = &pd.virtual_machine {
             check_maps(&xml_sdf, &mrs, vm, &vm.maps)?;
         }
+        for template in &pd.templates {
+            check_maps(&xml_sdf, &mrs, template, &template.maps)?;
+        }
     }
 
     // Ensure MRs with physical addresses do not overlap
@@ -1408,6 +2306,9 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
         if let Some(vm) = &pd.virtual_machine {
             all_maps.extend(&vm.maps);
         }
+        for template in &pd.templates {
+            all_maps.extend(&template.maps);
+        }
     }
     for mr in &mrs {
         let mut found = false;
@@ -1432,16 +2333,12 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
             continue;
         }
 
-        // Get all the addresses that this MR will be mapped into
+        // Get all the addresses that this MR will be mapped into. Maps of part
+        // of the MR also need their bounds within the MR to be page aligned.
         let mut addrs: Vec<_> = all_maps
             .iter()
-            .filter_map(|&map| {
-                if map.mr == mr.name {
-                    Some(map.vaddr)
-                } else {
-                    None
-                }
-            })
+            .filter(|&map| map.mr == mr.name)
+            .flat_map(|&map| [map.vaddr, map.offset, map.size.unwrap_or(0)])
             .collect();
         if let Some(paddr) = mr.phys_addr {
             addrs.push(paddr);
@@ -1472,5 +2369,7 @@ pub fn parse(filename: &str, xml: &str, config: &Config) -> Result<SystemDescrip
         protection_domains: pds,
         memory_regions: mrs,
         channels,
+        broadcasts,
+        limits: limits.unwrap_or_default(),
     })
 }
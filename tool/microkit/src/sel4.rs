@@ -48,6 +48,8 @@ pub struct Object {
     pub cap_addr: u64,
     /// Physical memory address of the kernel object
     pub phys_addr: u64,
+    /// Number of bytes of untyped memory used by the kernel object
+    pub size: u64,
 }
 
 pub struct Config {
@@ -768,6 +770,16 @@ impl Invocation {
         }
     }
 
+    /// Name of the invocation's label, for summarising invocations by kind.
+    pub fn label_name(&self) -> String {
+        self.label.to_string()
+    }
+
+    /// Number of system calls that the monitor makes for this invocation.
+    pub fn count(&self) -> u64 {
+        self.repeat.as_ref().map_or(1, |(count, _)| *count as u64)
+    }
+
     /// With how count is used when we convert the invocation, it is limited to a u32.
     pub fn repeat(&mut self, count: u32, repeat_args: InvocationArgs) {
         assert!(self.repeat.is_none());
@@ -882,6 +894,19 @@ impl Invocation {
                 arg_strs.push(Invocation::fmt_field_cap("fault_ep", fault_ep, cap_lookup));
                 (tcb, &cap_lookup[&tcb])
             }
+            InvocationArgs::TcbSetPriority {
+                tcb,
+                authority,
+                priority,
+            } => {
+                arg_strs.push(Invocation::fmt_field_cap(
+                    "authority",
+                    authority,
+                    cap_lookup,
+                ));
+                arg_strs.push(Invocation::fmt_field("priority", priority));
+                (tcb, &cap_lookup[&tcb])
+            }
             InvocationArgs::TcbSetSpace {
                 tcb,
                 fault_ep,
@@ -1117,6 +1142,18 @@ impl Invocation {
                 arg_strs.push(Invocation::fmt_field_cap("tcb", tcb, cap_lookup));
                 (vcpu, &cap_lookup[&vcpu])
             }
+            InvocationArgs::PageUnmap { page } => (page, &cap_lookup[&page]),
+            InvocationArgs::PageUnifyInstruction { page, start, end } => {
+                arg_strs.push(Invocation::fmt_field_hex("start", start));
+                arg_strs.push(Invocation::fmt_field_hex("end", end));
+                (page, &cap_lookup[&page])
+            }
+            InvocationArgs::CnodeRevoke { cnode, index, depth }
+            | InvocationArgs::CnodeDelete { cnode, index, depth } => {
+                arg_strs.push(Invocation::fmt_field_cap("index", index, cap_lookup));
+                arg_strs.push(Invocation::fmt_field("depth", depth));
+                (cnode, &cap_lookup[&cnode])
+            }
         };
         _ = writeln!(
             f,
@@ -1136,6 +1173,7 @@ impl Invocation {
         match self.label {
             InvocationLabel::UntypedRetype => "Untyped",
             InvocationLabel::TCBSetSchedParams
+            | InvocationLabel::TCBSetPriority
             | InvocationLabel::TCBSetSpace
             | InvocationLabel::TCBSetIPCBuffer
             | InvocationLabel::TCBResume
@@ -1150,8 +1188,15 @@ impl Invocation {
             | InvocationLabel::RISCVIRQIssueIRQHandlerTrigger => "IRQ Control",
             InvocationLabel::IRQSetIRQHandler => "IRQ Handler",
             InvocationLabel::ARMPageTableMap | InvocationLabel::RISCVPageTableMap => "Page Table",
-            InvocationLabel::ARMPageMap | InvocationLabel::RISCVPageMap => "Page",
-            InvocationLabel::CNodeCopy | InvocationLabel::CNodeMint => "CNode",
+            InvocationLabel::ARMPageMap
+            | InvocationLabel::RISCVPageMap
+            | InvocationLabel::ARMPageUnmap
+            | InvocationLabel::RISCVPageUnmap
+            | InvocationLabel::ARMPageUnifyInstruction => "Page",
+            InvocationLabel::CNodeCopy
+            | InvocationLabel::CNodeMint
+            | InvocationLabel::CNodeRevoke
+            | InvocationLabel::CNodeDelete => "CNode",
             InvocationLabel::SchedControlConfigureFlags => "SchedControl",
             InvocationLabel::ARMVCPUSetTCB => "VCPU",
             _ => panic!(
@@ -1165,6 +1210,7 @@ impl Invocation {
         match self.label {
             InvocationLabel::UntypedRetype => "Retype",
             InvocationLabel::TCBSetSchedParams => "SetSchedParams",
+            InvocationLabel::TCBSetPriority => "SetPriority",
             InvocationLabel::TCBSetSpace => "SetSpace",
             InvocationLabel::TCBSetIPCBuffer => "SetIPCBuffer",
             InvocationLabel::TCBResume => "Resume",
@@ -1180,8 +1226,12 @@ impl Invocation {
             | InvocationLabel::ARMPageMap
             | InvocationLabel::RISCVPageTableMap
             | InvocationLabel::RISCVPageMap => "Map",
+            InvocationLabel::ARMPageUnmap | InvocationLabel::RISCVPageUnmap => "Unmap",
+            InvocationLabel::ARMPageUnifyInstruction => "UnifyInstruction",
             InvocationLabel::CNodeCopy => "Copy",
             InvocationLabel::CNodeMint => "Mint",
+            InvocationLabel::CNodeRevoke => "Revoke",
+            InvocationLabel::CNodeDelete => "Delete",
             InvocationLabel::SchedControlConfigureFlags => "ConfigureFlags",
             InvocationLabel::ARMVCPUSetTCB => "VCPUSetTcb",
             _ => panic!(
@@ -1197,6 +1247,7 @@ impl InvocationArgs {
         match self {
             InvocationArgs::UntypedRetype { .. } => InvocationLabel::UntypedRetype,
             InvocationArgs::TcbSetSchedParams { .. } => InvocationLabel::TCBSetSchedParams,
+            InvocationArgs::TcbSetPriority { .. } => InvocationLabel::TCBSetPriority,
             InvocationArgs::TcbSetSpace { .. } => InvocationLabel::TCBSetSpace,
             InvocationArgs::TcbSetIpcBuffer { .. } => InvocationLabel::TCBSetIPCBuffer,
             InvocationArgs::TcbResume { .. } => InvocationLabel::TCBResume,
@@ -1227,6 +1278,16 @@ impl InvocationArgs {
                 InvocationLabel::SchedControlConfigureFlags
             }
             InvocationArgs::ArmVcpuSetTcb { .. } => InvocationLabel::ARMVCPUSetTCB,
+            InvocationArgs::PageUnmap { .. } => match config.arch {
+                Arch::Aarch64 => InvocationLabel::ARMPageUnmap,
+                Arch::Riscv64 => InvocationLabel::RISCVPageUnmap,
+            },
+            InvocationArgs::PageUnifyInstruction { .. } => match config.arch {
+                Arch::Aarch64 => InvocationLabel::ARMPageUnifyInstruction,
+                Arch::Riscv64 => panic!("Instruction cache maintenance is only invoked on AArch64"),
+            },
+            InvocationArgs::CnodeRevoke { .. } => InvocationLabel::CNodeRevoke,
+            InvocationArgs::CnodeDelete { .. } => InvocationLabel::CNodeDelete,
         }
     }
 
@@ -1265,6 +1326,11 @@ impl InvocationArgs {
                 vec![mcp, priority],
                 vec![authority, sched_context, fault_ep],
             ),
+            InvocationArgs::TcbSetPriority {
+                tcb,
+                authority,
+                priority,
+            } => (tcb, vec![priority], vec![authority]),
             InvocationArgs::TcbSetSpace {
                 tcb,
                 fault_ep,
@@ -1401,6 +1467,14 @@ impl InvocationArgs {
                 vec![sched_context],
             ),
             InvocationArgs::ArmVcpuSetTcb { vcpu, tcb } => (vcpu, vec![], vec![tcb]),
+            InvocationArgs::PageUnmap { page } => (page, vec![], vec![]),
+            InvocationArgs::PageUnifyInstruction { page, start, end } => {
+                (page, vec![start, end], vec![])
+            }
+            InvocationArgs::CnodeRevoke { cnode, index, depth }
+            | InvocationArgs::CnodeDelete { cnode, index, depth } => {
+                (cnode, vec![index, depth], vec![])
+            }
         }
     }
 }
@@ -1426,6 +1500,11 @@ pub enum InvocationArgs {
         sched_context: u64,
         fault_ep: u64,
     },
+    TcbSetPriority {
+        tcb: u64,
+        authority: u64,
+        priority: u64,
+    },
     TcbSetSpace {
         tcb: u64,
         fault_ep: u64,
@@ -1533,4 +1612,22 @@ pub enum InvocationArgs {
         vcpu: u64,
         tcb: u64,
     },
+    PageUnmap {
+        page: u64,
+    },
+    PageUnifyInstruction {
+        page: u64,
+        start: u64,
+        end: u64,
+    },
+    CnodeRevoke {
+        cnode: u64,
+        index: u64,
+        depth: u64,
+    },
+    CnodeDelete {
+        cnode: u64,
+        index: u64,
+        depth: u64,
+    },
 }
@@ -0,0 +1,194 @@
+//
+// Copyright 2025, Capabilities Limited
+//
+// SPDX-License-Identifier: BSD-2-Clause
+//
+
+//! A summary of the resources used by a built system. It is written out
+//! with '--stats' so that builds can be compared with 'microkit diff', and
+//! it is what the limits in the system description are checked against.
+
+use crate::sdf::SysLimits;
+use crate::util::comma_sep_u64;
+use serde::{Deserialize, Serialize};
+use std::collections::BTreeMap;
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Serialize, Deserialize)]
+pub struct CountAndBytes {
+    pub count: u64,
+    pub bytes: u64,
+}
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Serialize, Deserialize)]
+pub struct ImagePart {
+    /// Size of the data once loaded
+    pub size: u64,
+    /// Size of the data in the loader image, which is smaller when compressed
+    pub stored_size: u64,
+}
+
+#[derive(Debug, Default, PartialEq, Serialize, Deserialize)]
+pub struct BuildStats {
+    /// Kernel objects created for the system, by object type
+    pub kernel_objects: BTreeMap<String, CountAndBytes>,
+    /// Untyped memory used by kernel objects other than pages
+    pub kernel_memory: u64,
+    /// Paging structures of each PD and VM
+    pub page_tables: BTreeMap<String, u64>,
+    /// System invocations made by the monitor, by label. The count is the
+    /// number of system calls, the bytes are the size in the invocation table.
+    pub invocations: BTreeMap<String, CountAndBytes>,
+    /// What the regions of the loader image hold
+    pub image_parts: BTreeMap<String, ImagePart>,
+    pub image_size: u64,
+    /// Normal (non-device) untyped memory: all of it, what is left once the
+    /// system is created, and the largest allocation that is still possible.
+    pub untyped_total: u64,
+    pub untyped_free: u64,
+    pub untyped_max_alloc: u64,
+}
+
+impl BuildStats {
+    pub fn invocation_count(&self) -> u64 {
+        self.invocations.values().map(|i| i.count).sum()
+    }
+
+    /// Every value in the summary with a name, for comparing two builds.
+    fn metrics(&self) -> BTreeMap<String, u64> {
+        let mut metrics = BTreeMap::new();
+        for (ty, objs) in &self.kernel_objects {
+            metrics.insert(format!("kernel_objects.{}.count", ty), objs.count);
+            metrics.insert(format!("kernel_objects.{}.bytes", ty), objs.bytes);
+        }
+        metrics.insert("kernel_memory".to_string(), self.kernel_memory);
+        for (name, count) in &self.page_tables {
+            metrics.insert(format!("page_tables.{}", name), *count);
+        }
+        for (label, invocations) in &self.invocations {
+            metrics.insert(format!("invocations.{}.count", label), invocations.count);
+            metrics.insert(format!("invocations.{}.bytes", label), invocations.bytes);
+        }
+        metrics.insert("invocations.total.count".to_string(), self.invocation_count());
+        metrics.insert(
+            "invocations.total.bytes".to_string(),
+            self.invocations.values().map(|i| i.bytes).sum(),
+        );
+        for (name, part) in &self.image_parts {
+            metrics.insert(format!("image.{}.size", name), part.size);
+            metrics.insert(format!("image.{}.stored_size", name), part.stored_size);
+        }
+        metrics.insert("image.total".to_string(), self.image_size);
+        metrics.insert("untyped.total".to_string(), self.untyped_total);
+        metrics.insert("untyped.free".to_string(), self.untyped_free);
+        metrics.insert("untyped.max_alloc".to_string(), self.untyped_max_alloc);
+
+        metrics
+    }
+
+    /// Describe every value that differs between 'old' and 'new', one per line.
+    /// Values that only exist in one of the two are compared against zero.
+    pub fn diff(old: &BuildStats, new: &BuildStats) -> Vec<String> {
+        let old_metrics = old.metrics();
+        let new_metrics = new.metrics();
+
+        let mut names: Vec<&String> = old_metrics.keys().chain(new_metrics.keys()).collect();
+        names.sort();
+        names.dedup();
+
+        let mut lines = Vec::new();
+        for name in names {
+            let old_value = old_metrics.get(name).copied().unwrap_or(0);
+            let new_value = new_metrics.get(name).copied().unwrap_or(0);
+            if old_value == new_value {
+                continue;
+            }
+            let delta = new_value as i128 - old_value as i128;
+            let percent = if old_value == 0 {
+                "new".to_string()
+            } else {
+                format!("{:+.1}%", 100.0 * delta as f64 / old_value as f64)
+            };
+            lines.push(format!(
+                "{:<60} {:>16} -> {:>16} {:>+16} ({})",
+                name,
+                comma_sep_u64(old_value),
+                comma_sep_u64(new_value),
+                delta,
+                percent
+            ));
+        }
+
+        lines
+    }
+
+    /// Check the summary against the limits given in the system description,
+    /// returning a description of each limit that is exceeded.
+    pub fn check_limits(&self, limits: &SysLimits) -> Vec<String> {
+        let checks = [
+            ("max_invocations", limits.max_invocations, self.invocation_count(), "number of system invocations"),
+            ("max_kernel_memory", limits.max_kernel_memory, self.kernel_memory, "kernel memory (bytes)"),
+            ("max_image_size", limits.max_image_size, self.image_size, "loader image size (bytes)"),
+        ];
+
+        checks
+            .iter()
+            .filter_map(|(name, limit, value, what)| {
+                let limit = (*limit)?;
+                (*value > limit).then(|| {
+                    format!(
+                        "{} exceeded: {} is {}, the limit is {}",
+                        name,
+                        what,
+                        comma_sep_u64(*value),
+                        comma_sep_u64(limit)
+                    )
+                })
+            })
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_diff_and_limits() {
+        let mut old = BuildStats {
+            kernel_memory: 0x10000,
+            image_size: 1000,
+            ..Default::default()
+        };
+        old.invocations.insert(
+            "UntypedRetype".to_string(),
+            CountAndBytes { count: 10, bytes: 400 },
+        );
+        let mut new = BuildStats {
+            kernel_memory: 0x10000,
+            image_size: 1500,
+            ..Default::default()
+        };
+        new.invocations.insert(
+            "UntypedRetype".to_string(),
+            CountAndBytes { count: 10, bytes: 400 },
+        );
+        new.page_tables.insert("PD=a".to_string(), 3);
+
+        let diff = BuildStats::diff(&old, &new);
+        assert_eq!(diff.len(), 2);
+        assert!(diff[0].starts_with("image.total ") && diff[0].ends_with("(+50.0%)"));
+        assert!(diff[1].starts_with("page_tables.PD=a ") && diff[1].ends_with("(new)"));
+        assert!(BuildStats::diff(&new, &new).is_empty());
+
+        let limits = SysLimits {
+            max_invocations: Some(10),
+            max_kernel_memory: None,
+            max_image_size: Some(1200),
+        };
+        assert!(old.check_limits(&limits).is_empty());
+        assert_eq!(
+            new.check_limits(&limits),
+            vec!["max_image_size exceeded: loader image size (bytes) is 1,500, the limit is 1,200"]
+        );
+    }
+}
@@ -0,0 +1,182 @@
+//
+// Copyright 2025, Capabilities Limited
+//
+// SPDX-License-Identifier: BSD-2-Clause
+//
+
+//! Instrumentation of the tool itself for '--timings': the wall time, heap
+//! allocation and peak resident set size of each phase of building a system.
+//!
+//! Heap use is tracked by 'CountingAlloc', which the tool installs as its
+//! global allocator. Keeping count costs a few relaxed atomic operations per
+//! allocation, so it is always done rather than only with '--timings'.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Instant;
+
+static ALLOCATED: AtomicU64 = AtomicU64::new(0);
+static IN_USE: AtomicU64 = AtomicU64::new(0);
+static PEAK_IN_USE: AtomicU64 = AtomicU64::new(0);
+
+/// The system allocator, keeping count of how much memory is allocated.
+pub struct CountingAlloc;
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc(layout);
+        if !ptr.is_null() {
+            allocated(layout.size() as u64);
+        }
+        ptr
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        let ptr = System.alloc_zeroed(layout);
+        if !ptr.is_null() {
+            allocated(layout.size() as u64);
+        }
+        ptr
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout);
+        IN_USE.fetch_sub(layout.size() as u64, Ordering::Relaxed);
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_ptr = System.realloc(ptr, layout, new_size);
+        if !new_ptr.is_null() {
+            IN_USE.fetch_sub(layout.size() as u64, Ordering::Relaxed);
+            allocated(new_size as u64);
+        }
+        new_ptr
+    }
+}
+
+fn allocated(size: u64) {
+    ALLOCATED.fetch_add(size, Ordering::Relaxed);
+    let in_use = IN_USE.fetch_add(size, Ordering::Relaxed) + size;
+    PEAK_IN_USE.fetch_max(in_use, Ordering::Relaxed);
+}
+
+/// Peak resident set size of the process so far, where the OS tells us.
+fn peak_rss() -> Option<u64> {
+    let status = std::fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|l| l.starts_with("VmHWM:"))?;
+    let kb: u64 = line.split_whitespace().nth(1)?.parse().ok()?;
+    Some(kb * 1024)
+}
+
+struct Phase {
+    name: String,
+    /// Start relative to when timing started, and duration, in microseconds
+    start: u64,
+    duration: u64,
+    /// Bytes allocated during the phase
+    allocated: u64,
+    /// Most heap memory in use at any point during the phase
+    peak_heap: u64,
+    /// Peak resident set size of the process at the end of the phase
+    peak_rss: Option<u64>,
+}
+
+/// A phase that has been started with 'Timings::start'.
+pub struct PhaseStart {
+    name: String,
+    instant: Instant,
+    allocated: u64,
+}
+
+pub struct Timings {
+    enabled: bool,
+    start: Instant,
+    phases: Vec<Phase>,
+}
+
+impl Timings {
+    pub fn new(enabled: bool) -> Timings {
+        Timings {
+            enabled,
+            start: Instant::now(),
+            phases: Vec::new(),
+        }
+    }
+
+    pub fn start(&self, name: impl Into<String>) -> PhaseStart {
+        PEAK_IN_USE.store(IN_USE.load(Ordering::Relaxed), Ordering::Relaxed);
+        PhaseStart {
+            name: name.into(),
+            instant: Instant::now(),
+            allocated: ALLOCATED.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn end(&mut self, phase: PhaseStart) {
+        if !self.enabled {
+            return;
+        }
+        self.phases.push(Phase {
+            name: phase.name,
+            start: phase.instant.duration_since(self.start).as_micros() as u64,
+            duration: phase.instant.elapsed().as_micros() as u64,
+            allocated: ALLOCATED.load(Ordering::Relaxed) - phase.allocated,
+            peak_heap: PEAK_IN_USE.load(Ordering::Relaxed),
+            peak_rss: peak_rss(),
+        });
+    }
+
+    pub fn print(&self) {
+        if !self.enabled {
+            return;
+        }
+        let mib = |bytes: u64| format!("{:.1}", bytes as f64 / (1024.0 * 1024.0));
+        println!(
+            "{:<40} {:>12} {:>16} {:>16} {:>16}",
+            "phase", "time (ms)", "allocated (MiB)", "peak heap (MiB)", "peak RSS (MiB)"
+        );
+        for phase in &self.phases {
+            println!(
+                "{:<40} {:>12.3} {:>16} {:>16} {:>16}",
+                phase.name,
+                phase.duration as f64 / 1000.0,
+                mib(phase.allocated),
+                mib(phase.peak_heap),
+                phase.peak_rss.map_or("-".to_string(), mib)
+            );
+        }
+        println!(
+            "{:<40} {:>12.3}",
+            "total",
+            self.start.elapsed().as_micros() as f64 / 1000.0
+        );
+    }
+
+    /// Write the phases as a trace in the Chrome trace event format, which can be
+    /// opened with about:tracing or Perfetto.
+    pub fn write_chrome_trace(&self, path: &str) -> Result<(), String> {
+        let events: Vec<serde_json::Value> = self
+            .phases
+            .iter()
+            .map(|phase| {
+                serde_json::json!({
+                    "name": phase.name,
+                    "ph": "X",
+                    "ts": phase.start,
+                    "dur": phase.duration,
+                    "pid": std::process::id(),
+                    "tid": 1,
+                    "args": {
+                        "allocated": phase.allocated,
+                        "peak_heap": phase.peak_heap,
+                        "peak_rss": phase.peak_rss,
+                    },
+                })
+            })
+            .collect();
+        let trace = serde_json::json!({ "traceEvents": events });
+
+        std::fs::write(path, trace.to_string())
+            .map_err(|e| format!("Could not write trace file '{}': {}", path, e))
+    }
+}
@@ -46,6 +46,16 @@ fn check_error(test_name: &str, expected_err: &str) {
     assert!(parse_err.starts_with(expected_err));
 }
 
+fn check_success(test_name: &str) {
+    let mut path = std::path::PathBuf::from(env!("CARGO_MANIFEST_DIR"));
+    path.push("tests/sdf/");
+    path.push(test_name);
+    let sdf = std::fs::read_to_string(path).unwrap();
+    if let Err(err) = sdf::parse(test_name, &sdf, &DEFAULT_KERNEL_CONFIG) {
+        panic!("Expected '{}' to parse, got error:\n{}", test_name, err);
+    }
+}
+
 fn check_missing(test_name: &str, attr: &str, element: &str) {
     let expected_error = format!(
         "Error: Missing required attribute '{}' on element '{}'",
@@ -203,6 +213,22 @@ mod protection_domain {
         check_error("pd_budget_gt_period.system", "Error: budget (1000) must be less than, or equal to, period (100) on element 'protection_domain':")
     }
 
+    #[test]
+    fn test_refills_no_period() {
+        check_error(
+            "pd_refills_no_period.system",
+            "Error: refills requires budget to be less than period on element 'protection_domain'",
+        )
+    }
+
+    #[test]
+    fn test_refills_greater_than_max() {
+        check_error(
+            "pd_refills_greater_than_max.system",
+            "Error: refills must be at most 1024 on element 'protection_domain'",
+        )
+    }
+
     #[test]
     fn test_irq_greater_than_max() {
         check_error(
@@ -287,6 +313,44 @@ mod protection_domain {
             "Error: map for 'mr2' has virtual address range [0x1000000..0x1001000) which overlaps with map for 'mr1' [0x1000000..0x1001000) in protection domain 'hello' @"
         )
     }
+
+    #[test]
+    fn test_early_passive() {
+        check_error(
+            "pd_early_passive.system",
+            "Error: passive protection domains cannot be early on element 'protection_domain'",
+        )
+    }
+
+    #[test]
+    fn test_early_with_passive() {
+        // Only early PDs cannot be passive, the rest are started at the monitor's own priority
+        check_success("pd_early_with_passive.system")
+    }
+
+    #[test]
+    fn test_early_child_not_early() {
+        check_error(
+            "pd_early_child_not_early.system",
+            "Error: child of an early protection domain must also be early on element 'protection_domain'",
+        )
+    }
+
+    #[test]
+    fn test_invalid_mode() {
+        check_error(
+            "pd_invalid_mode.system",
+            "Error: mode must be 'event' or 'poll' on element 'protection_domain'",
+        )
+    }
+
+    #[test]
+    fn test_passive_poll() {
+        check_error(
+            "pd_passive_poll.system",
+            "Error: passive protection domains cannot poll on element 'protection_domain'",
+        )
+    }
 }
 
 #[cfg(test)]
@@ -428,6 +492,22 @@ mod channel {
         )
     }
 
+    #[test]
+    fn test_invalid_dispatch_priority() {
+        check_error(
+            "ch_invalid_dispatch_priority.system",
+            "Error: dispatch_priority must be between 0 and 255 on element 'end': ",
+        )
+    }
+
+    #[test]
+    fn test_buffer_unaligned_size() {
+        check_error(
+            "ch_buffer_unaligned_size.system",
+            "Error: buffer size must be a non-zero multiple of the page size on element 'channel': ",
+        )
+    }
+
     #[test]
     fn test_bidirectional_ppc() {
         check_error(
@@ -445,6 +525,72 @@ mod channel {
     }
 }
 
+#[cfg(test)]
+mod broadcast {
+    use super::*;
+
+    #[test]
+    fn test_missing_producer() {
+        check_error(
+            "bc_missing_producer.system",
+            "Error: exactly one producer element must be specified on element 'broadcast': ",
+        )
+    }
+
+    #[test]
+    fn test_id_greater_than_max() {
+        check_error(
+            "bc_id_greater_than_max.system",
+            "Error: id must be < 8 on element 'producer': ",
+        )
+    }
+
+    #[test]
+    fn test_duplicate_id() {
+        check_error(
+            "bc_duplicate_id.system",
+            "Error: duplicate broadcast id: 0 in protection domain: 'test1' @ ",
+        )
+    }
+
+    #[test]
+    fn test_duplicate_channel_id() {
+        check_error(
+            "bc_duplicate_channel_id.system",
+            "Error: duplicate channel id: 1 in protection domain: 'test2' @ ",
+        )
+    }
+}
+
+#[cfg(test)]
+mod template {
+    use super::*;
+
+    #[test]
+    fn test_duplicate_id() {
+        check_error(
+            "tmpl_duplicate_id.system",
+            "Error: duplicate template id 0 on element 'template': ",
+        )
+    }
+
+    #[test]
+    fn test_duplicate_channel_id() {
+        check_error(
+            "tmpl_duplicate_channel_id.system",
+            "Error: duplicate channel id: 3 in protection domain: 'test1' @ ",
+        )
+    }
+
+    #[test]
+    fn test_missing_program_image() {
+        check_error(
+            "tmpl_missing_program_image.system",
+            "Error: missing 'program_image' element on template: 'worker'",
+        )
+    }
+}
+
 #[cfg(test)]
 mod system {
     use super::*;
@@ -529,6 +675,30 @@ mod system {
         )
     }
 
+    #[test]
+    fn test_map_offset_not_aligned() {
+        check_error(
+            "sys_map_offset_not_aligned.system",
+            "Error: invalid offset alignment on 'map' @ ",
+        )
+    }
+
+    #[test]
+    fn test_map_outside_mr() {
+        check_error(
+            "sys_map_outside_mr.system",
+            "Error: map for 'foo' with offset 0x2000 and size 0x4000 is outside of the memory region of size 0x4000 @ ",
+        )
+    }
+
+    #[test]
+    fn test_map_offset_outside_mr_with_buffer() {
+        check_error(
+            "sys_map_offset_outside_mr_with_buffer.system",
+            "Error: map for 'foo' with offset 0x8000 and size 0x0 is outside of the memory region of size 0x4000 @ ",
+        )
+    }
+
     #[test]
     fn test_map_too_high() {
         check_error(
@@ -537,6 +707,22 @@ mod system {
         )
     }
 
+    #[test]
+    fn test_duplicate_limits() {
+        check_error(
+            "sys_duplicate_limits.system",
+            "Error: duplicate limits element: ",
+        )
+    }
+
+    #[test]
+    fn test_limits_invalid_attr() {
+        check_error(
+            "sys_limits_invalid_attr.system",
+            "Error: invalid attribute 'max_pds' on element 'limits': ",
+        )
+    }
+
     #[test]
     fn test_too_many_pds() {
         check_error(